@@ -0,0 +1,403 @@
+/* BlockCapture.cpp
+ *
+ * This implements reading and writing the block capture container.
+ *   A block's checksum is the message checksum of its frame bytes; it is summed
+ *   frame by frame as the block fills, since the sum of the parts is the sum
+ *   of the whole.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "BlockCapture.h"
+#include "FrameCodec.h"
+#include "Checksum.h"
+
+#include <assert.h>     /* assert */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+
+/*
+ * @brief byte offsets of the file header, block header and trailer fields
+ */
+enum
+{
+    blockCaptureHeader_magic         = 0,
+    blockCaptureHeader_version       = 4,
+    blockCaptureHeader_blockSize     = 8,
+
+    blockCaptureBlock_frameCount     = 0,
+    blockCaptureBlock_frameBytes     = 4,
+    blockCaptureBlock_minEpoch       = 8,
+    blockCaptureBlock_maxEpoch       = 12,
+    blockCaptureBlock_checksum       = 16,
+    blockCaptureBlock_commandBitmap  = 32,
+
+    blockCaptureTrailer_footerOffset = 0,
+    blockCaptureTrailer_blockCount   = 8,
+    blockCaptureTrailer_magic        = 12,
+};
+
+static_assert( blockCaptureBlock_commandBitmap + blockCapture_commandBitmapSize <= blockCapture_blockHeaderSize,
+               "command bitmap does not fit the block header" );
+
+static const char blockCaptureHeaderMagic[]  = "TTBC";
+static const char blockCaptureTrailerMagic[] = "TTBF";
+
+
+
+static void encodeBlockHeader(const BlockCapture_Block* block, uint8_t* bytes)
+{
+    memset(bytes, 0, blockCapture_blockHeaderSize);
+
+    storeLittle<uint32_t>(&bytes[blockCaptureBlock_frameCount], block->frameCount);
+    storeLittle<uint32_t>(&bytes[blockCaptureBlock_frameBytes], block->frameBytes);
+    storeLittle<uint32_t>(&bytes[blockCaptureBlock_minEpoch], block->minEpoch_seconds);
+    storeLittle<uint32_t>(&bytes[blockCaptureBlock_maxEpoch], block->maxEpoch_seconds);
+    storeLittle<uint16_t>(&bytes[blockCaptureBlock_checksum], block->checksum);
+
+    memcpy(&bytes[blockCaptureBlock_commandBitmap], block->commandBitmap, blockCapture_commandBitmapSize);
+}
+
+static void decodeBlockHeader(const uint8_t* bytes, BlockCapture_Block* block)
+{
+    block->frameCount       = loadLittle<uint32_t>(&bytes[blockCaptureBlock_frameCount]);
+    block->frameBytes       = loadLittle<uint32_t>(&bytes[blockCaptureBlock_frameBytes]);
+    block->minEpoch_seconds = loadLittle<uint32_t>(&bytes[blockCaptureBlock_minEpoch]);
+    block->maxEpoch_seconds = loadLittle<uint32_t>(&bytes[blockCaptureBlock_maxEpoch]);
+    block->checksum         = loadLittle<uint16_t>(&bytes[blockCaptureBlock_checksum]);
+
+    memcpy(block->commandBitmap, &bytes[blockCaptureBlock_commandBitmap], blockCapture_commandBitmapSize);
+}
+
+static void clearBlock(BlockCapture_Block* block)
+{
+    memset(block, 0, sizeof(BlockCapture_Block));
+
+    block->minEpoch_seconds = UINT32_MAX;
+}
+
+
+
+BlockCapture::BlockCapture()
+{
+    this->capture    = NULL;
+    this->blockSize  = 0;
+    this->blockCount = 0;
+    this->footer     = NULL;
+}
+
+/*
+* @brief Find out whether bytes start and end like a block capture
+*
+* @param capture     - the capture bytes
+* @param captureSize - number of bytes in capture
+* @return            capture has a block capture header and trailer
+*/
+bool BlockCapture::isBlockCapture(const uint8_t* capture, uint64_t captureSize)
+{
+    assert( capture || captureSize == 0 );
+
+    if( captureSize < blockCapture_fileHeaderSize + blockCapture_trailerSize )
+        return false;
+
+    return isBlockCaptureEnds(capture, &capture[captureSize - blockCapture_trailerSize]);
+}
+
+/*
+* @brief Find out whether a file header and trailer, read on their own, are those of a block capture
+*        This lets a reader check a file without mapping all of it.
+*
+* @param header  - the first blockCapture_fileHeaderSize bytes of the file
+* @param trailer - the last blockCapture_trailerSize bytes of the file
+* @return          both carry their magic
+*/
+bool BlockCapture::isBlockCaptureEnds(const uint8_t* header, const uint8_t* trailer)
+{
+    assert( header );
+    assert( trailer );
+
+    return memcmp(&header[blockCaptureHeader_magic], blockCaptureHeaderMagic, 4) == 0
+        && memcmp(&trailer[blockCaptureTrailer_magic], blockCaptureTrailerMagic, 4) == 0;
+}
+
+/*
+* @brief Check the layout of a block capture and read its footer
+*        The bytes must stay valid while the blocks are used.
+*
+* @param capture     - the capture bytes
+* @param captureSize - number of bytes in capture
+* @return            layout valid
+*/
+bool BlockCapture::open(const uint8_t* capture, uint64_t captureSize)
+{
+    this->capture    = NULL;
+    this->blockSize  = 0;
+    this->blockCount = 0;
+    this->footer     = NULL;
+
+    if( !isBlockCapture(capture, captureSize) )
+        return false;
+
+    const uint8_t* trailer      = &capture[captureSize - blockCapture_trailerSize];
+    uint32_t       blockSize    = loadLittle<uint32_t>(&capture[blockCaptureHeader_blockSize]);
+    uint32_t       blockCount   = loadLittle<uint32_t>(&trailer[blockCaptureTrailer_blockCount]);
+    uint64_t       footerOffset = loadLittle<uint64_t>(&trailer[blockCaptureTrailer_footerOffset]);
+
+    if(   loadLittle<uint16_t>(&capture[blockCaptureHeader_version]) != blockCapture_version
+       || blockSize < blockCapture_minBlockSize
+       || footerOffset != blockCapture_fileHeaderSize + (uint64_t)blockCount * blockSize
+       || footerOffset + (uint64_t)blockCount * blockCapture_blockHeaderSize + blockCapture_trailerSize != captureSize
+      )
+    {
+        return false;
+    }
+
+    this->capture    = capture;
+    this->blockSize  = blockSize;
+    this->blockCount = blockCount;
+    this->footer     = &capture[footerOffset];
+
+    return true;
+}
+
+/*
+* @brief Get the number of blocks
+*
+* @return block count
+*/
+uint32_t BlockCapture::getBlockCount(void)
+{
+    return this->blockCount;
+}
+
+/*
+* @brief Get a block's summary from the footer, without touching the block
+*
+* @param[in]  index - index of the block, below getBlockCount
+* @param[out] block - the block
+*/
+void BlockCapture::getBlock(uint32_t index, BlockCapture_Block* block)
+{
+    assert( index < this->blockCount );
+    assert( block );
+
+    decodeBlockHeader(&this->footer[(size_t)index * blockCapture_blockHeaderSize], block);
+
+    block->frames = &this->capture[blockCapture_fileHeaderSize + (uint64_t)index * this->blockSize + blockCapture_blockHeaderSize];
+}
+
+/*
+* @brief Check that a block's header matches the footer and its frames match the checksum
+*
+* @param index - index of the block, below getBlockCount
+* @return      block valid
+*/
+bool BlockCapture::verifyBlock(uint32_t index)
+{
+    assert( index < this->blockCount );
+
+    BlockCapture_Block block;
+    this->getBlock(index, &block);
+
+    const uint8_t* header = block.frames - blockCapture_blockHeaderSize;
+
+    return memcmp(header, &this->footer[(size_t)index * blockCapture_blockHeaderSize], blockCapture_blockHeaderSize) == 0
+        && block.frameBytes <= this->blockSize - blockCapture_blockHeaderSize
+        && generateChecksum(block.frames, block.frameBytes) == block.checksum;
+}
+
+
+
+BlockCaptureWriter::BlockCaptureWriter(uint32_t blockSize)
+{
+    assert( blockSize >= blockCapture_minBlockSize );
+
+    this->file           = NULL;
+    this->blockSize      = blockSize;
+    this->block          = NULL;
+    this->footer         = NULL;
+    this->blockCount     = 0;
+    this->footerCapacity = 0;
+    this->failed         = false;
+
+    clearBlock(&this->summary);
+}
+
+BlockCaptureWriter::~BlockCaptureWriter()
+{
+    if( this->file )
+        fclose(this->file);
+
+    free(this->block);
+    free(this->footer);
+}
+
+/*
+* @brief Create a block capture, replacing any file at path
+*
+* @param path - file to write
+* @return     file created
+*/
+bool BlockCaptureWriter::open(const char* path)
+{
+    assert( path );
+    assert( this->file == NULL );
+
+    if( this->block == NULL )
+        this->block = (uint8_t*)calloc(1, this->blockSize);
+
+    if( this->block == NULL )
+        return false;
+
+    this->file = fopen(path, "wb");
+
+    if( this->file == NULL )
+        return false;
+
+    uint8_t header[blockCapture_fileHeaderSize];
+
+    memset(header, 0, sizeof(header));
+    memcpy(&header[blockCaptureHeader_magic], blockCaptureHeaderMagic, 4);
+    storeLittle<uint16_t>(&header[blockCaptureHeader_version], blockCapture_version);
+    storeLittle<uint32_t>(&header[blockCaptureHeader_blockSize], this->blockSize);
+
+    this->blockCount = 0;
+    this->failed     = fwrite(header, 1, sizeof(header), this->file) != sizeof(header);
+
+    clearBlock(&this->summary);
+
+    return !this->failed;
+}
+
+/*
+* @brief Add a message, starting a new block when it does not fit in the current one
+*
+* @param frame     - the whole message, as getSerialized or a MessageView gives it
+* @param frameSize - number of bytes in frame
+* @return          message written
+*/
+bool BlockCaptureWriter::addFrame(const uint8_t* frame, uint32_t frameSize)
+{
+    assert( frame );
+    assert( frameSize >= fieldIndex_payload );
+    assert( this->file );
+
+    uint32_t space = this->blockSize - blockCapture_blockHeaderSize;
+
+    if( this->failed || frameSize > space )
+        return false;
+
+    if( this->summary.frameBytes + frameSize > space && !this->flushBlock() )
+        return false;
+
+    memcpy(&this->block[blockCapture_blockHeaderSize + this->summary.frameBytes], frame, frameSize);
+
+    uint16_t commandCode = frameCodec_commandCode::read(frame);
+    uint8_t  bit         = (uint8_t)commandCode;
+
+    this->summary.commandBitmap[bit / 8] |= (uint8_t)(1 << (bit % 8));
+
+    if(   commandCode == MESSAGE_HANDLER_COMMAND_HEARTBEAT
+       && frameSize >= fieldIndex_payload + sizeof(MessageHandler_HeartbeatPayload)
+      )
+    {
+        MessageHandler_HeartbeatPayload heartbeat;
+        frameCodec_heartbeat::decode(&frame[fieldIndex_payload], &heartbeat);
+
+        if( heartbeat.epochTime_seconds < this->summary.minEpoch_seconds )
+            this->summary.minEpoch_seconds = heartbeat.epochTime_seconds;
+
+        if( heartbeat.epochTime_seconds > this->summary.maxEpoch_seconds )
+            this->summary.maxEpoch_seconds = heartbeat.epochTime_seconds;
+    }
+
+    this->summary.checksum   += generateChecksum(frame, frameSize);
+    this->summary.frameBytes += frameSize;
+    this->summary.frameCount++;
+
+    return true;
+}
+
+/*
+* @brief Write the last block, the footer and the trailer, then close the file
+*
+* @return capture complete
+*/
+bool BlockCaptureWriter::close(void)
+{
+    if( this->file == NULL )
+        return false;
+
+    if( this->summary.frameCount > 0 )
+        this->flushBlock();
+
+    uint64_t footerOffset = blockCapture_fileHeaderSize + (uint64_t)this->blockCount * this->blockSize;
+    size_t   footerSize   = (size_t)this->blockCount * blockCapture_blockHeaderSize;
+    uint8_t  trailer[blockCapture_trailerSize];
+
+    storeLittle<uint64_t>(&trailer[blockCaptureTrailer_footerOffset], footerOffset);
+    storeLittle<uint32_t>(&trailer[blockCaptureTrailer_blockCount], this->blockCount);
+    memcpy(&trailer[blockCaptureTrailer_magic], blockCaptureTrailerMagic, 4);
+
+    if(   (footerSize > 0 && fwrite(this->footer, 1, footerSize, this->file) != footerSize)
+       || fwrite(trailer, 1, sizeof(trailer), this->file) != sizeof(trailer)
+      )
+    {
+        this->failed = true;
+    }
+
+    if( fclose(this->file) != 0 )
+        this->failed = true;
+
+    this->file = NULL;
+
+    return !this->failed;
+}
+
+/*
+* @brief Write the current block and start an empty one
+*
+* @return block written
+*/
+bool BlockCaptureWriter::flushBlock(void)
+{
+    if( this->blockCount == this->footerCapacity )
+    {
+        uint32_t capacity = this->footerCapacity ? this->footerCapacity * 2 : 64;
+        void*    grown    = realloc(this->footer, (size_t)capacity * blockCapture_blockHeaderSize);
+
+        if( grown == NULL )
+        {
+            this->failed = true;
+            return false;
+        }
+
+        this->footer         = (uint8_t*)grown;
+        this->footerCapacity = capacity;
+    }
+
+    encodeBlockHeader(&this->summary, this->block);
+
+    if( fwrite(this->block, 1, this->blockSize, this->file) != this->blockSize )
+    {
+        this->failed = true;
+        return false;
+    }
+
+    memcpy(&this->footer[(size_t)this->blockCount * blockCapture_blockHeaderSize], this->block, blockCapture_blockHeaderSize);
+    this->blockCount++;
+
+    memset(this->block, 0, this->blockSize);
+    clearBlock(&this->summary);
+
+    return true;
+}
+
+
+
+// EOF
@@ -0,0 +1,220 @@
+/* BlockCapture.h
+ *
+ * This defines a capture container that packs verified messages into fixed size
+ *   blocks, so a reader can skip, check and decode blocks on their own.
+ *
+ *   A block capture is a file header, then blocks of blockSize bytes, then a
+ *   footer holding a copy of every block header, then a trailer at the very end
+ *   of the file. Each block header summarizes the frames after it: how many
+ *   there are, the range of heartbeat epoch times, which command codes appear
+ *   and a checksum of the frame bytes. The rest of a block is zero padding.
+ *   Every field is little-endian.
+ *
+ *   Frames are stored exactly as they are on the wire, so parsing a block
+ *   capture as a raw capture still finds every message in it.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef BlockCapture_h
+#define BlockCapture_h
+
+#include "MessageHandler.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+
+/*
+ * @brief container layout
+ */
+enum
+{
+    blockCapture_version          = 1,
+
+    blockCapture_fileHeaderSize   = 64,     /* magic, version, block size */
+    blockCapture_blockHeaderSize  = 64,     /* frame count, frame bytes, epoch range, checksum, command bitmap */
+    blockCapture_trailerSize      = 16,     /* footer offset, block count, magic */
+
+    blockCapture_commandBitmapSize = 32,    /* one bit for the low byte of every command code */
+
+    blockCapture_maxFrameSize     = fieldIndex_payload + UINT16_MAX,
+    blockCapture_minBlockSize     = blockCapture_blockHeaderSize + blockCapture_maxFrameSize,
+    blockCapture_defaultBlockSize = 128 * 1024,
+};
+
+/*
+ * @brief what a block header says about its frames
+ */
+typedef struct
+{
+    uint32_t       frameCount;
+    uint32_t       frameBytes;          /* frames run back to back from the end of the block header */
+    uint32_t       minEpoch_seconds;    /* heartbeats only; UINT32_MAX and 0 when there are none */
+    uint32_t       maxEpoch_seconds;
+    uint16_t       checksum;            /* generateChecksum of the frame bytes */
+    uint8_t        commandBitmap[blockCapture_commandBitmapSize];
+    const uint8_t* frames;              /* set by BlockCapture::getBlock */
+} BlockCapture_Block;
+
+
+
+/*
+ * @brief Find out whether a block may hold messages with a command code
+ *
+ * @param block       - block to check
+ * @param commandCode - command code
+ * @return            a message in the block has a command code with the same low byte
+ */
+static inline bool isCommandInBlock(const BlockCapture_Block* block, uint16_t commandCode)
+{
+    uint8_t bit = (uint8_t)commandCode;
+
+    return (block->commandBitmap[bit / 8] >> (bit % 8)) & 1;
+}
+
+/*
+ * @brief Find out whether a block may hold heartbeats from a time range
+ *
+ * @param block             - block to check
+ * @param fromEpoch_seconds - start of the range, inclusive
+ * @param toEpoch_seconds   - end of the range, inclusive
+ * @return                  the block's heartbeat epoch times overlap the range
+ */
+static inline bool isEpochInBlock(const BlockCapture_Block* block, uint32_t fromEpoch_seconds, uint32_t toEpoch_seconds)
+{
+    return block->minEpoch_seconds <= toEpoch_seconds && block->maxEpoch_seconds >= fromEpoch_seconds;
+}
+
+
+
+/*
+ * @brief Reads a block capture held in memory, normally a whole mapped CaptureFile span
+ */
+class BlockCapture
+{
+    public:
+
+        BlockCapture();
+
+        /*
+         * @brief Find out whether bytes start and end like a block capture
+         *
+         * @param capture     - the capture bytes
+         * @param captureSize - number of bytes in capture
+         * @return            capture has a block capture header and trailer
+         */
+        static bool isBlockCapture(const uint8_t* capture, uint64_t captureSize);
+
+        /*
+         * @brief Find out whether a file header and trailer, read on their own, are those of a block capture
+         *        This lets a reader check a file without mapping all of it.
+         *
+         * @param header  - the first blockCapture_fileHeaderSize bytes of the file
+         * @param trailer - the last blockCapture_trailerSize bytes of the file
+         * @return          both carry their magic
+         */
+        static bool isBlockCaptureEnds(const uint8_t* header, const uint8_t* trailer);
+
+        /*
+         * @brief Check the layout of a block capture and read its footer
+         *        The bytes must stay valid while the blocks are used.
+         *
+         * @param capture     - the capture bytes
+         * @param captureSize - number of bytes in capture
+         * @return            layout valid
+         */
+        bool open(const uint8_t* capture, uint64_t captureSize);
+
+        /*
+         * @brief Get the number of blocks
+         *
+         * @return block count
+         */
+        uint32_t getBlockCount(void);
+
+        /*
+         * @brief Get a block's summary from the footer, without touching the block
+         *
+         * @param[in]  index - index of the block, below getBlockCount
+         * @param[out] block - the block
+         */
+        void getBlock(uint32_t index, BlockCapture_Block* block);
+
+        /*
+         * @brief Check that a block's header matches the footer and its frames match the checksum
+         *
+         * @param index - index of the block, below getBlockCount
+         * @return      block valid
+         */
+        bool verifyBlock(uint32_t index);
+
+    private:
+        const uint8_t* capture;
+        uint32_t       blockSize;
+        uint32_t       blockCount;
+        const uint8_t* footer;
+};
+
+
+
+/*
+ * @brief Writes verified messages into a block capture
+ */
+class BlockCaptureWriter
+{
+    public:
+
+        /*
+         * @param blockSize - bytes per block, at least blockCapture_minBlockSize
+         */
+        BlockCaptureWriter(uint32_t blockSize = blockCapture_defaultBlockSize);
+        ~BlockCaptureWriter();
+
+        /*
+         * @brief Create a block capture, replacing any file at path
+         *
+         * @param path - file to write
+         * @return     file created
+         */
+        bool open(const char* path);
+
+        /*
+         * @brief Add a message, starting a new block when it does not fit in the current one
+         *
+         * @param frame     - the whole message, as getSerialized or a MessageView gives it
+         * @param frameSize - number of bytes in frame
+         * @return          message written
+         */
+        bool addFrame(const uint8_t* frame, uint32_t frameSize);
+
+        /*
+         * @brief Write the last block, the footer and the trailer, then close the file
+         *
+         * @return capture complete
+         */
+        bool close(void);
+
+    private:
+        /*
+         * @brief Write the current block and start an empty one
+         *
+         * @return block written
+         */
+        bool flushBlock(void);
+
+        FILE*              file;
+        uint32_t           blockSize;
+        uint8_t*           block;
+        BlockCapture_Block summary;
+
+        uint8_t*           footer;
+        uint32_t           blockCount;
+        uint32_t           footerCapacity;
+        bool               failed;
+};
+
+
+#endif // BlockCapture_h
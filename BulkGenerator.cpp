@@ -0,0 +1,831 @@
+/* BulkGenerator.cpp
+ *
+ * This implements a class that generates a large capture of random messages from a spec.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "BulkGenerator.h"
+#include "FrameCodec.h"
+#include "Checksum.h"
+#include "cJSON.h"
+
+#include <assert.h>     /* assert */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+
+using namespace std;
+
+
+
+/*
+ * @brief frame sizes planned for a chunk before it has to grow
+ */
+enum
+{
+    bulkGenerator_plannedFrameSize = 32,
+};
+
+/*
+ * @brief heartbeat field ranges
+ */
+enum
+{
+    bulkGenerator_minVoltage_cV    = 2300,
+    bulkGenerator_voltageRange_cV  = 600,
+    bulkGenerator_minTemperature_C = 10,
+    bulkGenerator_temperatureRange = 60,
+    bulkGenerator_modeCount        = 4,
+};
+
+enum
+{
+    bulkGenerator_maxFrameSize       = fieldIndex_payload + bulkGenerator_maxJsonSize,
+    bulkGenerator_defaultGarbageSize = 64,
+};
+
+static const char* sarModes[] = { "high", "low", "scan", "standby" };
+
+static const uint16_t knownCommandCodes[bulkGenerator_maxMixEntries] =
+{
+    MESSAGE_HANDLER_COMMAND_HEARTBEAT,
+    MESSAGE_HANDLER_COMMAND_SETSARMODE,
+    MESSAGE_HANDLER_COMMAND_SETSTANDBYSTATE,
+};
+
+/*
+ * @brief splitmix64: every call gives the next value of the stream in state
+ */
+static inline uint64_t nextRandom(uint64_t* state)
+{
+    uint64_t value = (*state += 0x9E3779B97F4A7C15ull);
+
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+
+    return value ^ (value >> 31);
+}
+
+/*
+ * @brief Pick an index with chance in proportion to its weight; the weights must not all be 0
+ */
+static uint32_t pickWeighted(const uint32_t* weights, uint32_t count, uint64_t* state)
+{
+    uint64_t total = 0;
+
+    for(uint32_t i = 0; i < count; i++)
+        total += weights[i];
+
+    uint64_t pick = nextRandom(state) % total;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if( pick < weights[i] )
+            return i;
+
+        pick -= weights[i];
+    }
+
+    return count - 1;
+}
+
+/*
+ * @brief Draw whether something with the given chance, from 0 to 1, happens
+ */
+static inline bool drawChance(double chance, uint64_t* state)
+{
+    return chance > 0 && (double)(nextRandom(state) >> 11) * 0x1.0p-53 < chance;
+}
+
+/*
+ * @brief Make room for at least needed bytes of frames, doubling as it goes
+ *
+ * @return room made; the frames are unchanged when it could not be
+ */
+static bool reserveFrames(uint8_t** frames, size_t* capacity, size_t needed)
+{
+    if( needed <= *capacity )
+        return true;
+
+    size_t   grownCapacity = max(*capacity * 2, needed);
+    uint8_t* grown         = (uint8_t*)realloc(*frames, grownCapacity);
+
+    if( grown == NULL )
+        return false;
+
+    *frames   = grown;
+    *capacity = grownCapacity;
+
+    return true;
+}
+
+/*
+ * @brief Write JSON text of exactly size bytes, printed as cJSON_PrintUnformatted would print it,
+ *        so the payload goes out as it is
+ *
+ * @param[out] text - room for size bytes and a NUL
+ * @param[in]  size - bulkGenerator_minJsonSize to bulkGenerator_maxJsonSize
+ * @param[in]  mode - value of the mode member
+ */
+static void buildJson(char* text, uint32_t size, const char* mode)
+{
+    static const char modeStart[] = "{\"mode\":\"";
+    static const char padStart[]  = "\",\"pad\":\"";
+    static const char end[]       = "\"}";
+
+    uint32_t modeLength = (uint32_t)strlen(mode);
+    uint32_t used       = sizeof(modeStart) - 1;
+
+    memcpy(text, modeStart, used);
+
+    if( size >= used + modeLength + (sizeof(padStart) - 1) + (sizeof(end) - 1) )
+    {
+        memcpy(&text[used], mode, modeLength);
+        used += modeLength;
+
+        memcpy(&text[used], padStart, sizeof(padStart) - 1);
+        used += sizeof(padStart) - 1;
+    }
+    else
+    {
+        // Too short for a pad member, so the mode is cut short or padded itself
+        uint32_t valueLength = size - used - (sizeof(end) - 1);
+        uint32_t copied      = (valueLength < modeLength) ? valueLength : modeLength;
+
+        memcpy(&text[used], mode, copied);
+        used += copied;
+    }
+
+    uint32_t padLength = size - used - (sizeof(end) - 1);
+
+    memset(&text[used], 'x', padLength);
+    used += padLength;
+
+    memcpy(&text[used], end, sizeof(end));
+}
+
+/*
+ * @brief Make the JSON of a serialized Set Sar Mode message invalid by dropping its closing
+ *        brace, then fix up the payload checksum so the message still verifies
+ *
+ * @param frame - the whole message
+ */
+static void breakJson(uint8_t* frame)
+{
+    uint16_t payloadLength = frameCodec_payloadSize::read(frame);
+
+    frame[fieldIndex_payload + payloadLength - 1] = ' ';
+
+    frameCodec_dataChecksum::write(frame, generateChecksum(&frame[fieldIndex_payload], payloadLength));
+}
+
+/*
+ * @brief Read an optional number member of the spec
+ *
+ * @param[in]     spec  - the spec object
+ * @param[in]     name  - member name
+ * @param[in]     min   - smallest value allowed
+ * @param[in]     max   - largest value allowed
+ * @param[in,out] value - left as it is when the member is missing
+ * @return        member missing, or a number in range
+ */
+static bool readNumber(const cJSON* spec, const char* name, double min, double max, double* value)
+{
+    const cJSON* item = cJSON_GetObjectItemCaseSensitive(spec, name);
+
+    if( item == NULL )
+        return true;
+
+    if( !cJSON_IsNumber(item) || item->valuedouble < min || item->valuedouble > max )
+    {
+        fprintf(stderr, "Error - spec: %s must be a number from %.0f to %.0f\n", name, min, max);
+        return false;
+    }
+
+    *value = item->valuedouble;
+
+    return true;
+}
+
+/*
+ * @brief Read the mix member: command codes in hex, each with its weight
+ */
+static bool readMix(const cJSON* mix, BulkGenerator_Spec* spec)
+{
+    uint64_t total = 0;
+
+    if( !cJSON_IsObject(mix) )
+    {
+        fprintf(stderr, "Error - spec: mix must be an object\n");
+        return false;
+    }
+
+    spec->mixCount = 0;
+
+    for(const cJSON* item = mix->child; item; item = item->next)
+    {
+        char*    end;
+        uint16_t commandCode = (uint16_t)strtoul(item->string, &end, 16);
+        bool     known       = false;
+
+        for(uint32_t i = 0; i < bulkGenerator_maxMixEntries; i++)
+            known = known || (commandCode == knownCommandCodes[i]);
+
+        if( *end != '\0' || !known )
+        {
+            fprintf(stderr, "Error - spec: mix has unknown command code %s\n", item->string);
+            return false;
+        }
+
+        if( !cJSON_IsNumber(item) || item->valuedouble < 0 || item->valuedouble > UINT32_MAX )
+        {
+            fprintf(stderr, "Error - spec: mix weight for %s must be a number from 0 to %u\n", item->string, UINT32_MAX);
+            return false;
+        }
+
+        uint32_t entry = 0;
+
+        while( entry < spec->mixCount && spec->mix[entry].commandCode != commandCode )
+            entry++;
+
+        if( entry == spec->mixCount )
+            spec->mixCount++;
+
+        spec->mix[entry].commandCode = commandCode;
+        spec->mix[entry].weight      = (uint32_t)item->valuedouble;
+    }
+
+    for(uint32_t i = 0; i < spec->mixCount; i++)
+        total += spec->mix[i].weight;
+
+    if( total == 0 )
+    {
+        fprintf(stderr, "Error - spec: mix must give some command code a weight\n");
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * @brief Read the priorities member: weights for priority 0 onwards
+ */
+static bool readPriorities(const cJSON* priorities, BulkGenerator_Spec* spec)
+{
+    uint64_t total = 0;
+    uint32_t count = 0;
+
+    if( !cJSON_IsArray(priorities) || cJSON_GetArraySize(priorities) > bulkGenerator_priorityCount )
+    {
+        fprintf(stderr, "Error - spec: priorities must be an array of at most %u weights\n", bulkGenerator_priorityCount);
+        return false;
+    }
+
+    memset(spec->priorityWeights, 0, sizeof(spec->priorityWeights));
+
+    for(const cJSON* item = priorities->child; item; item = item->next)
+    {
+        if( !cJSON_IsNumber(item) || item->valuedouble < 0 || item->valuedouble > UINT32_MAX )
+        {
+            fprintf(stderr, "Error - spec: priority %u weight must be a number from 0 to %u\n", count, UINT32_MAX);
+            return false;
+        }
+
+        spec->priorityWeights[count] = (uint32_t)item->valuedouble;
+        total                       += spec->priorityWeights[count];
+        count++;
+    }
+
+    if( total == 0 )
+    {
+        fprintf(stderr, "Error - spec: priorities must give some priority a weight\n");
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * @brief Read the faults member: the chance of each fault, and the most garbage put in at once
+ */
+static bool readFaults(const cJSON* faults, BulkGenerator_Spec* spec)
+{
+    if( !cJSON_IsObject(faults) )
+    {
+        fprintf(stderr, "Error - spec: faults must be an object\n");
+        return false;
+    }
+
+    BulkGenerator_Faults* rates          = &spec->faults;
+    double                maxGarbageSize = rates->maxGarbageSize;
+
+    bool valid =    readNumber(faults, "garbage",         0, 1, &rates->garbage)
+                 && readNumber(faults, "spuriousT",       0, 1, &rates->spuriousT)
+                 && readNumber(faults, "bitFlip",         0, 1, &rates->bitFlip)
+                 && readNumber(faults, "truncate",        0, 1, &rates->truncate)
+                 && readNumber(faults, "headerChecksum",  0, 1, &rates->headerChecksum)
+                 && readNumber(faults, "payloadChecksum", 0, 1, &rates->payloadChecksum)
+                 && readNumber(faults, "maxGarbage",      1, bulkGenerator_maxGarbageSize, &maxGarbageSize);
+
+    rates->maxGarbageSize = (uint32_t)maxGarbageSize;
+    spec->groundTruth     = true;
+
+    return valid;
+}
+
+
+
+/*
+* @brief Fill a spec with the defaults: heartbeats only, priority 0, one device
+*
+* @param[out] spec - spec to fill
+*/
+void BulkGenerator::setDefaultSpec(BulkGenerator_Spec* spec)
+{
+    assert( spec );
+
+    memset(spec, 0, sizeof(BulkGenerator_Spec));
+
+    spec->seed               = 1;
+    spec->deviceCount        = 1;
+    spec->firstSerialNumber  = 1;
+    spec->startEpoch_seconds = 1530000000;
+    spec->messagesPerSecond  = 1;
+
+    spec->mix[0].commandCode = MESSAGE_HANDLER_COMMAND_HEARTBEAT;
+    spec->mix[0].weight      = 1;
+    spec->mixCount           = 1;
+
+    spec->priorityWeights[0] = 1;
+
+    spec->minJsonSize = bulkGenerator_minJsonSize;
+    spec->maxJsonSize = bulkGenerator_maxJsonSize;
+
+    spec->faults.maxGarbageSize = bulkGenerator_defaultGarbageSize;
+}
+
+/*
+* @brief Read a spec from JSON text
+*        Every member is optional except count; the rest keep their defaults.
+*        Problems with the spec are reported on stderr.
+*
+* @param[in]  text - NUL terminated JSON text
+* @param[out] spec - spec read
+* @return     spec valid
+*/
+bool BulkGenerator::parseSpec(const char* text, BulkGenerator_Spec* spec)
+{
+    assert( text );
+    assert( spec );
+
+    BulkGenerator::setDefaultSpec(spec);
+
+    cJSON* tree = cJSON_Parse(text);
+
+    if( !cJSON_IsObject(tree) )
+    {
+        fprintf(stderr, "Error - spec: not a JSON object\n");
+        cJSON_Delete(tree);
+        return false;
+    }
+
+    double count       = -1;
+    double seed        = (double)spec->seed;
+    double devices     = spec->deviceCount;
+    double firstSerial = spec->firstSerialNumber;
+    double startTime   = spec->startEpoch_seconds;
+    double rate        = spec->messagesPerSecond;
+    double minJsonSize = spec->minJsonSize;
+    double maxJsonSize = spec->maxJsonSize;
+
+    const cJSON* mix        = cJSON_GetObjectItemCaseSensitive(tree, "mix");
+    const cJSON* priorities = cJSON_GetObjectItemCaseSensitive(tree, "priorities");
+    const cJSON* jsonSize   = cJSON_GetObjectItemCaseSensitive(tree, "jsonSize");
+    const cJSON* faults     = cJSON_GetObjectItemCaseSensitive(tree, "faults");
+
+    bool valid =    readNumber(tree, "count",       0, (double)(1ull << 53), &count)
+                 && readNumber(tree, "seed",        0, (double)(1ull << 53), &seed)
+                 && readNumber(tree, "devices",     1, UINT32_MAX,           &devices)
+                 && readNumber(tree, "firstSerial", 0, UINT32_MAX,           &firstSerial)
+                 && readNumber(tree, "startTime",   0, UINT32_MAX,           &startTime)
+                 && readNumber(tree, "rate",        1, UINT32_MAX,           &rate)
+                 && readNumber(tree, "badJson",     0, 1,                    &spec->badJson)
+                 && (mix == NULL        || readMix(mix, spec))
+                 && (priorities == NULL || readPriorities(priorities, spec))
+                 && (faults == NULL     || readFaults(faults, spec));
+
+    if( valid && jsonSize )
+    {
+        valid =    cJSON_IsObject(jsonSize)
+                && readNumber(jsonSize, "min", bulkGenerator_minJsonSize, bulkGenerator_maxJsonSize, &minJsonSize)
+                && readNumber(jsonSize, "max", bulkGenerator_minJsonSize, bulkGenerator_maxJsonSize, &maxJsonSize);
+
+        if( valid && minJsonSize > maxJsonSize )
+        {
+            fprintf(stderr, "Error - spec: jsonSize min is more than max\n");
+            valid = false;
+        }
+    }
+
+    if( valid && count < 0 )
+    {
+        fprintf(stderr, "Error - spec: count is missing\n");
+        valid = false;
+    }
+
+    cJSON_Delete(tree);
+
+    spec->messageCount       = (uint64_t)count;
+    spec->seed               = (uint64_t)seed;
+    spec->deviceCount        = (uint32_t)devices;
+    spec->firstSerialNumber  = (uint32_t)firstSerial;
+    spec->startEpoch_seconds = (uint32_t)startTime;
+    spec->messagesPerSecond  = (uint32_t)rate;
+    spec->minJsonSize        = (uint16_t)minJsonSize;
+    spec->maxJsonSize        = (uint16_t)maxJsonSize;
+
+    return valid;
+}
+
+BulkGenerator::BulkGenerator(const BulkGenerator_Spec* spec, uint32_t threadCount)
+{
+    assert( spec );
+    assert( spec->mixCount > 0 && spec->deviceCount > 0 && spec->messagesPerSecond > 0 );
+    assert( spec->minJsonSize >= bulkGenerator_minJsonSize && spec->minJsonSize <= spec->maxJsonSize );
+    assert( spec->maxJsonSize <= bulkGenerator_maxJsonSize );
+    assert( spec->faults.maxGarbageSize > 0 && spec->faults.maxGarbageSize <= bulkGenerator_maxGarbageSize );
+    assert( threadCount > 0 );
+
+    const BulkGenerator_Faults* faults = &spec->faults;
+
+    this->spec           = *spec;
+    this->threadCount    = threadCount;
+    this->truth          = NULL;
+    this->bytesGenerated = 0;
+    this->intactCount    = 0;
+    this->nextWork       = 0;
+    this->nextOutput     = 0;
+    this->stopped        = false;
+
+    // Without faults, no chances are drawn for them, so the stream is as it was without the option
+    this->faulty =    faults->garbage > 0 || faults->spuriousT > 0 || faults->bitFlip > 0
+                   || faults->truncate > 0 || faults->headerChecksum > 0 || faults->payloadChecksum > 0;
+}
+
+/*
+* @brief Set where the messages left intact are reported; without a writer they are not
+*
+* @param truth - open sidecar writer, or NULL; generate adds to it but does not close it
+*/
+void BulkGenerator::setGroundTruth(CaptureIndexWriter* truth)
+{
+    this->truth = truth;
+}
+
+/*
+* @brief Generate the whole capture
+*
+* @param output  - takes each chunk in turn
+* @param context - passed to output
+* @return        every chunk generated and written, and every intact message reported
+*/
+bool BulkGenerator::generate(BulkGenerator_Output output, void* context)
+{
+    assert( output );
+
+    bool written = true;
+
+    this->chunks.clear();
+
+    for(uint64_t first = 0; first < this->spec.messageCount; first += bulkGenerator_chunkMessageCount)
+    {
+        Chunk chunk;
+
+        chunk.firstMessage = first;
+        chunk.messageCount = (uint32_t)min<uint64_t>(this->spec.messageCount - first, bulkGenerator_chunkMessageCount);
+        chunk.frames       = NULL;
+        chunk.size         = 0;
+        chunk.intact       = NULL;
+        chunk.intactCount  = 0;
+        chunk.failed       = false;
+        chunk.done         = false;
+
+        this->chunks.push_back(chunk);
+    }
+
+    this->bytesGenerated = 0;
+    this->intactCount    = 0;
+    this->nextWork       = 0;
+    this->nextOutput     = 0;
+    this->stopped        = false;
+
+    vector<thread> workers;
+
+    for(uint32_t i = 0; i < this->threadCount; i++)
+        workers.push_back(thread(&BulkGenerator::chunkWorker, this));
+
+    for(size_t i = 0; i < this->chunks.size(); i++)
+    {
+        Chunk* chunk = &this->chunks[i];
+
+        {
+            unique_lock<mutex> guard(this->lock);
+
+            while( !chunk->done )
+                this->progress.wait(guard);
+
+            this->nextOutput = i + 1;
+        }
+
+        this->progress.notify_all();
+
+        if( written && (chunk->failed || !output(chunk->frames, chunk->size, context)) )
+            written = false;
+
+        for(uint32_t j = 0; written && this->truth && j < chunk->intactCount; j++)
+        {
+            CaptureIndex_Entry* entry = &chunk->intact[j];
+            const uint8_t*      frame = &chunk->frames[entry->frameOffset];
+
+            entry->frameOffset += this->bytesGenerated;
+
+            written = this->truth->addEntry(entry, frame);
+        }
+
+        if( written )
+        {
+            this->bytesGenerated += chunk->size;
+            this->intactCount    += chunk->intactCount;
+        }
+        else
+        {
+            lock_guard<mutex> guard(this->lock);
+
+            // The chunks still to come are passed over instead of generated
+            this->stopped = true;
+        }
+
+        free(chunk->frames);
+        free(chunk->intact);
+        chunk->frames = NULL;
+        chunk->intact = NULL;
+    }
+
+    for(uint32_t i = 0; i < this->threadCount; i++)
+        workers[i].join();
+
+    return written;
+}
+
+/*
+* @brief Get the number of messages the last generate left intact
+*
+* @return message count
+*/
+uint64_t BulkGenerator::getIntactCount(void)
+{
+    return this->intactCount;
+}
+
+/*
+* @brief Get the number of bytes handed to the output by the last generate
+*
+* @return byte count
+*/
+uint64_t BulkGenerator::getBytesGenerated(void)
+{
+    return this->bytesGenerated;
+}
+
+void BulkGenerator::chunkWorker(void)
+{
+    size_t aheadLimit = (size_t)this->threadCount * bulkGenerator_chunksPerThread;
+
+    while( true )
+    {
+        Chunk* chunk;
+        bool   stopped;
+
+        {
+            unique_lock<mutex> guard(this->lock);
+
+            // Chunks are held in memory until their turn, so do not run too far ahead of the output
+            while( this->nextWork < this->chunks.size() && this->nextWork >= this->nextOutput + aheadLimit )
+                this->progress.wait(guard);
+
+            if( this->nextWork >= this->chunks.size() )
+                return;
+
+            chunk   = &this->chunks[this->nextWork++];
+            stopped = this->stopped;
+        }
+
+        if( !stopped )
+            this->generateChunk(chunk);
+
+        {
+            lock_guard<mutex> guard(this->lock);
+
+            chunk->done = true;
+        }
+
+        this->progress.notify_all();
+    }
+}
+
+/*
+* @brief Generate the frames of one chunk
+*
+* @param chunk - firstMessage and messageCount are set, the rest is filled in
+*/
+void BulkGenerator::generateChunk(Chunk* chunk)
+{
+    assert( chunk );
+
+    const BulkGenerator_Spec* spec = &this->spec;
+
+    MessageHandler message;
+    uint32_t       mixWeights[bulkGenerator_maxMixEntries];
+    char           json[bulkGenerator_maxJsonSize + 1];
+    size_t         capacity = (size_t)chunk->messageCount * bulkGenerator_plannedFrameSize;
+    uint64_t       state    = spec->seed ^ (chunk->firstMessage * 0xD1B54A32D192ED03ull);
+
+    // A stream of its own for every chunk, so any thread can generate it
+    state = nextRandom(&state);
+
+    for(uint32_t i = 0; i < spec->mixCount; i++)
+        mixWeights[i] = spec->mix[i].weight;
+
+    chunk->frames      = (uint8_t*)malloc(capacity);
+    chunk->size        = 0;
+    chunk->intact      = this->truth ? (CaptureIndex_Entry*)malloc(chunk->messageCount * sizeof(CaptureIndex_Entry)) : NULL;
+    chunk->intactCount = 0;
+    chunk->failed      = (chunk->frames == NULL) || (this->truth && chunk->intact == NULL);
+
+    for(uint32_t i = 0; i < chunk->messageCount && !chunk->failed; i++)
+    {
+        uint64_t                         index       = chunk->firstMessage + i;
+        uint16_t                         commandCode = spec->mix[pickWeighted(mixWeights, spec->mixCount, &state)].commandCode;
+        MessageHandler_MessageProperties properties;
+
+        properties.value    = 0;
+        properties.priority = pickWeighted(spec->priorityWeights, bulkGenerator_priorityCount, &state);
+
+        if( commandCode == MESSAGE_HANDLER_COMMAND_HEARTBEAT )
+        {
+            MessageHandler_HeartbeatPayload heartbeat;
+
+            heartbeat.epochTime_seconds = spec->startEpoch_seconds + (uint32_t)(index / spec->messagesPerSecond);
+            heartbeat.serialNumber      = spec->firstSerialNumber + (uint32_t)(nextRandom(&state) % spec->deviceCount);
+            heartbeat.voltage_cV        = (int16_t)(bulkGenerator_minVoltage_cV + nextRandom(&state) % bulkGenerator_voltageRange_cV);
+            heartbeat.temperature_C     = (int8_t)(bulkGenerator_minTemperature_C + nextRandom(&state) % bulkGenerator_temperatureRange);
+            heartbeat.mode              = (uint8_t)(nextRandom(&state) % bulkGenerator_modeCount);
+
+            message.setHeartbeat(&heartbeat);
+        }
+        else if( commandCode == MESSAGE_HANDLER_COMMAND_SETSARMODE )
+        {
+            uint32_t range = spec->maxJsonSize - spec->minJsonSize + 1;
+            uint32_t size  = spec->minJsonSize + (uint32_t)(nextRandom(&state) % range);
+
+            buildJson(json, size, sarModes[nextRandom(&state) % (sizeof(sarModes) / sizeof(sarModes[0]))]);
+
+            message.setPayloadJson(json);
+        }
+        else
+        {
+            message.setPayloadStandbyEnabled(nextRandom(&state) & 1);
+        }
+
+        message.setMessageProperties(&properties);
+
+        size_t   frameStart = chunk->size;
+        uint32_t frameSize  = message.serializeInto(&chunk->frames[frameStart], capacity - frameStart);
+
+        if( frameSize > capacity - frameStart )
+        {
+            if( !reserveFrames(&chunk->frames, &capacity, frameStart + frameSize) )
+            {
+                chunk->failed = true;
+                break;
+            }
+
+            message.serializeInto(&chunk->frames[frameStart], capacity - frameStart);
+        }
+
+        // Drawn only when asked for, so the stream is as it was without the option
+        if( commandCode == MESSAGE_HANDLER_COMMAND_SETSARMODE && drawChance(spec->badJson, &state) )
+            breakJson(&chunk->frames[frameStart]);
+
+        chunk->size += frameSize;
+
+        bool intact = !this->faulty || this->injectFaults(chunk, &capacity, &frameStart, &state);
+
+        if( chunk->failed )
+            break;
+
+        if( intact && chunk->intact )
+        {
+            const uint8_t*      frame = &chunk->frames[frameStart];
+            CaptureIndex_Entry* entry = &chunk->intact[chunk->intactCount++];
+
+            entry->frameOffset       = frameStart;
+            entry->commandCode       = frameCodec_commandCode::read(frame);
+            entry->payloadLength     = frameCodec_payloadSize::read(frame);
+            entry->epochTime_seconds = 0;
+            entry->serialNumber      = 0;
+
+            if( entry->commandCode == MESSAGE_HANDLER_COMMAND_HEARTBEAT )
+            {
+                MessageHandler_HeartbeatPayload heartbeat;
+
+                frameCodec_heartbeat::decode(&frame[fieldIndex_payload], &heartbeat);
+
+                entry->epochTime_seconds = heartbeat.epochTime_seconds;
+                entry->serialNumber      = heartbeat.serialNumber;
+            }
+        }
+    }
+}
+
+/*
+* @brief Put the faults the spec asks for before and into the frame just added to a chunk
+*
+* @param[in,out] chunk      - the chunk; its size may change
+* @param[in,out] capacity   - bytes allocated for the chunk's frames; may grow
+* @param[in,out] frameStart - chunk offset of the frame, which runs to the chunk's size;
+*                             moved on past anything put before it
+* @param[in,out] state      - the chunk's random stream
+* @return        frame left intact; false if it was damaged, or if the chunk could not grow
+*/
+bool BulkGenerator::injectFaults(Chunk* chunk, size_t* capacity, size_t* frameStart, uint64_t* state)
+{
+    const BulkGenerator_Faults* faults = &this->spec.faults;
+
+    uint32_t frameSize    = (uint32_t)(chunk->size - *frameStart);
+    uint32_t garbageSize  = drawChance(faults->garbage, state) ? 1 + (uint32_t)(nextRandom(state) % faults->maxGarbageSize) : 0;
+    uint32_t spuriousSize = drawChance(faults->spuriousT, state) ? 1 + (uint32_t)(nextRandom(state) % 2) : 0;
+    uint32_t insertSize   = garbageSize + spuriousSize;
+
+    assert( frameSize <= bulkGenerator_maxFrameSize );
+
+    if( insertSize > 0 )
+    {
+        if( !reserveFrames(&chunk->frames, capacity, chunk->size + insertSize) )
+        {
+            chunk->failed = true;
+            return false;
+        }
+
+        uint8_t* insert = &chunk->frames[*frameStart];
+
+        memmove(insert + insertSize, insert, frameSize);
+
+        for(uint32_t i = 0; i < garbageSize; i++)
+            insert[i] = (uint8_t)nextRandom(state);
+
+        // Stray key signature bytes go right before the frame, where they can pass for its start
+        memset(insert + garbageSize, 'T', spuriousSize);
+
+        *frameStart += insertSize;
+        chunk->size += insertSize;
+    }
+
+    uint8_t* frame = &chunk->frames[*frameStart];
+    uint8_t  original[bulkGenerator_maxFrameSize];
+    bool     truncated = false;
+
+    memcpy(original, frame, frameSize);
+
+    if( drawChance(faults->bitFlip, state) )
+    {
+        uint64_t bit = nextRandom(state) % ((uint64_t)frameSize * 8);
+
+        frame[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+    }
+
+    // A nonzero change to either byte of a checksum leaves it wrong
+    if( drawChance(faults->headerChecksum, state) )
+        frame[fieldIndex_headerChecksum + nextRandom(state) % fieldSize_headerChecksum] ^= (uint8_t)(1 + nextRandom(state) % 255);
+
+    if( drawChance(faults->payloadChecksum, state) )
+        frame[fieldIndex_dataChecksum + nextRandom(state) % fieldSize_dataChecksum] ^= (uint8_t)(1 + nextRandom(state) % 255);
+
+    if( drawChance(faults->truncate, state) )
+    {
+        chunk->size = *frameStart + 1 + nextRandom(state) % (frameSize - 1);
+        truncated   = true;
+    }
+
+    // Faults can cancel out, so the frame counts as damaged only when it changed
+    return !truncated && memcmp(original, frame, frameSize) == 0;
+}
+
+
+
+// EOF
@@ -0,0 +1,226 @@
+/* BulkGenerator.h
+ *
+ * This defines a class that generates a large capture of random messages from
+ *   a spec: how many messages, how often each command code and priority comes
+ *   up, the range of Set Sar Mode payload sizes, and how many devices send
+ *   heartbeats.
+ *
+ *   Messages are generated in chunks of bulkGenerator_chunkMessageCount on
+ *   several threads and handed to the output in capture order, a chunk at a
+ *   time. Each chunk draws from its own random stream seeded from the spec, so
+ *   the capture only depends on the spec, not on the number of threads.
+ *
+ *   A spec may also ask for faults like those of a noisy link: garbage and
+ *   stray 'T' bytes between messages, flipped bits, messages cut short, and
+ *   bad checksums. The messages left intact are reported as a capture index
+ *   (see CaptureIndex.h) naming exactly where they are, so what a parser
+ *   recovers can be checked against it.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef BulkGenerator_h
+#define BulkGenerator_h
+
+#include "MessageHandler.h"
+#include "CaptureIndex.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+
+
+/*
+ * @brief spec limits and chunk sizes
+ */
+enum
+{
+    bulkGenerator_maxMixEntries    = 3,     /* one per command code messageGenerator can build */
+    bulkGenerator_priorityCount    = 16,
+    bulkGenerator_minJsonSize      = 11,    /* {"mode":""} */
+    bulkGenerator_maxJsonSize      = 256,   /* the most setPayloadJson keeps */
+    bulkGenerator_maxGarbageSize   = 4096,
+
+    bulkGenerator_chunkMessageCount = 64 * 1024,
+    bulkGenerator_chunksPerThread   = 2,    /* how far generation may run ahead of output */
+};
+
+/*
+ * @brief how often one command code comes up, relative to the others
+ */
+typedef struct
+{
+    uint16_t commandCode;
+    uint32_t weight;
+} BulkGenerator_MixEntry;
+
+/*
+ * @brief faults to inject; each rate is the chance, from 0 to 1, that a message gets
+ *        that fault, drawn for every message and every fault on its own
+ */
+typedef struct
+{
+    double   garbage;           /* 1 to maxGarbageSize random bytes before the message */
+    double   spuriousT;         /* one or two stray 'T' bytes before the message */
+    double   bitFlip;           /* one bit of the message flipped */
+    double   truncate;          /* the message cut short */
+    double   headerChecksum;    /* header checksum wrong */
+    double   payloadChecksum;   /* payload checksum wrong */
+    uint32_t maxGarbageSize;
+} BulkGenerator_Faults;
+
+/*
+ * @brief what to generate
+ */
+typedef struct
+{
+    uint64_t               messageCount;
+    uint64_t               seed;
+    uint32_t               deviceCount;         /* heartbeat serial numbers are firstSerialNumber onwards */
+    uint32_t               firstSerialNumber;
+    uint32_t               startEpoch_seconds;  /* heartbeat time of the first message */
+    uint32_t               messagesPerSecond;   /* how fast heartbeat time moves through the capture */
+    BulkGenerator_MixEntry mix[bulkGenerator_maxMixEntries];
+    uint32_t               mixCount;
+    uint32_t               priorityWeights[bulkGenerator_priorityCount];
+    uint16_t               minJsonSize;         /* Set Sar Mode payload sizes, picked evenly from the range */
+    uint16_t               maxJsonSize;
+    double                 badJson;             /* chance a Set Sar Mode payload is not valid JSON */
+    BulkGenerator_Faults   faults;
+    bool                   groundTruth;         /* set when the spec has a faults member */
+} BulkGenerator_Spec;
+
+/*
+ * @brief Take the next chunk of the capture; called on the thread running generate, in capture order
+ *
+ * @param frames  - whole messages, one after another
+ * @param size    - number of bytes in frames
+ * @param context - as given to generate
+ * @return        chunk written; false stops generation
+ */
+typedef bool (*BulkGenerator_Output)(const uint8_t* frames, size_t size, void* context);
+
+class BulkGenerator
+{
+    public:
+
+        /*
+         * @brief Fill a spec with the defaults: heartbeats only, priority 0, one device
+         *
+         * @param[out] spec - spec to fill
+         */
+        static void setDefaultSpec(BulkGenerator_Spec* spec);
+
+        /*
+         * @brief Read a spec from JSON text, such as
+         *          { "count": 1000000, "seed": 7, "devices": 64, "firstSerial": 4096,
+         *            "startTime": 1530000000, "rate": 64,
+         *            "mix": { "FF08": 90, "FF03": 5, "FF05": 5 },
+         *            "priorities": [ 8, 4, 2, 1 ],
+         *            "jsonSize": { "min": 16, "max": 256 }, "badJson": 0.01,
+         *            "faults": { "garbage": 0.01, "maxGarbage": 64, "spuriousT": 0.01, "bitFlip": 0.001,
+         *                        "truncate": 0.001, "headerChecksum": 0.001, "payloadChecksum": 0.001 } }
+         *        Every member is optional except count; the rest keep their defaults.
+         *        A Set Sar Mode message with bad JSON still has the right checksums, so it
+         *        is framed and indexed like any other message but fails to decode.
+         *        Problems with the spec are reported on stderr.
+         *
+         * @param[in]  text - NUL terminated JSON text
+         * @param[out] spec - spec read
+         * @return     spec valid
+         */
+        static bool parseSpec(const char* text, BulkGenerator_Spec* spec);
+
+        /*
+         * @param spec        - what to generate; checked by parseSpec or made by setDefaultSpec
+         * @param threadCount - number of worker threads, at least 1
+         */
+        BulkGenerator(const BulkGenerator_Spec* spec, uint32_t threadCount);
+
+        /*
+         * @brief Set where the messages left intact are reported; without a writer they are not
+         *
+         * @param truth - open sidecar writer, or NULL; generate adds to it but does not close it
+         */
+        void setGroundTruth(CaptureIndexWriter* truth);
+
+        /*
+         * @brief Generate the whole capture
+         *
+         * @param output  - takes each chunk in turn
+         * @param context - passed to output
+         * @return        every chunk generated and written, and every intact message reported
+         */
+        bool generate(BulkGenerator_Output output, void* context);
+
+        /*
+         * @brief Get the number of messages the last generate left intact
+         *
+         * @return message count
+         */
+        uint64_t getIntactCount(void);
+
+        /*
+         * @brief Get the number of bytes handed to the output by the last generate
+         *
+         * @return byte count
+         */
+        uint64_t getBytesGenerated(void);
+
+    private:
+        /*
+         * @brief One run of messages and the frames generated for them
+         */
+        typedef struct
+        {
+            uint64_t            firstMessage;
+            uint32_t            messageCount;
+            uint8_t*            frames;
+            size_t              size;
+            CaptureIndex_Entry* intact;         /* frame offsets are from the start of the chunk */
+            uint32_t            intactCount;
+            bool                failed;
+            bool                done;
+        } Chunk;
+
+        void chunkWorker(void);
+
+        /*
+         * @brief Generate the frames of one chunk
+         *
+         * @param chunk - firstMessage and messageCount are set, the rest is filled in
+         */
+        void generateChunk(Chunk* chunk);
+
+        /*
+         * @brief Put the faults the spec asks for before and into the frame just added to a chunk
+         *
+         * @param[in,out] chunk      - the chunk; its size may change
+         * @param[in,out] capacity   - bytes allocated for the chunk's frames; may grow
+         * @param[in,out] frameStart - chunk offset of the frame, which runs to the chunk's size;
+         *                             moved on past anything put before it
+         * @param[in,out] state      - the chunk's random stream
+         * @return        frame left intact; false if it was damaged, or if the chunk could not grow
+         */
+        bool injectFaults(Chunk* chunk, size_t* capacity, size_t* frameStart, uint64_t* state);
+
+        BulkGenerator_Spec  spec;
+        uint32_t            threadCount;
+        bool                faulty;
+        CaptureIndexWriter* truth;
+        uint64_t            bytesGenerated;
+        uint64_t            intactCount;
+
+        std::vector<Chunk>      chunks;
+        size_t                  nextWork;
+        size_t                  nextOutput;
+        bool                    stopped;
+        std::mutex              lock;
+        std::condition_variable progress;
+};
+
+
+#endif // BulkGenerator_h
@@ -0,0 +1,494 @@
+/* CaptureCodec.cpp
+ *
+ * This implements the compressed capture encoding.
+ *   The decoder keeps each device's last heartbeat message in a plain array
+ *   indexed by id. A known device heartbeat patches the fields that changed
+ *   into that message, sums its payload again and copies it out whole.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "CaptureCodec.h"
+#include "FrameCodec.h"
+
+#include <assert.h>     /* assert */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+using namespace std;
+
+
+
+/*
+ * @brief record tag bits
+ */
+enum
+{
+    captureCodecTag_kindMask     = 0x03,
+    captureCodecTag_raw          = 0x00,
+    captureCodecTag_newDevice    = 0x01,
+    captureCodecTag_knownDevice  = 0x02,
+
+    captureCodecTag_properties   = 0x04,
+    captureCodecTag_voltage      = 0x08,
+    captureCodecTag_temperature  = 0x10,
+    captureCodecTag_mode         = 0x20,
+};
+
+enum
+{
+    captureCodecHeader_magic     = 0,
+    captureCodecHeader_version   = 4,
+
+    captureCodec_maxVarintSize   = 5,
+};
+
+static const char captureCodecMagic[] = "TTCZ";
+
+
+
+static inline uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static inline size_t writeVarint(uint8_t* output, uint32_t value)
+{
+    size_t size = 0;
+
+    while( value >= 0x80 )
+    {
+        output[size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    output[size++] = (uint8_t)value;
+
+    return size;
+}
+
+static inline bool readVarint(const uint8_t** cursor, const uint8_t* end, uint32_t* value)
+{
+    const uint8_t* next = *cursor;
+
+    // Most deltas fit one byte
+    if( next < end && *next < 0x80 )
+    {
+        *value  = *next;
+        *cursor = next + 1;
+        return true;
+    }
+
+    uint32_t result = 0;
+
+    for(uint32_t shift = 0; shift < 7 * captureCodec_maxVarintSize && next < end; shift += 7)
+    {
+        uint8_t byte = *next++;
+
+        result |= (uint32_t)(byte & 0x7F) << shift;
+
+        if( byte < 0x80 )
+        {
+            *value  = result;
+            *cursor = next;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+* @brief Sum the bytes of a word without a loop; each 16 bit lane holds at most 2 * 255
+*/
+static inline uint32_t sumWordBytes(uint64_t word)
+{
+    word = (word & 0x00FF00FF00FF00FFull) + ((word >> 8) & 0x00FF00FF00FF00FFull);
+
+    return (uint32_t)((word * 0x0001000100010001ull) >> 48);
+}
+
+/*
+* @brief Checksum a heartbeat header; every byte but the properties is fixed
+*/
+static inline uint16_t sumHeartbeatHeader(uint16_t properties)
+{
+    return (uint16_t)((properties & 0xFF) + (properties >> 8)
+                    + (MESSAGE_HANDLER_COMMAND_HEARTBEAT & 0xFF) + (MESSAGE_HANDLER_COMMAND_HEARTBEAT >> 8)
+                    + sizeof(MessageHandler_HeartbeatPayload));
+}
+
+/*
+* @brief Checksum a heartbeat payload
+*/
+static inline uint16_t sumHeartbeatPayload(const uint8_t* payload)
+{
+    uint64_t head;
+    uint32_t tail;
+
+    memcpy(&head, payload, sizeof(head));
+    memcpy(&tail, &payload[sizeof(head)], sizeof(tail));
+
+    return (uint16_t)(sumWordBytes(head) + sumWordBytes(tail));
+}
+
+/*
+* @brief Build the heartbeat message a device's state describes
+*
+* @param device - properties and heartbeat
+* @param frame  - captureCodec_heartbeatSize bytes
+*/
+static inline void buildHeartbeat(const CaptureCodec_Device* device, uint8_t* frame)
+{
+    frame[fieldIndex_keySignature]     = 'T';
+    frame[fieldIndex_keySignature + 1] = 'T';
+
+    frameCodec_messageProperties::write(frame, device->properties);
+    frameCodec_commandCode::write(frame, MESSAGE_HANDLER_COMMAND_HEARTBEAT);
+    frameCodec_payloadSize::write(frame, sizeof(MessageHandler_HeartbeatPayload));
+    frameCodec_heartbeat::encode(&device->heartbeat, &frame[fieldIndex_payload]);
+
+    frameCodec_headerChecksum::write(frame, sumHeartbeatHeader(device->properties));
+    frameCodec_dataChecksum::write(frame, sumHeartbeatPayload(&frame[fieldIndex_payload]));
+}
+
+
+
+/*
+* @brief Find out whether bytes start like a compressed capture
+*
+* @param capture     - the capture bytes
+* @param captureSize - number of bytes in capture
+* @return            capture has a compressed capture header
+*/
+bool isCompressedCapture(const uint8_t* capture, uint64_t captureSize)
+{
+    assert( capture || captureSize == 0 );
+
+    return captureSize >= captureCodec_headerSize
+        && memcmp(&capture[captureCodecHeader_magic], captureCodecMagic, 4) == 0;
+}
+
+
+
+CaptureEncoder::CaptureEncoder()
+{
+}
+
+/*
+* @brief Write the header and forget every device, starting a new compressed capture
+*
+* @param output - captureCodec_headerSize bytes
+* @return       bytes written
+*/
+size_t CaptureEncoder::begin(uint8_t* output)
+{
+    assert( output );
+
+    this->deviceIds.clear();
+    this->devices.clear();
+
+    memset(output, 0, captureCodec_headerSize);
+    memcpy(&output[captureCodecHeader_magic], captureCodecMagic, 4);
+    storeLittle<uint16_t>(&output[captureCodecHeader_version], captureCodec_version);
+
+    return captureCodec_headerSize;
+}
+
+/*
+* @brief Encode one message
+*
+* @param frame     - the whole message
+* @param frameSize - number of bytes in frame
+* @param output    - at least frameSize + captureCodec_recordOverhead bytes
+* @return          bytes written
+*/
+size_t CaptureEncoder::encodeFrame(const uint8_t* frame, uint32_t frameSize, uint8_t* output)
+{
+    assert( frame );
+    assert( output );
+
+    if( frameSize == captureCodec_heartbeatSize && frameCodec_commandCode::read(frame) == MESSAGE_HANDLER_COMMAND_HEARTBEAT )
+    {
+        CaptureCodec_Device device;
+        uint8_t             rebuilt[captureCodec_heartbeatSize];
+
+        device.properties = frameCodec_messageProperties::read(frame);
+        frameCodec_heartbeat::decode(&frame[fieldIndex_payload], &device.heartbeat);
+
+        buildHeartbeat(&device, rebuilt);
+
+        // Only a heartbeat the decoder rebuilds byte for byte can be coded as fields
+        if( memcmp(rebuilt, frame, captureCodec_heartbeatSize) == 0 )
+        {
+            MessageHandler_HeartbeatPayload* heartbeat = &device.heartbeat;
+            size_t                           size      = 1;
+
+            // The payload is packed, so the map key is copied out rather than referenced in place
+            uint32_t serialNumber = heartbeat->serialNumber;
+
+            auto found = this->deviceIds.find(serialNumber);
+
+            if( found == this->deviceIds.end() )
+            {
+                output[0] = captureCodecTag_newDevice;
+
+                size += writeVarint(&output[size], device.properties);
+                size += writeVarint(&output[size], heartbeat->serialNumber);
+                size += writeVarint(&output[size], heartbeat->epochTime_seconds);
+                size += writeVarint(&output[size], zigzag(heartbeat->voltage_cV));
+                size += writeVarint(&output[size], zigzag(heartbeat->temperature_C));
+                output[size++] = heartbeat->mode;
+
+                this->deviceIds[serialNumber] = (uint32_t)this->devices.size();
+                this->devices.push_back(device);
+
+                return size;
+            }
+
+            CaptureCodec_Device*             known = &this->devices[found->second];
+            MessageHandler_HeartbeatPayload* last  = &known->heartbeat;
+            uint8_t                          tag   = captureCodecTag_knownDevice;
+
+            if( device.properties != known->properties )
+                tag |= captureCodecTag_properties;
+            if( heartbeat->voltage_cV != last->voltage_cV )
+                tag |= captureCodecTag_voltage;
+            if( heartbeat->temperature_C != last->temperature_C )
+                tag |= captureCodecTag_temperature;
+            if( heartbeat->mode != last->mode )
+                tag |= captureCodecTag_mode;
+
+            output[0] = tag;
+
+            size += writeVarint(&output[size], found->second);
+            size += writeVarint(&output[size], zigzag((int32_t)(heartbeat->epochTime_seconds - last->epochTime_seconds)));
+
+            if( tag & captureCodecTag_properties )
+                size += writeVarint(&output[size], device.properties);
+            if( tag & captureCodecTag_voltage )
+                size += writeVarint(&output[size], zigzag((int16_t)(heartbeat->voltage_cV - last->voltage_cV)));
+            if( tag & captureCodecTag_temperature )
+                size += writeVarint(&output[size], zigzag((int8_t)(heartbeat->temperature_C - last->temperature_C)));
+            if( tag & captureCodecTag_mode )
+                output[size++] = heartbeat->mode;
+
+            *known = device;
+
+            return size;
+        }
+    }
+
+    size_t size = 0;
+
+    output[size++] = captureCodecTag_raw;
+    size += writeVarint(&output[size], frameSize);
+
+    memcpy(&output[size], frame, frameSize);
+
+    return size + frameSize;
+}
+
+
+
+CaptureDecoder::CaptureDecoder()
+{
+}
+
+/*
+* @brief Check the header and forget every device, starting a new compressed capture
+*
+* @param input     - the start of the compressed capture
+* @param inputSize - number of bytes in input
+* @return          header valid; the records start captureCodec_headerSize bytes in
+*/
+bool CaptureDecoder::begin(const uint8_t* input, size_t inputSize)
+{
+    this->devices.clear();
+
+    return isCompressedCapture(input, inputSize)
+        && loadLittle<uint16_t>(&input[captureCodecHeader_version]) == captureCodec_version;
+}
+
+/*
+* @brief Decode whole records until the input runs out or the next message does not fit
+*
+* @param[in]  input      - records; a record cut off at the end counts as damaged
+* @param[in]  inputSize  - number of bytes in input
+* @param[out] consumed   - bytes of input decoded
+* @param[in]  output     - where the messages go, back to back
+* @param[in]  outputSize - number of bytes in output, at least captureCodec_maxFrameSize
+*                          to be sure of room for any message
+* @param[out] produced   - bytes of output written
+* @return     false when the record at consumed is damaged
+*/
+bool CaptureDecoder::decode(const uint8_t* input, size_t inputSize, size_t* consumed, uint8_t* output, size_t outputSize, size_t* produced)
+{
+    assert( input || inputSize == 0 );
+    assert( consumed );
+    assert( output );
+    assert( produced );
+
+    const uint8_t* cursor  = input;
+    const uint8_t* end     = input + inputSize;
+    size_t         written = 0;
+    bool           valid   = true;
+
+    *consumed = 0;
+    *produced = 0;
+
+    while( cursor < end )
+    {
+        const uint8_t* record = cursor;
+        uint8_t        tag    = *cursor++;
+        uint32_t       value;
+
+        if( (tag & captureCodecTag_kindMask) == captureCodecTag_knownDevice )
+        {
+            if( outputSize - written < captureCodec_heartbeatSize )
+            {
+                cursor = record;
+                break;
+            }
+
+            if( !readVarint(&cursor, end, &value) || value >= this->devices.size() )
+            {
+                valid = false;
+                cursor = record;
+                break;
+            }
+
+            uint8_t* frame       = this->devices[value].bytes;
+            uint32_t epochDelta  = 0;
+            uint32_t properties  = 0;
+            uint32_t voltage     = 0;
+            uint32_t temperature = 0;
+            bool     complete    = readVarint(&cursor, end, &epochDelta);
+
+            if( complete && (tag & captureCodecTag_properties) )
+                complete = readVarint(&cursor, end, &properties);
+            if( complete && (tag & captureCodecTag_voltage) )
+                complete = readVarint(&cursor, end, &voltage);
+            if( complete && (tag & captureCodecTag_temperature) )
+                complete = readVarint(&cursor, end, &temperature);
+            if( complete && (tag & captureCodecTag_mode) )
+                complete = (cursor < end);
+
+            if( !complete )
+            {
+                valid = false;
+                cursor = record;
+                break;
+            }
+
+            uint8_t* payload = &frame[fieldIndex_payload];
+
+            storeLittle<uint32_t>(&payload[heartbeatIndex_epochTime], loadLittle<uint32_t>(&payload[heartbeatIndex_epochTime]) + (uint32_t)unzigzag(epochDelta));
+
+            if( tag & captureCodecTag_voltage )
+                storeLittle<uint16_t>(&payload[heartbeatIndex_voltage], (uint16_t)(loadLittle<uint16_t>(&payload[heartbeatIndex_voltage]) + unzigzag(voltage)));
+            if( tag & captureCodecTag_temperature )
+                payload[heartbeatIndex_temperature] = (uint8_t)(payload[heartbeatIndex_temperature] + unzigzag(temperature));
+            if( tag & captureCodecTag_mode )
+                payload[heartbeatIndex_mode] = *cursor++;
+
+            if( tag & captureCodecTag_properties )
+            {
+                frameCodec_messageProperties::write(frame, (uint16_t)properties);
+                frameCodec_headerChecksum::write(frame, sumHeartbeatHeader((uint16_t)properties));
+            }
+
+            frameCodec_dataChecksum::write(frame, sumHeartbeatPayload(payload));
+
+            memcpy(&output[written], frame, captureCodec_heartbeatSize);
+            written += captureCodec_heartbeatSize;
+        }
+        else if( (tag & captureCodecTag_kindMask) == captureCodecTag_newDevice )
+        {
+            if( outputSize - written < captureCodec_heartbeatSize )
+            {
+                cursor = record;
+                break;
+            }
+
+            CaptureCodec_Device device;
+            uint32_t            properties;
+            uint32_t            serialNumber;
+            uint32_t            epochTime;
+            uint32_t            voltage;
+            uint32_t            temperature;
+
+            if(   !readVarint(&cursor, end, &properties)
+               || !readVarint(&cursor, end, &serialNumber)
+               || !readVarint(&cursor, end, &epochTime)
+               || !readVarint(&cursor, end, &voltage)
+               || !readVarint(&cursor, end, &temperature)
+               || cursor >= end
+              )
+            {
+                valid = false;
+                cursor = record;
+                break;
+            }
+
+            device.properties                  = (uint16_t)properties;
+            device.heartbeat.serialNumber      = serialNumber;
+            device.heartbeat.epochTime_seconds = epochTime;
+            device.heartbeat.voltage_cV        = (int16_t)unzigzag(voltage);
+            device.heartbeat.temperature_C     = (int8_t)unzigzag(temperature);
+            device.heartbeat.mode              = *cursor++;
+
+            this->devices.emplace_back();
+
+            buildHeartbeat(&device, this->devices.back().bytes);
+
+            memcpy(&output[written], this->devices.back().bytes, captureCodec_heartbeatSize);
+            written += captureCodec_heartbeatSize;
+        }
+        else if( (tag & captureCodecTag_kindMask) == captureCodecTag_raw )
+        {
+            if(   !readVarint(&cursor, end, &value)
+               || value > captureCodec_maxFrameSize
+               || value > (size_t)(end - cursor)
+              )
+            {
+                valid = false;
+                cursor = record;
+                break;
+            }
+
+            if( outputSize - written < value )
+            {
+                cursor = record;
+                break;
+            }
+
+            memcpy(&output[written], cursor, value);
+
+            cursor  += value;
+            written += value;
+        }
+        else
+        {
+            valid = false;
+            cursor = record;
+            break;
+        }
+    }
+
+    *consumed = (size_t)(cursor - input);
+    *produced = written;
+
+    return valid;
+}
+
+
+
+// EOF
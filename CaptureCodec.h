@@ -0,0 +1,143 @@
+/* CaptureCodec.h
+ *
+ * This defines a compressed encoding of a capture's verified messages.
+ *   Heartbeats are coded against the last heartbeat from the same device:
+ *   the device is named by a small id given out in order of first appearance,
+ *   and epoch time, voltage and temperature are zigzag deltas packed as
+ *   varints. Fields that did not change are left out. Every other message,
+ *   and any heartbeat that would not come back byte for byte, is stored raw.
+ *
+ *   A compressed capture is a header followed by records:
+ *     tag bits 0-1 - record kind
+ *     raw          - varint frame size, frame bytes
+ *     new device   - varint properties, serial number, epoch time,
+ *                    zigzag voltage and temperature, mode byte
+ *     known device - varint id, zigzag epoch time delta, then the fields
+ *                    tag bits 2-5 say changed
+ *   Decoding rebuilds each message exactly, checksums included.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef CaptureCodec_h
+#define CaptureCodec_h
+
+#include "MessageHandler.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <unordered_map>
+#include <vector>
+
+
+
+/*
+ * @brief encoding sizes
+ */
+enum
+{
+    captureCodec_version        = 1,
+
+    captureCodec_headerSize     = 8,    /* magic, version, reserved */
+    captureCodec_recordOverhead = 6,    /* most a raw record adds to its frame: tag and 5 byte varint */
+    captureCodec_heartbeatSize  = fieldIndex_payload + sizeof(MessageHandler_HeartbeatPayload),
+    captureCodec_maxFrameSize   = fieldIndex_payload + UINT16_MAX,
+};
+
+/*
+ * @brief what the encoder remembers about a device
+ */
+typedef struct
+{
+    uint16_t                        properties;
+    MessageHandler_HeartbeatPayload heartbeat;
+} CaptureCodec_Device;
+
+/*
+ * @brief what the decoder remembers about a device: its last heartbeat message,
+ *        which the next one is patched from
+ */
+typedef struct
+{
+    uint8_t bytes[captureCodec_heartbeatSize];
+} CaptureCodec_Frame;
+
+
+
+/*
+ * @brief Find out whether bytes start like a compressed capture
+ *
+ * @param capture     - the capture bytes
+ * @param captureSize - number of bytes in capture
+ * @return            capture has a compressed capture header
+ */
+bool isCompressedCapture(const uint8_t* capture, uint64_t captureSize);
+
+
+
+class CaptureEncoder
+{
+    public:
+
+        CaptureEncoder();
+
+        /*
+         * @brief Write the header and forget every device, starting a new compressed capture
+         *
+         * @param output - captureCodec_headerSize bytes
+         * @return       bytes written
+         */
+        size_t begin(uint8_t* output);
+
+        /*
+         * @brief Encode one message
+         *
+         * @param frame     - the whole message
+         * @param frameSize - number of bytes in frame
+         * @param output    - at least frameSize + captureCodec_recordOverhead bytes
+         * @return          bytes written
+         */
+        size_t encodeFrame(const uint8_t* frame, uint32_t frameSize, uint8_t* output);
+
+    private:
+        std::unordered_map<uint32_t, uint32_t> deviceIds;   /* serial number to id */
+        std::vector<CaptureCodec_Device>       devices;
+};
+
+
+
+class CaptureDecoder
+{
+    public:
+
+        CaptureDecoder();
+
+        /*
+         * @brief Check the header and forget every device, starting a new compressed capture
+         *
+         * @param input     - the start of the compressed capture
+         * @param inputSize - number of bytes in input
+         * @return          header valid; the records start captureCodec_headerSize bytes in
+         */
+        bool begin(const uint8_t* input, size_t inputSize);
+
+        /*
+         * @brief Decode whole records until the input runs out or the next message does not fit
+         *
+         * @param[in]  input      - records; a record cut off at the end counts as damaged
+         * @param[in]  inputSize  - number of bytes in input
+         * @param[out] consumed   - bytes of input decoded
+         * @param[in]  output     - where the messages go, back to back
+         * @param[in]  outputSize - number of bytes in output, at least captureCodec_maxFrameSize
+         *                          to be sure of room for any message
+         * @param[out] produced   - bytes of output written
+         * @return     false when the record at consumed is damaged
+         */
+        bool decode(const uint8_t* input, size_t inputSize, size_t* consumed, uint8_t* output, size_t outputSize, size_t* produced);
+
+    private:
+        std::vector<CaptureCodec_Frame> devices;
+};
+
+
+#endif // CaptureCodec_h
@@ -0,0 +1,277 @@
+/* CaptureFile.cpp
+ *
+ * This implements a class that hands a capture file to a parser in large spans
+ *   using mmap, with a read() fallback for files that cannot be mapped.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "CaptureFile.h"
+
+#include <assert.h>     /* assert */
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+/*
+ * @brief Largest capture mapped in one piece; bigger captures use a sliding window
+ */
+static const uint64_t maxWholeMappingSize = (sizeof(void*) < 8) ? (1ULL << 30) : (1ULL << 40);
+
+
+
+CaptureFile::CaptureFile()
+{
+    this->fileDescriptor = -1;
+    this->fileSize       = 0;
+    this->offset         = 0;
+    this->mappable       = false;
+
+    this->mapping        = NULL;
+    this->mappingSize    = 0;
+    this->windowSize     = 0;
+
+    this->readBuffer     = NULL;
+}
+
+CaptureFile::~CaptureFile()
+{
+    this->close();
+}
+
+/*
+* @brief Open a capture for reading from the start
+*
+* @param path - path to the capture file
+* @return     file opened
+*/
+bool CaptureFile::open(const char* path)
+{
+    assert( path );
+
+    this->close();
+
+    this->fileDescriptor = ::open(path, O_RDONLY);
+    if( this->fileDescriptor < 0 )
+        return false;
+
+    struct stat fileStat;
+
+    if( fstat(this->fileDescriptor, &fileStat) == 0 && S_ISREG(fileStat.st_mode) )
+    {
+        this->fileSize = (uint64_t)fileStat.st_size;
+        this->mappable = true;
+
+        if( this->fileSize <= maxWholeMappingSize )
+        {
+            this->windowSize = (size_t)this->fileSize;
+        }
+        else
+        {
+            // Window boundaries must stay page aligned for mmap
+            long pageSize    = sysconf(_SC_PAGESIZE);
+            this->windowSize = captureFile_windowSize - (captureFile_windowSize % pageSize);
+        }
+    }
+
+    return true;
+}
+
+/*
+* @brief Release the mapping or read buffer and close the file
+*/
+void CaptureFile::close(void)
+{
+    this->unmapWindow();
+
+    if( this->readBuffer )
+        free(this->readBuffer);
+
+    if( this->fileDescriptor >= 0 )
+        ::close(this->fileDescriptor);
+
+    this->fileDescriptor = -1;
+    this->fileSize       = 0;
+    this->offset         = 0;
+    this->mappable       = false;
+    this->windowSize     = 0;
+    this->readBuffer     = NULL;
+}
+
+/*
+* @brief Get the size of the capture; 0 when it is not a regular file
+*
+* @return capture size in bytes
+*/
+uint64_t CaptureFile::getSize(void)
+{
+    return this->fileSize;
+}
+
+/*
+* @brief Get the capture offset of the first byte of the next span
+*
+* @return offset in bytes
+*/
+uint64_t CaptureFile::getOffset(void)
+{
+    return this->offset;
+}
+
+/*
+* @brief Get the next span of the capture
+*        The span is valid until the next call or until the file is closed.
+*
+* @param[out] span     - pointer to the bytes of the span
+* @param[out] spanSize - number of bytes in the span
+* @return     a span was returned; false at the end of the capture or on error
+*/
+bool CaptureFile::nextSpan(const uint8_t** span, size_t* spanSize)
+{
+    assert( span );
+    assert( spanSize );
+
+    if( this->fileDescriptor < 0 )
+        return false;
+
+    if( this->mappable )
+    {
+        if( this->offset >= this->fileSize )
+            return false;
+
+        uint64_t remaining = this->fileSize - this->offset;
+        size_t   length    = (remaining < this->windowSize) ? (size_t)remaining : this->windowSize;
+
+        if( !this->mapWindow(this->offset, length) && this->windowSize > captureFile_windowSize )
+        {
+            // Not enough address space for the whole capture; slide a window over it instead
+            long pageSize    = sysconf(_SC_PAGESIZE);
+            this->windowSize = captureFile_windowSize - (captureFile_windowSize % pageSize);
+            length           = (remaining < this->windowSize) ? (size_t)remaining : this->windowSize;
+
+            this->mapWindow(this->offset, length);
+        }
+
+        if( this->mapping )
+        {
+            *span         = this->mapping;
+            *spanSize     = length;
+            this->offset += length;
+            return true;
+        }
+
+        // The mapping was refused; read the rest of the file instead
+        this->mappable = false;
+
+        if( lseek(this->fileDescriptor, (off_t)this->offset, SEEK_SET) < 0 )
+            return false;
+    }
+
+    this->unmapWindow();
+
+    if( this->readBuffer == NULL )
+    {
+        this->readBuffer = (uint8_t*)malloc(captureFile_readBufferSize);
+        if( this->readBuffer == NULL )
+            return false;
+    }
+
+    ssize_t length;
+
+    do
+    {
+        length = read(this->fileDescriptor, this->readBuffer, captureFile_readBufferSize);
+    } while( length < 0 && errno == EINTR );
+
+    if( length <= 0 )
+        return false;
+
+    *span         = this->readBuffer;
+    *spanSize     = (size_t)length;
+    this->offset += (uint64_t)length;
+
+    return true;
+}
+
+/*
+* @brief Read bytes from anywhere in the capture, leaving the span position alone
+*
+* @param offset - capture offset of the first byte
+* @param buffer - where the bytes go
+* @param size   - number of bytes
+* @return       all size bytes were read
+*/
+bool CaptureFile::readAt(uint64_t offset, uint8_t* buffer, size_t size)
+{
+    assert( buffer || size == 0 );
+
+    if( this->fileDescriptor < 0 )
+        return false;
+
+    while( size > 0 )
+    {
+        ssize_t length = pread(this->fileDescriptor, buffer, size, (off_t)offset);
+
+        if( length < 0 && errno == EINTR )
+            continue;
+
+        if( length <= 0 )
+            return false;
+
+        buffer += length;
+        offset += (uint64_t)length;
+        size   -= (size_t)length;
+    }
+
+    return true;
+}
+
+/*
+* @brief Map length bytes at offset, replacing any current mapping
+*
+* @return mapping succeeded
+*/
+bool CaptureFile::mapWindow(uint64_t offset, size_t length)
+{
+    this->unmapWindow();
+
+    void* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, this->fileDescriptor, (off_t)offset);
+    if( mapping == MAP_FAILED )
+        return false;
+
+    // These are only hints; the capture is parsed front to back exactly once. Sequential
+    // readahead keeps ahead of the parser without WILLNEED reading the whole window up front,
+    // which paths that only touch a few pages of a large capture cannot afford
+    madvise(mapping, length, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(mapping, length, MADV_HUGEPAGE);
+#endif
+
+    this->mapping     = (uint8_t*)mapping;
+    this->mappingSize = length;
+
+    return true;
+}
+
+/*
+* @brief Release the current mapping
+*/
+void CaptureFile::unmapWindow(void)
+{
+    if( this->mapping )
+        munmap(this->mapping, this->mappingSize);
+
+    this->mapping     = NULL;
+    this->mappingSize = 0;
+}
+
+
+
+// EOF
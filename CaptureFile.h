@@ -0,0 +1,111 @@
+/* CaptureFile.h
+ *
+ * This defines a class that hands a capture file to a parser in large spans.
+ *   Regular files are memory mapped, whole when they fit and through a sliding
+ *   window when they do not. Anything that cannot be mapped (pipes, devices)
+ *   is read into an owned buffer instead.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef CaptureFile_h
+#define CaptureFile_h
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+
+/*
+ * @brief mapping sizes
+ */
+enum
+{
+    captureFile_windowSize     = 256 * 1024 * 1024,
+    captureFile_readBufferSize = 1024 * 1024,
+};
+
+
+
+class CaptureFile
+{
+    public:
+
+        CaptureFile();
+        ~CaptureFile();
+
+        /*
+         * @brief Open a capture for reading from the start
+         *
+         * @param path - path to the capture file
+         * @return     file opened
+         */
+        bool open(const char* path);
+
+        /*
+         * @brief Release the mapping or read buffer and close the file
+         */
+        void close(void);
+
+        /*
+         * @brief Get the size of the capture; 0 when it is not a regular file
+         *
+         * @return capture size in bytes
+         */
+        uint64_t getSize(void);
+
+        /*
+         * @brief Get the next span of the capture
+         *        The span is valid until the next call or until the file is closed.
+         *
+         * @param[out] span     - pointer to the bytes of the span
+         * @param[out] spanSize - number of bytes in the span
+         * @return     a span was returned; false at the end of the capture or on error
+         */
+        bool nextSpan(const uint8_t** span, size_t* spanSize);
+
+        /*
+         * @brief Get the capture offset of the first byte of the next span
+         *
+         * @return offset in bytes
+         */
+        uint64_t getOffset(void);
+
+        /*
+         * @brief Read bytes from anywhere in the capture, leaving the span position alone
+         *
+         * @param offset - capture offset of the first byte
+         * @param buffer - where the bytes go
+         * @param size   - number of bytes
+         * @return       all size bytes were read
+         */
+        bool readAt(uint64_t offset, uint8_t* buffer, size_t size);
+
+    private:
+        /*
+         * @brief Map length bytes at offset, replacing any current mapping
+         *
+         * @return mapping succeeded
+         */
+        bool mapWindow(uint64_t offset, size_t length);
+
+        /*
+         * @brief Release the current mapping
+         */
+        void unmapWindow(void);
+
+        int       fileDescriptor;
+        uint64_t  fileSize;
+        uint64_t  offset;
+        bool      mappable;
+
+        uint8_t*  mapping;
+        size_t    mappingSize;
+        size_t    windowSize;
+
+        uint8_t*  readBuffer;
+};
+
+
+#endif // CaptureFile_h
@@ -0,0 +1,604 @@
+/* CaptureIndex.cpp
+ *
+ * This implements an index of the verified messages in a capture.
+ *   An interrupted build leaves entries the header does not count yet;
+ *   the next build cuts them off before it appends.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "CaptureIndex.h"
+#include "CaptureFile.h"
+#include "MessageHandler.h"
+#include "MessageView.h"
+#include "FrameCodec.h"
+
+#include <assert.h>     /* assert */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>     /* ftruncate */
+#include <algorithm>
+
+using namespace std;
+
+
+
+/*
+ * @brief byte offsets of the header and entry fields
+ */
+enum
+{
+    captureIndexHeader_magic        = 0,
+    captureIndexHeader_version      = 4,
+    captureIndexHeader_entrySize    = 6,
+    captureIndexHeader_coveredBytes = 8,
+    captureIndexHeader_entryCount   = 16,
+    captureIndexHeader_fingerprint  = 24,
+
+    captureIndexEntry_frameOffset   = 0,
+    captureIndexEntry_epochTime     = 8,
+    captureIndexEntry_serialNumber  = 12,
+    captureIndexEntry_commandCode   = 16,
+    captureIndexEntry_payloadLength = 18,
+};
+
+enum
+{
+    captureIndex_bufferSize   = 1024 * 1024,
+    captureIndex_maxFrameSize = fieldIndex_payload + UINT16_MAX,
+};
+
+static const char captureIndexMagic[] = "TTIX";
+
+static const uint64_t captureIndexFingerprintBasis = 0xcbf29ce484222325ULL;
+static const uint64_t captureIndexFingerprintPrime = 0x100000001b3ULL;
+
+
+
+static void encodeEntry(const CaptureIndex_Entry* entry, uint8_t* bytes)
+{
+    storeLittle<uint64_t>(&bytes[captureIndexEntry_frameOffset], entry->frameOffset);
+    storeLittle<uint32_t>(&bytes[captureIndexEntry_epochTime], entry->epochTime_seconds);
+    storeLittle<uint32_t>(&bytes[captureIndexEntry_serialNumber], entry->serialNumber);
+    storeLittle<uint16_t>(&bytes[captureIndexEntry_commandCode], entry->commandCode);
+    storeLittle<uint16_t>(&bytes[captureIndexEntry_payloadLength], entry->payloadLength);
+}
+
+static void decodeEntry(const uint8_t* bytes, CaptureIndex_Entry* entry)
+{
+    entry->frameOffset       = loadLittle<uint64_t>(&bytes[captureIndexEntry_frameOffset]);
+    entry->epochTime_seconds = loadLittle<uint32_t>(&bytes[captureIndexEntry_epochTime]);
+    entry->serialNumber      = loadLittle<uint32_t>(&bytes[captureIndexEntry_serialNumber]);
+    entry->commandCode       = loadLittle<uint16_t>(&bytes[captureIndexEntry_commandCode]);
+    entry->payloadLength     = loadLittle<uint16_t>(&bytes[captureIndexEntry_payloadLength]);
+}
+
+/*
+* @brief Fingerprint the bytes of a frame, a 64 bit FNV-1a hash
+*
+* @param frame - frame
+* @param size  - number of bytes in the frame
+* @return      fingerprint
+*/
+static uint64_t fingerprintFrame(const uint8_t* frame, size_t size)
+{
+    uint64_t fingerprint = captureIndexFingerprintBasis;
+
+    for(size_t i = 0; i < size; i++)
+        fingerprint = (fingerprint ^ frame[i]) * captureIndexFingerprintPrime;
+
+    return fingerprint;
+}
+
+/*
+* @brief Fingerprint the frame of an entry as it is in the capture now
+*
+* @param[in]  capture     - capture the entry indexes
+* @param[in]  entry       - entry
+* @param[out] fingerprint - fingerprint of the frame
+* @return     frame read
+*/
+static bool fingerprintEntry(CaptureFile* capture, const CaptureIndex_Entry* entry, uint64_t* fingerprint)
+{
+    uint8_t frame[captureIndex_maxFrameSize];
+    size_t  frameSize = fieldIndex_payload + entry->payloadLength;
+
+    if( !capture->readAt(entry->frameOffset, frame, frameSize) )
+        return false;
+
+    *fingerprint = fingerprintFrame(frame, frameSize);
+
+    return true;
+}
+
+/*
+* @brief Read and check a sidecar header
+*
+* @param[in]  file         - sidecar, positioned at the start
+* @param[out] coveredBytes - capture bytes the entries cover
+* @param[out] entryCount   - number of entries
+* @param[out] fingerprint  - fingerprint of the last frame the entries cover
+* @return     header valid
+*/
+static bool readHeader(FILE* file, uint64_t* coveredBytes, uint64_t* entryCount, uint64_t* fingerprint)
+{
+    uint8_t header[captureIndex_headerSize];
+
+    if( fread(header, 1, sizeof(header), file) != sizeof(header) )
+        return false;
+
+    if(   memcmp(&header[captureIndexHeader_magic], captureIndexMagic, 4) != 0
+       || loadLittle<uint16_t>(&header[captureIndexHeader_version]) != captureIndex_version
+       || loadLittle<uint16_t>(&header[captureIndexHeader_entrySize]) != captureIndex_entrySize
+      )
+    {
+        return false;
+    }
+
+    *coveredBytes = loadLittle<uint64_t>(&header[captureIndexHeader_coveredBytes]);
+    *entryCount   = loadLittle<uint64_t>(&header[captureIndexHeader_entryCount]);
+    *fingerprint  = loadLittle<uint64_t>(&header[captureIndexHeader_fingerprint]);
+
+    return true;
+}
+
+/*
+* @brief Write a sidecar header at the start of the file
+*
+* @param file         - sidecar
+* @param coveredBytes - capture bytes the entries cover
+* @param entryCount   - number of entries
+* @param fingerprint  - fingerprint of the last frame the entries cover
+* @return             header written
+*/
+static bool writeHeader(FILE* file, uint64_t coveredBytes, uint64_t entryCount, uint64_t fingerprint)
+{
+    uint8_t header[captureIndex_headerSize];
+
+    memset(header, 0, sizeof(header));
+    memcpy(&header[captureIndexHeader_magic], captureIndexMagic, 4);
+    storeLittle<uint16_t>(&header[captureIndexHeader_version], captureIndex_version);
+    storeLittle<uint16_t>(&header[captureIndexHeader_entrySize], captureIndex_entrySize);
+    storeLittle<uint64_t>(&header[captureIndexHeader_coveredBytes], coveredBytes);
+    storeLittle<uint64_t>(&header[captureIndexHeader_entryCount], entryCount);
+    storeLittle<uint64_t>(&header[captureIndexHeader_fingerprint], fingerprint);
+
+    return fseek(file, 0, SEEK_SET) == 0 && fwrite(header, 1, sizeof(header), file) == sizeof(header);
+}
+
+
+
+CaptureIndex::CaptureIndex()
+{
+    this->entries        = NULL;
+    this->entryCount     = 0;
+    this->byEpoch        = NULL;
+    this->heartbeatCount = 0;
+    this->matches        = NULL;
+}
+
+CaptureIndex::~CaptureIndex()
+{
+    free(this->entries);
+    free(this->byEpoch);
+    free(this->matches);
+}
+
+/*
+* @brief Bring the sidecar of a capture up to date in one pass over the new part
+*        An index that does not match the capture is rebuilt from the start.
+*
+* @param capturePath - capture to index
+* @param indexPath   - sidecar file, created if missing
+* @return            index up to date
+*/
+bool CaptureIndex::build(const char* capturePath, const char* indexPath)
+{
+    assert( capturePath );
+    assert( indexPath );
+
+    CaptureFile capture;
+
+    if( !capture.open(capturePath) )
+        return false;
+
+    uint64_t           coveredBytes = 0;
+    uint64_t           entryCount   = 0;
+    uint64_t           fingerprint  = 0;
+    CaptureIndex_Entry lastEntry;
+    FILE*              file         = fopen(indexPath, "r+b");
+
+    if( file && !readHeader(file, &coveredBytes, &entryCount, &fingerprint) )
+    {
+        coveredBytes = 0;
+        entryCount   = 0;
+    }
+
+    // A capture that was replaced rather than appended to no longer holds the
+    //   last frame indexed, or holds different bytes there
+    if( entryCount > 0 )
+    {
+        uint8_t  bytes[captureIndex_entrySize];
+        uint64_t found;
+
+        bool same =    fseek(file, (long)(captureIndex_headerSize + (entryCount - 1) * captureIndex_entrySize), SEEK_SET) == 0
+                    && fread(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+
+        if( same )
+        {
+            decodeEntry(bytes, &lastEntry);
+
+            same =    lastEntry.frameOffset + fieldIndex_payload + lastEntry.payloadLength == coveredBytes
+                   && coveredBytes <= capture.getSize()
+                   && fingerprintEntry(&capture, &lastEntry, &found)
+                   && found == fingerprint;
+        }
+
+        if( !same )
+        {
+            coveredBytes = 0;
+            entryCount   = 0;
+        }
+    }
+
+    if( entryCount == 0 )
+    {
+        coveredBytes = 0;
+        fingerprint  = 0;
+    }
+
+    if( file == NULL )
+        file = fopen(indexPath, "w+b");
+
+    if( file == NULL )
+        return false;
+
+    uint64_t entriesEnd = captureIndex_headerSize + entryCount * captureIndex_entrySize;
+
+    if(   ftruncate(fileno(file), (off_t)entriesEnd) != 0
+       || !writeHeader(file, coveredBytes, entryCount, fingerprint)
+       || fseek(file, (long)entriesEnd, SEEK_SET) != 0
+      )
+    {
+        fclose(file);
+        return false;
+    }
+
+    setvbuf(file, NULL, _IOFBF, captureIndex_bufferSize);
+
+    // The handler starts at the end of the last message indexed, as a parse from the start would
+    MessageHandler handler;
+    uint64_t       resumeOffset = coveredBytes;
+    uint64_t       resumeCount  = entryCount;
+    bool           written      = true;
+    const uint8_t* span;
+    size_t         spanSize;
+
+    handler.setSink(NULL);
+
+    while( written && capture.nextSpan(&span, &spanSize) )
+    {
+        uint64_t spanEnd = capture.getOffset();
+        uint64_t spanStart = spanEnd - spanSize;
+
+        if( spanEnd <= resumeOffset )
+            continue;
+
+        size_t position = (resumeOffset > spanStart) ? (size_t)(resumeOffset - spanStart) : 0;
+
+        while( position < spanSize )
+        {
+            MessageView        view;
+            CaptureIndex_Entry entry;
+            uint8_t            bytes[captureIndex_entrySize];
+            size_t             consumed;
+
+            if( !handler.parseView(&span[position], spanSize - position, &consumed, &view) )
+                break;
+
+            position += consumed;
+
+            entry.frameOffset       = resumeOffset + handler.getMessageOffset();
+            entry.commandCode       = view.getCommandCode();
+            entry.payloadLength     = view.getPayloadLength();
+            entry.epochTime_seconds = 0;
+            entry.serialNumber      = 0;
+
+            if( entry.commandCode == MESSAGE_HANDLER_COMMAND_HEARTBEAT )
+            {
+                MessageHandler_HeartbeatPayload heartbeat;
+                view.getHeartbeat(&heartbeat);
+
+                entry.epochTime_seconds = heartbeat.epochTime_seconds;
+                entry.serialNumber      = heartbeat.serialNumber;
+            }
+
+            encodeEntry(&entry, bytes);
+
+            if( fwrite(bytes, 1, sizeof(bytes), file) != sizeof(bytes) )
+            {
+                written = false;
+                break;
+            }
+
+            coveredBytes = entry.frameOffset + view.getFrameSize();
+            entryCount++;
+            lastEntry = entry;
+        }
+    }
+
+    // The last frame may sit in a span already unmapped, so it is read back once
+    if( written && entryCount > resumeCount )
+        written = fingerprintEntry(&capture, &lastEntry, &fingerprint);
+
+    // Entries first, then the header that counts them
+    written = written && fflush(file) == 0 && writeHeader(file, coveredBytes, entryCount, fingerprint);
+
+    return (fclose(file) == 0) && written;
+}
+
+/*
+* @brief Read a sidecar into memory, replacing what was loaded before
+*
+* @param indexPath - sidecar file
+* @return          index loaded
+*/
+bool CaptureIndex::load(const char* indexPath)
+{
+    assert( indexPath );
+
+    free(this->entries);
+    free(this->byEpoch);
+    free(this->matches);
+
+    this->entries        = NULL;
+    this->entryCount     = 0;
+    this->byEpoch        = NULL;
+    this->heartbeatCount = 0;
+    this->matches        = NULL;
+
+    FILE*    file = fopen(indexPath, "rb");
+    uint64_t coveredBytes;
+    uint64_t entryCount;
+    uint64_t fingerprint;
+
+    if( file == NULL )
+        return false;
+
+    if( !readHeader(file, &coveredBytes, &entryCount, &fingerprint) )
+    {
+        fclose(file);
+        return false;
+    }
+
+    this->entries = (CaptureIndex_Entry*)malloc((entryCount ? entryCount : 1) * sizeof(CaptureIndex_Entry));
+
+    uint8_t* buffer = (uint8_t*)malloc(captureIndex_bufferSize);
+    bool     loaded = (this->entries != NULL) && (buffer != NULL);
+
+    while( loaded && this->entryCount < entryCount )
+    {
+        uint64_t count = entryCount - this->entryCount;
+
+        if( count > captureIndex_bufferSize / captureIndex_entrySize )
+            count = captureIndex_bufferSize / captureIndex_entrySize;
+
+        if( fread(buffer, captureIndex_entrySize, (size_t)count, file) != count )
+        {
+            loaded = false;
+            break;
+        }
+
+        for(uint64_t i = 0; i < count; i++)
+            decodeEntry(&buffer[i * captureIndex_entrySize], &this->entries[this->entryCount++]);
+    }
+
+    free(buffer);
+    fclose(file);
+
+    if( loaded )
+        this->sortByEpoch();
+
+    return loaded && this->byEpoch != NULL;
+}
+
+/*
+* @brief Get the number of entries loaded
+*
+* @return entry count
+*/
+uint64_t CaptureIndex::getCount(void)
+{
+    return this->entryCount;
+}
+
+/*
+* @brief Get a loaded entry
+*
+* @param index - index of the entry, below getCount
+* @return      entry
+*/
+CaptureIndex_Entry* CaptureIndex::getEntry(uint64_t index)
+{
+    assert( index < this->entryCount );
+
+    return &this->entries[index];
+}
+
+/*
+* @brief Find the heartbeats a query selects, without scanning every entry
+*
+* @param[in]  query   - heartbeats to select
+* @param[out] matches - indexes of the selected entries in capture order;
+*                       valid until the next select or load
+* @return     number of entries selected
+*/
+uint64_t CaptureIndex::select(const CaptureIndex_Query* query, uint64_t** matches)
+{
+    assert( query );
+    assert( matches );
+
+    CaptureIndex_Entry* entries = this->entries;
+    uint64_t            count   = 0;
+
+    // Binary search for the first heartbeat in the time range, then walk to its end
+    uint64_t* first = lower_bound(this->byEpoch, this->byEpoch + this->heartbeatCount, query->fromEpoch_seconds,
+                                  [entries](uint64_t index, uint32_t epoch) { return entries[index].epochTime_seconds < epoch; });
+
+    for(uint64_t* next = first; next < this->byEpoch + this->heartbeatCount; next++)
+    {
+        CaptureIndex_Entry* entry = &entries[*next];
+
+        if( entry->epochTime_seconds > query->toEpoch_seconds )
+            break;
+
+        if( !query->matchSerial || entry->serialNumber == query->serialNumber )
+            this->matches[count++] = *next;
+    }
+
+    sort(this->matches, this->matches + count);
+
+    *matches = this->matches;
+
+    return count;
+}
+
+/*
+* @brief Sort the heartbeat entries by epoch time for select
+*/
+void CaptureIndex::sortByEpoch(void)
+{
+    this->heartbeatCount = 0;
+
+    for(uint64_t i = 0; i < this->entryCount; i++)
+    {
+        if( this->entries[i].commandCode == MESSAGE_HANDLER_COMMAND_HEARTBEAT )
+            this->heartbeatCount++;
+    }
+
+    size_t size = (this->heartbeatCount ? this->heartbeatCount : 1) * sizeof(uint64_t);
+
+    this->byEpoch = (uint64_t*)malloc(size);
+    this->matches = (uint64_t*)malloc(size);
+
+    if( this->byEpoch == NULL || this->matches == NULL )
+    {
+        free(this->byEpoch);
+        free(this->matches);
+        this->byEpoch = NULL;
+        this->matches = NULL;
+        return;
+    }
+
+    uint64_t count = 0;
+
+    for(uint64_t i = 0; i < this->entryCount; i++)
+    {
+        if( this->entries[i].commandCode == MESSAGE_HANDLER_COMMAND_HEARTBEAT )
+            this->byEpoch[count++] = i;
+    }
+
+    // Captures are mostly in time order already, so this is usually close to a linear pass
+    CaptureIndex_Entry* entries = this->entries;
+
+    stable_sort(this->byEpoch, this->byEpoch + count,
+                [entries](uint64_t a, uint64_t b) { return entries[a].epochTime_seconds < entries[b].epochTime_seconds; });
+}
+
+
+
+CaptureIndexWriter::CaptureIndexWriter()
+{
+    this->file         = NULL;
+    this->coveredBytes = 0;
+    this->entryCount   = 0;
+    this->fingerprint  = 0;
+    this->failed       = false;
+}
+
+CaptureIndexWriter::~CaptureIndexWriter()
+{
+    if( this->file )
+        fclose(this->file);
+}
+
+/*
+* @brief Create an empty sidecar, replacing any file at path
+*
+* @param indexPath - sidecar file
+* @return          file created
+*/
+bool CaptureIndexWriter::open(const char* indexPath)
+{
+    assert( indexPath );
+    assert( this->file == NULL );
+
+    this->file = fopen(indexPath, "w+b");
+
+    if( this->file == NULL )
+        return false;
+
+    setvbuf(this->file, NULL, _IOFBF, captureIndex_bufferSize);
+
+    // Until close, the header counts nothing, like an interrupted build
+    this->failed = !writeHeader(this->file, 0, 0, 0);
+
+    return !this->failed;
+}
+
+/*
+* @brief Add the next message of the capture
+*
+* @param entry - message; frame offsets must only grow
+* @param frame - bytes of the message frame
+* @return      entry written
+*/
+bool CaptureIndexWriter::addEntry(const CaptureIndex_Entry* entry, const uint8_t* frame)
+{
+    assert( entry );
+    assert( frame );
+    assert( this->file );
+    assert( entry->frameOffset >= this->coveredBytes );
+
+    uint8_t bytes[captureIndex_entrySize];
+
+    encodeEntry(entry, bytes);
+
+    if( this->failed || fwrite(bytes, 1, sizeof(bytes), this->file) != sizeof(bytes) )
+    {
+        this->failed = true;
+        return false;
+    }
+
+    this->coveredBytes = entry->frameOffset + fieldIndex_payload + entry->payloadLength;
+    this->entryCount++;
+    this->fingerprint  = fingerprintFrame(frame, fieldIndex_payload + entry->payloadLength);
+
+    return true;
+}
+
+/*
+* @brief Write the header that counts the entries, then close the file
+*
+* @return sidecar complete
+*/
+bool CaptureIndexWriter::close(void)
+{
+    if( this->file == NULL )
+        return false;
+
+    bool written = !this->failed && fflush(this->file) == 0 && writeHeader(this->file, this->coveredBytes, this->entryCount, this->fingerprint);
+
+    written = (fclose(this->file) == 0) && written;
+
+    this->file = NULL;
+
+    return written;
+}
+
+
+
+// EOF
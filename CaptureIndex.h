@@ -0,0 +1,172 @@
+/* CaptureIndex.h
+ *
+ * This defines an index of the verified messages in a capture, kept in a
+ *   sidecar file next to it, so messages can be found by time or device
+ *   without parsing the capture again.
+ *
+ *   The sidecar is a header followed by one fixed size little-endian entry per
+ *   message, in capture order. The header records how much of the capture the
+ *   entries cover and a fingerprint of the last frame they cover; building the
+ *   index again checks that frame is still in the capture, then only parses
+ *   what was added since, and appends to the entries.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef CaptureIndex_h
+#define CaptureIndex_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+
+/*
+ * @brief sidecar layout
+ */
+enum
+{
+    captureIndex_version    = 2,
+
+    captureIndex_headerSize = 32,   /* magic, version, entry size, covered bytes, entry count, last frame fingerprint */
+    captureIndex_entrySize  = 20,   /* frame offset, epoch, serial number, command code, payload length */
+};
+
+/*
+ * @brief one verified message; epoch time and serial number are 0 for anything but a heartbeat
+ */
+typedef struct
+{
+    uint64_t frameOffset;
+    uint32_t epochTime_seconds;
+    uint32_t serialNumber;
+    uint16_t commandCode;
+    uint16_t payloadLength;
+} CaptureIndex_Entry;
+
+/*
+ * @brief heartbeats to select; both epoch times are inclusive
+ */
+typedef struct
+{
+    bool     matchSerial;
+    uint32_t serialNumber;
+    uint32_t fromEpoch_seconds;
+    uint32_t toEpoch_seconds;
+} CaptureIndex_Query;
+
+
+
+class CaptureIndex
+{
+    public:
+
+        CaptureIndex();
+        ~CaptureIndex();
+
+        /*
+         * @brief Bring the sidecar of a capture up to date in one pass over the new part
+         *        An index that does not match the capture is rebuilt from the start.
+         *
+         * @param capturePath - capture to index
+         * @param indexPath   - sidecar file, created if missing
+         * @return            index up to date
+         */
+        bool build(const char* capturePath, const char* indexPath);
+
+        /*
+         * @brief Read a sidecar into memory, replacing what was loaded before
+         *
+         * @param indexPath - sidecar file
+         * @return          index loaded
+         */
+        bool load(const char* indexPath);
+
+        /*
+         * @brief Get the number of entries loaded
+         *
+         * @return entry count
+         */
+        uint64_t getCount(void);
+
+        /*
+         * @brief Get a loaded entry
+         *
+         * @param index - index of the entry, below getCount
+         * @return      entry
+         */
+        CaptureIndex_Entry* getEntry(uint64_t index);
+
+        /*
+         * @brief Find the heartbeats a query selects, without scanning every entry
+         *
+         * @param[in]  query   - heartbeats to select
+         * @param[out] matches - indexes of the selected entries in capture order;
+         *                       valid until the next select or load
+         * @return     number of entries selected
+         */
+        uint64_t select(const CaptureIndex_Query* query, uint64_t** matches);
+
+    private:
+        /*
+         * @brief Sort the heartbeat entries by epoch time for select
+         */
+        void sortByEpoch(void);
+
+        CaptureIndex_Entry* entries;
+        uint64_t            entryCount;
+
+        uint64_t*           byEpoch;        /* heartbeat entry indexes, by epoch time then capture order */
+        uint64_t            heartbeatCount;
+
+        uint64_t*           matches;
+};
+
+/*
+ * @brief Writes a sidecar for a capture whose messages are already known, such as
+ *        one being generated; it matches what CaptureIndex::build would write
+ *        for the same capture when the entries are the messages build would find
+ */
+class CaptureIndexWriter
+{
+    public:
+
+        CaptureIndexWriter();
+        ~CaptureIndexWriter();
+
+        /*
+         * @brief Create an empty sidecar, replacing any file at path
+         *
+         * @param indexPath - sidecar file
+         * @return          file created
+         */
+        bool open(const char* indexPath);
+
+        /*
+         * @brief Add the next message of the capture
+         *
+         * @param entry - message; frame offsets must only grow
+         * @param frame - bytes of the message frame
+         * @return      entry written
+         */
+        bool addEntry(const CaptureIndex_Entry* entry, const uint8_t* frame);
+
+        /*
+         * @brief Write the header that counts the entries, then close the file
+         *
+         * @return sidecar complete
+         */
+        bool close(void);
+
+    private:
+        FILE*    file;
+        uint64_t coveredBytes;
+        uint64_t entryCount;
+        uint64_t fingerprint;   /* of the last frame added */
+        bool     failed;
+};
+
+
+#endif // CaptureIndex_h
@@ -0,0 +1,277 @@
+/* Checksum.cpp
+ *
+ * This implements the message checksum and its SIMD kernels.
+ *   psadbw against zero sums each group of 8 bytes into a 64 bit lane, so the
+ *   kernels only add lanes in the loop and reduce them once at the end.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "Checksum.h"
+
+#include <assert.h>     /* assert */
+#include <stdlib.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHECKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+
+
+/*
+* @brief Buffers shorter than this are summed by the scalar loop in every kernel
+*/
+enum
+{
+    checksum_minimumVectorSize = 16,
+};
+
+static const char* kernelNames[checksum_kernelCount] =
+{
+    "scalar",
+    "sse2",
+    "avx2",
+    "avx512",
+};
+
+
+
+static uint16_t checksumScalar(const uint8_t* buffer, uint32_t size)
+{
+    assert( buffer || size == 0 );
+
+    uint16_t checksum = 0;
+
+    for(uint32_t i = 0; i < size; i++)
+    {
+        checksum += buffer[i];
+    }
+
+    return checksum;
+}
+
+
+
+#ifdef CHECKSUM_X86
+
+__attribute__((target("sse2")))
+static uint16_t checksumSse2(const uint8_t* buffer, uint32_t size)
+{
+    if( size < checksum_minimumVectorSize )
+        return checksumScalar(buffer, size);
+
+    const __m128i zero = _mm_setzero_si128();
+    __m128i       sum0 = zero;
+    __m128i       sum1 = zero;
+    uint32_t      i    = 0;
+
+    for( ; i + 2 * sizeof(__m128i) <= size; i += 2 * sizeof(__m128i) )
+    {
+        sum0 = _mm_add_epi64(sum0, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)&buffer[i]), zero));
+        sum1 = _mm_add_epi64(sum1, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)&buffer[i + sizeof(__m128i)]), zero));
+    }
+
+    if( i + sizeof(__m128i) <= size )
+    {
+        sum0 = _mm_add_epi64(sum0, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)&buffer[i]), zero));
+        i   += sizeof(__m128i);
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(sum0, sum1));
+
+    return (uint16_t)(lanes[0] + lanes[1]) + checksumScalar(&buffer[i], size - i);
+}
+
+
+
+__attribute__((target("avx2")))
+static uint16_t checksumAvx2(const uint8_t* buffer, uint32_t size)
+{
+    if( size < 2 * sizeof(__m256i) )
+        return checksumSse2(buffer, size);
+
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i       sum0 = zero;
+    __m256i       sum1 = zero;
+    uint32_t      i    = 0;
+
+    for( ; i + 2 * sizeof(__m256i) <= size; i += 2 * sizeof(__m256i) )
+    {
+        sum0 = _mm256_add_epi64(sum0, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)&buffer[i]), zero));
+        sum1 = _mm256_add_epi64(sum1, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)&buffer[i + sizeof(__m256i)]), zero));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(sum0, sum1));
+
+    return (uint16_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + checksumSse2(&buffer[i], size - i);
+}
+
+
+
+__attribute__((target("avx512f,avx512bw")))
+static uint16_t checksumAvx512(const uint8_t* buffer, uint32_t size)
+{
+    if( size < 2 * sizeof(__m512i) )
+        return checksumAvx2(buffer, size);
+
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i       sum0 = zero;
+    __m512i       sum1 = zero;
+    uint32_t      i    = 0;
+
+    for( ; i + 2 * sizeof(__m512i) <= size; i += 2 * sizeof(__m512i) )
+    {
+        sum0 = _mm512_add_epi64(sum0, _mm512_sad_epu8(_mm512_loadu_si512((const void*)&buffer[i]), zero));
+        sum1 = _mm512_add_epi64(sum1, _mm512_sad_epu8(_mm512_loadu_si512((const void*)&buffer[i + sizeof(__m512i)]), zero));
+    }
+
+    uint64_t lanes[8];
+    _mm512_storeu_si512((void*)lanes, _mm512_add_epi64(sum0, sum1));
+
+    uint64_t sum = 0;
+
+    for(uint32_t lane = 0; lane < 8; lane++)
+        sum += lanes[lane];
+
+    return (uint16_t)sum + checksumAvx2(&buffer[i], size - i);
+}
+
+#endif // CHECKSUM_X86
+
+
+
+typedef uint16_t (*ChecksumFunction)(const uint8_t* buffer, uint32_t size);
+
+static const ChecksumFunction kernels[checksum_kernelCount] =
+{
+    checksumScalar,
+#ifdef CHECKSUM_X86
+    checksumSse2,
+    checksumAvx2,
+    checksumAvx512,
+#else
+    checksumScalar,
+    checksumScalar,
+    checksumScalar,
+#endif
+};
+
+/*
+* @brief Pick the kernel while the program starts, before any thread can sum, so the
+*        pointer is never written once threads share it
+*/
+static ChecksumFunction selectChecksumKernel(void)
+{
+#ifdef CHECKSUM_X86
+    // CPU features are not guaranteed to be read yet this early
+    __builtin_cpu_init();
+#endif
+
+    return kernels[getChecksumKernel()];
+}
+
+static const ChecksumFunction checksumKernel = selectChecksumKernel();
+
+
+
+/*
+* @brief Sum the bytes of a buffer with the fastest kernel the CPU supports
+*
+* @param buffer - bytes to sum
+* @param size   - number of bytes
+* @return       checksum
+*/
+uint16_t generateChecksum(const uint8_t* buffer, uint32_t size)
+{
+    assert( buffer || size == 0 );
+
+    // Headers and most payloads are shorter than a vector; skip the kernel chain for them
+    if( size < checksum_minimumVectorSize )
+        return checksumScalar(buffer, size);
+
+    return checksumKernel(buffer, size);
+}
+
+/*
+* @brief Sum the bytes of a buffer with a particular kernel
+*
+* @param kernel - kernel to use; it must be supported
+* @param buffer - bytes to sum
+* @param size   - number of bytes
+* @return       checksum
+*/
+uint16_t generateChecksumWith(Checksum_Kernel kernel, const uint8_t* buffer, uint32_t size)
+{
+    assert( isChecksumKernelSupported(kernel) );
+    assert( buffer || size == 0 );
+
+    return kernels[kernel](buffer, size);
+}
+
+/*
+* @brief Get the kernel generateChecksum uses on this CPU
+*
+* @return kernel
+*/
+Checksum_Kernel getChecksumKernel(void)
+{
+    for(int kernel = checksum_kernelCount - 1; kernel > checksum_kernelScalar; kernel--)
+    {
+        if( isChecksumKernelSupported((Checksum_Kernel)kernel) )
+            return (Checksum_Kernel)kernel;
+    }
+
+    return checksum_kernelScalar;
+}
+
+/*
+* @brief Find out whether this build and CPU can run a kernel
+*
+* @param kernel - kernel to check
+* @return       kernel supported
+*/
+bool isChecksumKernelSupported(Checksum_Kernel kernel)
+{
+    switch( kernel )
+    {
+        case checksum_kernelScalar:
+            return true;
+
+#ifdef CHECKSUM_X86
+        // These check CPUID and that the OS saves the wider registers
+        case checksum_kernelSse2:
+            return __builtin_cpu_supports("sse2");
+
+        case checksum_kernelAvx2:
+            return __builtin_cpu_supports("avx2");
+
+        case checksum_kernelAvx512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+
+        default:
+            return false;
+    }
+}
+
+/*
+* @brief Get a printable name for a kernel
+*
+* @param kernel - kernel to name
+* @return       name
+*/
+const char* getChecksumKernelName(Checksum_Kernel kernel)
+{
+    assert( kernel < checksum_kernelCount );
+
+    return kernelNames[kernel];
+}
+
+
+
+// EOF
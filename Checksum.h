@@ -0,0 +1,75 @@
+/* Checksum.h
+ *
+ * This declares the message checksum: the sum of every byte, truncated to 16 bits.
+ *   On x86 the sum runs through SSE2, AVX2 or AVX-512 kernels built on psadbw,
+ *   picked at runtime from what the CPU supports; everywhere else, and for
+ *   anything too short to be worth it, a scalar loop gives the same result.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef Checksum_h
+#define Checksum_h
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+
+typedef enum
+{
+    checksum_kernelScalar = 0,
+    checksum_kernelSse2,
+    checksum_kernelAvx2,
+    checksum_kernelAvx512,
+
+    checksum_kernelCount,
+} Checksum_Kernel;
+
+
+
+/*
+ * @brief Sum the bytes of a buffer with the fastest kernel the CPU supports
+ *
+ * @param buffer - bytes to sum
+ * @param size   - number of bytes
+ * @return       checksum
+ */
+uint16_t generateChecksum(const uint8_t* buffer, uint32_t size);
+
+/*
+ * @brief Sum the bytes of a buffer with a particular kernel
+ *
+ * @param kernel - kernel to use; it must be supported
+ * @param buffer - bytes to sum
+ * @param size   - number of bytes
+ * @return       checksum
+ */
+uint16_t generateChecksumWith(Checksum_Kernel kernel, const uint8_t* buffer, uint32_t size);
+
+/*
+ * @brief Get the kernel generateChecksum uses on this CPU
+ *
+ * @return kernel
+ */
+Checksum_Kernel getChecksumKernel(void);
+
+/*
+ * @brief Find out whether this build and CPU can run a kernel
+ *
+ * @param kernel - kernel to check
+ * @return       kernel supported
+ */
+bool isChecksumKernelSupported(Checksum_Kernel kernel);
+
+/*
+ * @brief Get a printable name for a kernel
+ *
+ * @param kernel - kernel to name
+ * @return       name
+ */
+const char* getChecksumKernelName(Checksum_Kernel kernel);
+
+
+#endif // Checksum_h
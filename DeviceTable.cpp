@@ -0,0 +1,216 @@
+/* DeviceTable.cpp
+ *
+ * This implements a table of per-device state, keyed by heartbeat serial number.
+ *   Serial numbers are hashed by multiplying by 2^32 / golden ratio and keeping
+ *   the top bits, which spreads sequential serial numbers across the table.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "DeviceTable.h"
+
+#include <assert.h>     /* assert */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+using namespace std;
+
+
+
+enum
+{
+    deviceTable_hashMultiplier = 2654435769u,
+};
+
+
+
+DeviceTable::DeviceTable(uint32_t capacity)
+{
+    uint32_t slotCount = 4;
+    uint32_t slotBits  = 2;
+
+    while( slotCount < capacity )
+    {
+        slotCount *= 2;
+        slotBits++;
+    }
+
+    this->slots     = new Slot[slotCount]();
+    this->slotMask  = slotCount - 1;
+    this->slotShift = 32 - slotBits;
+    this->maxCount  = slotCount - slotCount / 4;
+
+    this->count        = 0;
+    this->droppedCount = 0;
+}
+
+DeviceTable::~DeviceTable()
+{
+    delete[] this->slots;
+}
+
+/*
+* @brief Record a heartbeat; updating thread only
+*
+* @param heartbeat - decoded heartbeat
+* @return          recorded; false for a new device when the table is full
+*/
+bool DeviceTable::update(MessageHandler_HeartbeatPayload* heartbeat)
+{
+    assert( heartbeat );
+
+    uint32_t index = (uint32_t)(heartbeat->serialNumber * deviceTable_hashMultiplier) >> this->slotShift;
+    Slot*    slot  = &this->slots[index];
+
+    // Only this thread writes, so the slots can be read here without the sequence
+    while( slot->used && slot->device.serialNumber != heartbeat->serialNumber )
+    {
+        index = (index + 1) & this->slotMask;
+        slot  = &this->slots[index];
+    }
+
+    if( !slot->used && this->count.load(memory_order_relaxed) == this->maxCount )
+    {
+        this->droppedCount.store(this->droppedCount.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        return false;
+    }
+
+    uint32_t            sequence = slot->sequence.load(memory_order_relaxed);
+    DeviceTable_Device* device   = &slot->device;
+
+    slot->sequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    if( !slot->used )
+    {
+        memset(device, 0, sizeof(DeviceTable_Device));
+        device->serialNumber      = heartbeat->serialNumber;
+        device->firstSeen_seconds = heartbeat->epochTime_seconds;
+        device->lastSeen_seconds  = heartbeat->epochTime_seconds;
+        device->heartbeat.mode    = heartbeat->mode;
+
+        slot->used = true;
+        this->count.store(this->count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+
+    if( heartbeat->mode != device->heartbeat.mode )
+        device->modeTransitions++;
+
+    if( heartbeat->epochTime_seconds < device->lastSeen_seconds )
+        device->outOfOrderCount++;
+    else
+        device->lastSeen_seconds = heartbeat->epochTime_seconds;
+
+    device->heartbeat = *heartbeat;
+    device->heartbeatCount++;
+
+    slot->sequence.store(sequence + 2, memory_order_release);
+
+    return true;
+}
+
+/*
+* @brief Copy the state of one device; any thread
+*
+* @param[in]  serialNumber - device to find
+* @param[out] device       - its state
+* @return     device found
+*/
+bool DeviceTable::find(uint32_t serialNumber, DeviceTable_Device* device)
+{
+    assert( device );
+
+    uint32_t index = (uint32_t)(serialNumber * deviceTable_hashMultiplier) >> this->slotShift;
+
+    // The table is never full, so an unused slot ends every probe
+    for(uint32_t probe = 0; probe <= this->slotMask; probe++)
+    {
+        if( !this->readSlot(&this->slots[index], device) )
+            return false;
+
+        if( device->serialNumber == serialNumber )
+            return true;
+
+        index = (index + 1) & this->slotMask;
+    }
+
+    return false;
+}
+
+/*
+* @brief Copy the state of every device; any thread
+*        Each device is copied consistently, but devices updated during
+*        the copy may be from before or after the update.
+*
+* @param[out] devices  - array the devices are copied to
+* @param[in]  maxCount - length of devices
+* @return     number of devices copied
+*/
+uint32_t DeviceTable::snapshot(DeviceTable_Device* devices, uint32_t maxCount)
+{
+    assert( devices || maxCount == 0 );
+
+    uint32_t copied = 0;
+
+    for(uint32_t index = 0; index <= this->slotMask && copied < maxCount; index++)
+    {
+        if( this->readSlot(&this->slots[index], &devices[copied]) )
+            copied++;
+    }
+
+    return copied;
+}
+
+/*
+* @brief Get the number of devices in the table
+*
+* @return device count
+*/
+uint32_t DeviceTable::getCount(void)
+{
+    return this->count.load(memory_order_relaxed);
+}
+
+/*
+* @brief Get the number of heartbeats from new devices that did not fit
+*
+* @return dropped heartbeat count
+*/
+uint64_t DeviceTable::getDroppedCount(void)
+{
+    return this->droppedCount.load(memory_order_relaxed);
+}
+
+/*
+* @brief Copy a slot that is not being written
+*
+* @param[in]  slot   - slot to copy
+* @param[out] device - device in the slot
+* @return     slot in use
+*/
+bool DeviceTable::readSlot(Slot* slot, DeviceTable_Device* device)
+{
+    uint32_t before;
+    uint32_t after;
+    bool     used;
+
+    do
+    {
+        before = slot->sequence.load(memory_order_acquire);
+
+        used = slot->used;
+        memcpy(device, &slot->device, sizeof(DeviceTable_Device));
+
+        atomic_thread_fence(memory_order_acquire);
+        after = slot->sequence.load(memory_order_relaxed);
+    }
+    while( (before & 1) || before != after );
+
+    return used;
+}
+
+
+
+// EOF
@@ -0,0 +1,132 @@
+/* DeviceTable.h
+ *
+ * This defines a table of per-device state, keyed by heartbeat serial number.
+ *   It is an open-addressing hash table with linear probing, one cache line
+ *   per slot, sized once when it is created so it never moves under a reader.
+ *
+ *   One thread updates the table, normally the one decoding messages through
+ *   MessageHandler::setDeviceTable. Any number of other threads may read it at
+ *   the same time; each slot carries a sequence count, and a reader that sees
+ *   it change while copying the slot copies it again.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef DeviceTable_h
+#define DeviceTable_h
+
+#include "MessageHandler.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+
+
+
+/*
+ * @brief table sizes; the table holds up to 3/4 of its slots
+ */
+enum
+{
+    deviceTable_defaultCapacity = 16384,
+    deviceTable_cacheLineSize   = 64,
+};
+
+/*
+ * @brief what the table knows about one device
+ */
+typedef struct
+{
+    uint32_t                        serialNumber;
+    MessageHandler_HeartbeatPayload heartbeat;          /* the last one received */
+    uint32_t                        firstSeen_seconds;  /* epoch time of the first heartbeat received */
+    uint32_t                        lastSeen_seconds;   /* latest epoch time of any heartbeat received */
+    uint64_t                        heartbeatCount;
+    uint32_t                        modeTransitions;    /* heartbeats whose mode differs from the one before */
+    uint32_t                        outOfOrderCount;    /* heartbeats older than lastSeen_seconds */
+} DeviceTable_Device;
+
+
+
+class DeviceTable
+{
+    public:
+
+        /*
+         * @param capacity - number of slots, rounded up to a power of 2 of at least 4
+         */
+        DeviceTable(uint32_t capacity = deviceTable_defaultCapacity);
+        ~DeviceTable();
+
+        /*
+         * @brief Record a heartbeat; updating thread only
+         *
+         * @param heartbeat - decoded heartbeat
+         * @return          recorded; false for a new device when the table is full
+         */
+        bool update(MessageHandler_HeartbeatPayload* heartbeat);
+
+        /*
+         * @brief Copy the state of one device; any thread
+         *
+         * @param[in]  serialNumber - device to find
+         * @param[out] device       - its state
+         * @return     device found
+         */
+        bool find(uint32_t serialNumber, DeviceTable_Device* device);
+
+        /*
+         * @brief Copy the state of every device; any thread
+         *        Each device is copied consistently, but devices updated during
+         *        the copy may be from before or after the update.
+         *
+         * @param[out] devices  - array the devices are copied to
+         * @param[in]  maxCount - length of devices
+         * @return     number of devices copied
+         */
+        uint32_t snapshot(DeviceTable_Device* devices, uint32_t maxCount);
+
+        /*
+         * @brief Get the number of devices in the table
+         *
+         * @return device count
+         */
+        uint32_t getCount(void);
+
+        /*
+         * @brief Get the number of heartbeats from new devices that did not fit
+         *
+         * @return dropped heartbeat count
+         */
+        uint64_t getDroppedCount(void);
+
+    private:
+        /*
+         * @brief A slot; sequence is odd while the updating thread writes it
+         */
+        typedef struct alignas(deviceTable_cacheLineSize)
+        {
+            std::atomic<uint32_t> sequence;
+            bool                  used;
+            DeviceTable_Device    device;
+        } Slot;
+
+        /*
+         * @brief Copy a slot that is not being written
+         *
+         * @param[in]  slot   - slot to copy
+         * @param[out] device - device in the slot
+         * @return     slot in use
+         */
+        bool readSlot(Slot* slot, DeviceTable_Device* device);
+
+        Slot*                 slots;
+        uint32_t              slotMask;
+        uint32_t              slotShift;        /* turns a 32 bit hash into a slot index */
+        uint32_t              maxCount;
+        std::atomic<uint32_t> count;
+        std::atomic<uint64_t> droppedCount;
+};
+
+
+#endif // DeviceTable_h
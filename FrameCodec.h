@@ -0,0 +1,229 @@
+/* FrameCodec.h
+ *
+ * This defines the wire layout of a message as a table of field descriptors,
+ *   built from the fieldIndex_/fieldSize_ and heartbeatIndex_/heartbeatSize_
+ *   enums, and the code that reads and writes it. Parsing and serialization
+ *   both go through these descriptors, so the layout is written down once.
+ *
+ *   Every field is little-endian on the wire. A field is read or written as
+ *   one unaligned load or store; the bytes are swapped only on a big-endian
+ *   host. A record whose fields sit in the same order and at the same offsets
+ *   as in its struct is copied whole on a little-endian host.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef FrameCodec_h
+#define FrameCodec_h
+
+#include "MessageHandler.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+
+/*
+ * @brief byte order of the host
+ */
+enum
+{
+    frameCodec_bigEndian = (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__),
+};
+
+
+
+/*
+ * @brief Load a little-endian value from bytes with any alignment
+ *
+ * @param bytes - pointer to sizeof(Value) bytes
+ * @return      the value in host order
+ */
+template <typename Value>
+static inline Value loadLittle(const uint8_t* bytes)
+{
+    Value value;
+
+    memcpy(&value, bytes, sizeof(Value));
+
+    if( frameCodec_bigEndian )
+    {
+        if( sizeof(Value) == sizeof(uint16_t) )
+            return (Value)__builtin_bswap16((uint16_t)value);
+        if( sizeof(Value) == sizeof(uint32_t) )
+            return (Value)__builtin_bswap32((uint32_t)value);
+        if( sizeof(Value) == sizeof(uint64_t) )
+            return (Value)__builtin_bswap64((uint64_t)value);
+    }
+
+    return value;
+}
+
+/*
+ * @brief Store a value little-endian to bytes with any alignment
+ *
+ * @param bytes - pointer to sizeof(Value) bytes
+ * @param value - the value in host order
+ */
+template <typename Value>
+static inline void storeLittle(uint8_t* bytes, Value value)
+{
+    if( frameCodec_bigEndian )
+    {
+        if( sizeof(Value) == sizeof(uint16_t) )
+            value = (Value)__builtin_bswap16((uint16_t)value);
+        else if( sizeof(Value) == sizeof(uint32_t) )
+            value = (Value)__builtin_bswap32((uint32_t)value);
+        else if( sizeof(Value) == sizeof(uint64_t) )
+            value = (Value)__builtin_bswap64((uint64_t)value);
+    }
+
+    memcpy(bytes, &value, sizeof(Value));
+}
+
+
+
+/*
+ * @brief One field: its type, its offset and size on the wire, and, for a field
+ *        that belongs to a record, its offset in the record's struct
+ */
+template <typename Value, uint32_t index, uint32_t size, size_t offset = 0>
+struct FrameCodec_Field
+{
+    static_assert( size == sizeof(Value), "field size does not match its type" );
+
+    static constexpr uint32_t wireIndex   = index;
+    static constexpr uint32_t wireSize    = size;
+    static constexpr size_t   recordIndex = offset;
+
+    static inline Value read(const uint8_t* bytes)
+    {
+        return loadLittle<Value>(&bytes[index]);
+    }
+
+    static inline void write(uint8_t* bytes, Value value)
+    {
+        storeLittle<Value>(&bytes[index], value);
+    }
+
+    template <typename Record>
+    static inline void decode(const uint8_t* bytes, Record* record)
+    {
+        Value value = read(bytes);
+
+        memcpy((uint8_t*)record + recordIndex, &value, sizeof(Value));
+    }
+
+    template <typename Record>
+    static inline void encode(const Record* record, uint8_t* bytes)
+    {
+        Value value;
+
+        memcpy(&value, (const uint8_t*)record + recordIndex, sizeof(Value));
+
+        write(bytes, value);
+    }
+};
+
+/*
+ * @brief A struct carried on the wire as a run of fields; the fields must cover
+ *        the whole struct, one after another
+ */
+template <typename Record, typename... Fields>
+struct FrameCodec_Record
+{
+    static constexpr uint32_t wireSize = (Fields::wireSize + ...);
+
+    static_assert( wireSize == sizeof(Record), "fields do not cover the record" );
+
+    static constexpr bool isContiguous(void)
+    {
+        const uint32_t indexes[] = { Fields::wireIndex... };
+        const uint32_t sizes[]   = { Fields::wireSize... };
+        const size_t   records[] = { Fields::recordIndex... };
+
+        for(uint32_t i = 0; i < sizeof...(Fields); i++)
+        {
+            if( records[i] != indexes[i] - indexes[0] )
+                return false;
+
+            if( i > 0 && indexes[i] != indexes[i - 1] + sizes[i - 1] )
+                return false;
+        }
+
+        return true;
+    }
+
+    /*
+     * @brief Decode the record from bytes holding the fields at their wire indexes
+     */
+    static inline void decode(const uint8_t* bytes, Record* record)
+    {
+        if( !frameCodec_bigEndian && isContiguous() )
+            memcpy(record, bytes + firstIndex(), sizeof(Record));
+        else
+            (Fields::decode(bytes, record), ...);
+    }
+
+    /*
+     * @brief Encode the record into bytes, putting the fields at their wire indexes
+     */
+    static inline void encode(const Record* record, uint8_t* bytes)
+    {
+        if( !frameCodec_bigEndian && isContiguous() )
+            memcpy(bytes + firstIndex(), record, sizeof(Record));
+        else
+            (Fields::encode(record, bytes), ...);
+    }
+
+    private:
+        static constexpr uint32_t firstIndex(void)
+        {
+            const uint32_t indexes[] = { Fields::wireIndex... };
+
+            return indexes[0];
+        }
+};
+
+
+
+/*
+ * @brief The prefix fields, read and written on their own
+ */
+typedef FrameCodec_Field<uint16_t, fieldIndex_keySignature,      fieldSize_keySignature>      frameCodec_keySignature;
+typedef FrameCodec_Field<uint16_t, fieldIndex_headerChecksum,    fieldSize_headerChecksum>    frameCodec_headerChecksum;
+typedef FrameCodec_Field<uint16_t, fieldIndex_dataChecksum,      fieldSize_dataChecksum>      frameCodec_dataChecksum;
+
+/*
+ * @brief The header fields, and the header as a whole; indexes are from the key signature
+ */
+typedef FrameCodec_Field<uint16_t, fieldIndex_messageProperties, fieldSize_messageProperties,
+                         offsetof(MessageHandler_Header, properties)>                         frameCodec_messageProperties;
+typedef FrameCodec_Field<uint16_t, fieldIndex_commandCode,       fieldSize_commandCode,
+                         offsetof(MessageHandler_Header, commandCode)>                        frameCodec_commandCode;
+typedef FrameCodec_Field<uint16_t, fieldIndex_payloadSize,       fieldSize_payloadSize,
+                         offsetof(MessageHandler_Header, payloadLength)>                      frameCodec_payloadSize;
+
+typedef FrameCodec_Record<MessageHandler_Header,
+                          frameCodec_messageProperties,
+                          frameCodec_commandCode,
+                          frameCodec_payloadSize>                                             frameCodec_header;
+
+/*
+ * @brief The heartbeat payload; indexes are from the start of the payload
+ */
+typedef FrameCodec_Record<MessageHandler_HeartbeatPayload,
+                          FrameCodec_Field<uint32_t, heartbeatIndex_epochTime,    heartbeatSize_epochTime,
+                                           offsetof(MessageHandler_HeartbeatPayload, epochTime_seconds)>,
+                          FrameCodec_Field<uint32_t, heartbeatIndex_serialNumber, heartbeatSize_serialNumber,
+                                           offsetof(MessageHandler_HeartbeatPayload, serialNumber)>,
+                          FrameCodec_Field<int16_t,  heartbeatIndex_voltage,      heartbeatSize_voltage,
+                                           offsetof(MessageHandler_HeartbeatPayload, voltage_cV)>,
+                          FrameCodec_Field<int8_t,   heartbeatIndex_temperature,  heartbeatSize_temperature,
+                                           offsetof(MessageHandler_HeartbeatPayload, temperature_C)>,
+                          FrameCodec_Field<uint8_t,  heartbeatIndex_mode,         heartbeatSize_mode,
+                                           offsetof(MessageHandler_HeartbeatPayload, mode)> > frameCodec_heartbeat;
+
+
+#endif // FrameCodec_h
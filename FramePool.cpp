@@ -0,0 +1,139 @@
+/* FramePool.cpp
+ *
+ * This implements a pool of reusable message buffers grouped by size class.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "FramePool.h"
+
+#include <assert.h>     /* assert */
+#include <stdlib.h>
+#include <stdint.h>
+
+using namespace std;
+
+
+
+static const uint32_t classSizes[framePool_classCount] =
+{
+    4 * 1024,
+    16 * 1024,
+    framePool_maxFrameSize,
+};
+
+
+
+FramePool::FramePool()
+{
+    for(uint32_t i = 0; i < framePool_classCount; i++)
+    {
+        this->freeLists[i]    = NULL;
+        this->cachedCounts[i] = 0;
+    }
+
+    this->allocationCount = 0;
+}
+
+FramePool::~FramePool()
+{
+    for(uint32_t i = 0; i < framePool_classCount; i++)
+    {
+        while( this->freeLists[i] )
+        {
+            FreeBuffer* next = this->freeLists[i]->next;
+            free(this->freeLists[i]);
+            this->freeLists[i] = next;
+        }
+    }
+}
+
+/*
+* @brief Get a buffer of at least size bytes
+*
+* @param[in]  size     - bytes needed, no more than framePool_maxFrameSize
+* @param[out] capacity - actual size of the buffer, to hand back to release
+* @return     buffer, NULL if it could not be allocated
+*/
+uint8_t* FramePool::acquire(uint32_t size, uint32_t* capacity)
+{
+    assert( capacity );
+    assert( size <= framePool_maxFrameSize );
+
+    uint32_t sizeClass = 0;
+
+    while( classSizes[sizeClass] < size )
+        sizeClass++;
+
+    *capacity = classSizes[sizeClass];
+
+    {
+        lock_guard<mutex> guard(this->lock);
+
+        FreeBuffer* buffer = this->freeLists[sizeClass];
+
+        if( buffer )
+        {
+            this->freeLists[sizeClass] = buffer->next;
+            this->cachedCounts[sizeClass]--;
+            return (uint8_t*)buffer;
+        }
+
+        this->allocationCount++;
+    }
+
+    return (uint8_t*)malloc(classSizes[sizeClass]);
+}
+
+/*
+* @brief Return a buffer from acquire for reuse
+*
+* @param buffer   - buffer from acquire
+* @param capacity - capacity acquire reported for it
+*/
+void FramePool::release(uint8_t* buffer, uint32_t capacity)
+{
+    if( buffer == NULL )
+        return;
+
+    uint32_t sizeClass = 0;
+
+    while( classSizes[sizeClass] != capacity )
+    {
+        sizeClass++;
+        assert( sizeClass < framePool_classCount );
+    }
+
+    {
+        lock_guard<mutex> guard(this->lock);
+
+        if( this->cachedCounts[sizeClass] < framePool_maxCachedCount )
+        {
+            FreeBuffer* freeBuffer = (FreeBuffer*)buffer;
+
+            freeBuffer->next           = this->freeLists[sizeClass];
+            this->freeLists[sizeClass] = freeBuffer;
+            this->cachedCounts[sizeClass]++;
+            return;
+        }
+    }
+
+    free(buffer);
+}
+
+/*
+* @brief Get how many buffers the pool has had to allocate
+*
+* @return allocation count since the pool was created
+*/
+uint64_t FramePool::getAllocationCount(void)
+{
+    lock_guard<mutex> guard(this->lock);
+
+    return this->allocationCount;
+}
+
+
+
+// EOF
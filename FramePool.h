@@ -0,0 +1,83 @@
+/* FramePool.h
+ *
+ * This defines a pool of reusable message buffers grouped by size class.
+ *   Handlers keep small messages in their own parse buffer and only draw
+ *   from the pool for messages that do not fit, up to the largest message
+ *   a 16 bit payload length allows. Released buffers are kept for reuse,
+ *   so a steady stream of large messages stops allocating once warm.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef FramePool_h
+#define FramePool_h
+
+#include "MessageHandler.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <mutex>
+
+
+
+/*
+ * @brief size classes; the largest holds a whole message plus a terminating NUL for JSON
+ */
+enum
+{
+    framePool_maxFrameSize   = fieldIndex_payload + 0xFFFF + 1,
+
+    framePool_classCount     = 3,
+    framePool_maxCachedCount = 64,
+};
+
+
+
+class FramePool
+{
+    public:
+
+        FramePool();
+        ~FramePool();
+
+        /*
+         * @brief Get a buffer of at least size bytes
+         *
+         * @param[in]  size     - bytes needed, no more than framePool_maxFrameSize
+         * @param[out] capacity - actual size of the buffer, to hand back to release
+         * @return     buffer, NULL if it could not be allocated
+         */
+        uint8_t* acquire(uint32_t size, uint32_t* capacity);
+
+        /*
+         * @brief Return a buffer from acquire for reuse
+         *
+         * @param buffer   - buffer from acquire
+         * @param capacity - capacity acquire reported for it
+         */
+        void release(uint8_t* buffer, uint32_t capacity);
+
+        /*
+         * @brief Get how many buffers the pool has had to allocate
+         *
+         * @return allocation count since the pool was created
+         */
+        uint64_t getAllocationCount(void);
+
+    private:
+        /*
+         * @brief Cached buffers are linked through their first bytes
+         */
+        typedef struct FreeBuffer
+        {
+            struct FreeBuffer* next;
+        } FreeBuffer;
+
+        FreeBuffer* freeLists[framePool_classCount];
+        uint32_t    cachedCounts[framePool_classCount];
+        uint64_t    allocationCount;
+        std::mutex  lock;
+};
+
+
+#endif // FramePool_h
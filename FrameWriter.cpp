@@ -0,0 +1,140 @@
+/* FrameWriter.cpp
+ *
+ * This implements a writer that sends messages to a file or socket in batches.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "FrameWriter.h"
+
+#include <assert.h>     /* assert */
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+
+
+FrameWriter::FrameWriter(int fd)
+{
+    assert( fd >= 0 );
+
+    this->vectorCount  = 0;
+    this->fd           = fd;
+    this->bytesWritten = 0;
+    this->failed       = false;
+}
+
+/*
+* @brief Add a message to the batch, sending the batch first if the message does not fit
+*
+* @param message - message to send; it must not change until the next flush
+* @return        message added; false if it could not be serialized or an earlier batch failed
+*/
+bool FrameWriter::addMessage(MessageHandler* message)
+{
+    assert( message );
+
+    struct iovec messageVectors[messageHandler_maxSerializedVectors];
+    uint32_t     count = message->getSerializedVectors(messageVectors);
+
+    return count > 0 && this->addVectors(messageVectors, count);
+}
+
+/*
+* @brief Add a whole message already in memory, such as a MessageView gives
+*
+* @param frame     - the whole message; it must stay valid until the next flush
+* @param frameSize - number of bytes in frame
+* @return          message added; false if an earlier batch failed
+*/
+bool FrameWriter::addFrame(const uint8_t* frame, size_t frameSize)
+{
+    assert( frame );
+
+    struct iovec frameVector;
+
+    frameVector.iov_base = (void*)frame;
+    frameVector.iov_len  = frameSize;
+
+    return this->addVectors(&frameVector, 1);
+}
+
+/*
+* @brief Send the batch, retrying until every byte is written
+*
+* @return every byte written; once a write fails, the writer stays failed
+*/
+bool FrameWriter::flush(void)
+{
+    struct iovec* next      = this->vectors;
+    uint32_t      remaining = this->vectorCount;
+
+    while( !this->failed && remaining > 0 )
+    {
+        ssize_t written = writev(this->fd, next, (int)remaining);
+
+        if( written < 0 )
+        {
+            if( errno != EINTR )
+                this->failed = true;
+
+            continue;
+        }
+
+        this->bytesWritten += (uint64_t)written;
+
+        // Step past what went out, which can end part way through a vector
+        while( remaining > 0 && (size_t)written >= next->iov_len )
+        {
+            written -= (ssize_t)next->iov_len;
+            next++;
+            remaining--;
+        }
+
+        if( remaining > 0 )
+        {
+            next->iov_base = (uint8_t*)next->iov_base + written;
+            next->iov_len -= (size_t)written;
+        }
+    }
+
+    this->vectorCount = 0;
+
+    return !this->failed;
+}
+
+/*
+* @brief Get the number of bytes sent
+*
+* @return bytes written since the writer was created
+*/
+uint64_t FrameWriter::getBytesWritten(void)
+{
+    return this->bytesWritten;
+}
+
+/*
+* @brief Add vectors to the batch, sending the batch first if they do not fit
+*/
+bool FrameWriter::addVectors(const struct iovec* vectors, uint32_t count)
+{
+    assert( count <= frameWriter_maxVectors );
+
+    if( this->vectorCount + count > frameWriter_maxVectors && !this->flush() )
+        return false;
+
+    if( this->failed )
+        return false;
+
+    memcpy(&this->vectors[this->vectorCount], vectors, count * sizeof(struct iovec));
+    this->vectorCount += count;
+
+    return true;
+}
+
+
+
+// EOF
@@ -0,0 +1,87 @@
+/* FrameWriter.h
+ *
+ * This defines a writer that sends messages to a file or socket in batches,
+ *   one writev call per batch. Messages are added as the gather lists
+ *   MessageHandler::getSerializedVectors gives, so payloads the messages
+ *   already hold are not copied; every message added, and every frame added
+ *   by address, must stay unchanged until the next flush.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef FrameWriter_h
+#define FrameWriter_h
+
+#include "MessageHandler.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+
+
+
+/*
+ * @brief batch size; Linux takes at most 1024 vectors per writev
+ */
+enum
+{
+    frameWriter_maxVectors = 1024,
+};
+
+
+
+class FrameWriter
+{
+    public:
+
+        /*
+         * @param fd - file or socket to write to; the writer does not close it
+         */
+        FrameWriter(int fd);
+
+        /*
+         * @brief Add a message to the batch, sending the batch first if the message does not fit
+         *
+         * @param message - message to send; it must not change until the next flush
+         * @return        message added; false if it could not be serialized or an earlier batch failed
+         */
+        bool addMessage(MessageHandler* message);
+
+        /*
+         * @brief Add a whole message already in memory, such as a MessageView gives
+         *
+         * @param frame     - the whole message; it must stay valid until the next flush
+         * @param frameSize - number of bytes in frame
+         * @return          message added; false if an earlier batch failed
+         */
+        bool addFrame(const uint8_t* frame, size_t frameSize);
+
+        /*
+         * @brief Send the batch, retrying until every byte is written
+         *
+         * @return every byte written; once a write fails, the writer stays failed
+         */
+        bool flush(void);
+
+        /*
+         * @brief Get the number of bytes sent
+         *
+         * @return bytes written since the writer was created
+         */
+        uint64_t getBytesWritten(void);
+
+    private:
+        /*
+         * @brief Add vectors to the batch, sending the batch first if they do not fit
+         */
+        bool addVectors(const struct iovec* vectors, uint32_t count);
+
+        struct iovec vectors[frameWriter_maxVectors];
+        uint32_t     vectorCount;
+        int          fd;
+        uint64_t     bytesWritten;
+        bool         failed;
+};
+
+
+#endif // FrameWriter_h
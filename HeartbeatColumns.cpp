@@ -0,0 +1,316 @@
+/* HeartbeatColumns.cpp
+ *
+ * This implements a columnar store of decoded heartbeats.
+ *   The AVX2 kernel gathers one 32 bit word per frame for each of epoch time,
+ *   serial number and the last word of the payload, then splits the last word
+ *   into the voltage, temperature and mode columns with one shuffle and one
+ *   permute.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "HeartbeatColumns.h"
+#include "MessageBatch.h"
+#include "MessageView.h"
+#include "FrameCodec.h"
+
+#include <assert.h>     /* assert */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HEARTBEAT_COLUMNS_X86 1
+#include <immintrin.h>
+#endif
+
+
+
+/*
+ * @brief The AVX2 kernel reads voltage, temperature and mode as one word
+ */
+static_assert( heartbeatIndex_temperature == heartbeatIndex_voltage + heartbeatSize_voltage
+            && heartbeatIndex_mode == heartbeatIndex_temperature + heartbeatSize_temperature
+            && heartbeatIndex_mode + heartbeatSize_mode == heartbeatIndex_voltage + sizeof(uint32_t),
+               "voltage, temperature and mode no longer share a word" );
+
+enum
+{
+    heartbeatColumns_vectorCount = 8,       /* frames per AVX2 iteration */
+};
+
+
+
+static void decodeScalar(const uint8_t* frames, uint32_t stride, uint32_t count, HeartbeatColumns_Columns* columns)
+{
+    MessageHandler_HeartbeatPayload heartbeat;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        frameCodec_heartbeat::decode(&frames[(size_t)i * stride + fieldIndex_payload], &heartbeat);
+
+        columns->epochTime_seconds[i] = heartbeat.epochTime_seconds;
+        columns->serialNumber[i]      = heartbeat.serialNumber;
+        columns->voltage_cV[i]        = heartbeat.voltage_cV;
+        columns->temperature_C[i]     = heartbeat.temperature_C;
+        columns->mode[i]              = heartbeat.mode;
+    }
+}
+
+
+
+#ifdef HEARTBEAT_COLUMNS_X86
+
+__attribute__((target("avx2")))
+static void decodeAvx2(const uint8_t* frames, uint32_t stride, uint32_t count, HeartbeatColumns_Columns* columns)
+{
+    const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)stride));
+
+    // Within each 128 bit lane: the 4 voltages, then the 4 temperatures, then the 4 modes
+    const __m256i split   = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+                                             0, 1, 4, 5, 8, 9, 12, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+
+    // Bring the two lanes' voltages, temperatures and modes together
+    const __m256i merge   = _mm256_setr_epi32(0, 1, 4, 5, 2, 6, 3, 7);
+
+    uint32_t i = 0;
+
+    for( ; i + heartbeatColumns_vectorCount <= count; i += heartbeatColumns_vectorCount )
+    {
+        const uint8_t* payload = &frames[(size_t)i * stride + fieldIndex_payload];
+
+        __m256i epochTime = _mm256_i32gather_epi32((const int*)&payload[heartbeatIndex_epochTime], offsets, 1);
+        __m256i serial    = _mm256_i32gather_epi32((const int*)&payload[heartbeatIndex_serialNumber], offsets, 1);
+        __m256i tail      = _mm256_i32gather_epi32((const int*)&payload[heartbeatIndex_voltage], offsets, 1);
+
+        tail = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(tail, split), merge);
+
+        __m128i narrow = _mm256_extracti128_si256(tail, 1);
+
+        _mm256_storeu_si256((__m256i*)&columns->epochTime_seconds[i], epochTime);
+        _mm256_storeu_si256((__m256i*)&columns->serialNumber[i], serial);
+        _mm_storeu_si128((__m128i*)&columns->voltage_cV[i], _mm256_castsi256_si128(tail));
+        _mm_storel_epi64((__m128i*)&columns->temperature_C[i], narrow);
+        _mm_storel_epi64((__m128i*)&columns->mode[i], _mm_srli_si128(narrow, 8));
+    }
+
+    if( i < count )
+    {
+        HeartbeatColumns_Columns rest =
+        {
+            &columns->epochTime_seconds[i],
+            &columns->serialNumber[i],
+            &columns->voltage_cV[i],
+            &columns->temperature_C[i],
+            &columns->mode[i],
+        };
+
+        decodeScalar(&frames[(size_t)i * stride], stride, count - i, &rest);
+    }
+}
+
+#endif // HEARTBEAT_COLUMNS_X86
+
+
+
+typedef void (*DecodeFunction)(const uint8_t* frames, uint32_t stride, uint32_t count, HeartbeatColumns_Columns* columns);
+
+/*
+* @brief Pick the kernel while the program starts, so the pointer is only ever read by the threads decoding
+*/
+static DecodeFunction selectDecodeKernel(void)
+{
+#ifdef HEARTBEAT_COLUMNS_X86
+    __builtin_cpu_init();
+
+    if( __builtin_cpu_supports("avx2") )
+        return decodeAvx2;
+#endif
+
+    return decodeScalar;
+}
+
+static const DecodeFunction decodeKernel = selectDecodeKernel();
+
+
+
+HeartbeatColumns::HeartbeatColumns()
+{
+    memset(&this->columns, 0, sizeof(this->columns));
+
+    this->count    = 0;
+    this->capacity = 0;
+}
+
+HeartbeatColumns::~HeartbeatColumns()
+{
+    free(this->columns.epochTime_seconds);
+    free(this->columns.serialNumber);
+    free(this->columns.voltage_cV);
+    free(this->columns.temperature_C);
+    free(this->columns.mode);
+}
+
+/*
+* @brief Remove every heartbeat, keeping the columns for reuse
+*/
+void HeartbeatColumns::clear(void)
+{
+    this->count = 0;
+}
+
+/*
+* @brief Get the number of heartbeats in the columns
+*
+* @return heartbeat count
+*/
+uint32_t HeartbeatColumns::getCount(void)
+{
+    return this->count;
+}
+
+/*
+* @brief Get the columns; valid until heartbeats are added, or the columns are destroyed
+*
+* @param[out] columns - the columns, getCount entries long
+*/
+void HeartbeatColumns::getColumns(HeartbeatColumns_Columns* columns)
+{
+    assert( columns );
+
+    *columns = this->columns;
+}
+
+/*
+* @brief Decode heartbeat frames that sit a fixed distance apart
+*        The frames must be verified heartbeats.
+*
+* @param frames - pointer to the key signature of the first frame
+* @param stride - bytes from the start of one frame to the start of the next
+* @param count  - number of frames
+* @return       heartbeats added; false if the columns could not grow
+*/
+bool HeartbeatColumns::addFrames(const uint8_t* frames, uint32_t stride, uint32_t count)
+{
+    assert( frames || count == 0 );
+    assert( stride >= fieldIndex_payload + sizeof(MessageHandler_HeartbeatPayload) || count <= 1 );
+
+    // The gather offsets of one iteration must fit an int
+    assert( (uint64_t)stride * heartbeatColumns_vectorCount <= INT32_MAX );
+
+    if( !this->reserve(this->count + count) )
+        return false;
+
+    HeartbeatColumns_Columns end =
+    {
+        &this->columns.epochTime_seconds[this->count],
+        &this->columns.serialNumber[this->count],
+        &this->columns.voltage_cV[this->count],
+        &this->columns.temperature_C[this->count],
+        &this->columns.mode[this->count],
+    };
+
+    decodeKernel(frames, stride, count, &end);
+
+    this->count += count;
+
+    return true;
+}
+
+/*
+* @brief Decode every heartbeat in a batch, skipping its other messages
+*        A batch keeps its frames back to back, so each run of heartbeats
+*        in it is decoded as frames a fixed distance apart.
+*
+* @param batch - messages to decode
+* @return      number of heartbeats added
+*/
+uint32_t HeartbeatColumns::addBatch(MessageBatch* batch)
+{
+    assert( batch );
+
+    uint32_t messageCount = batch->getCount();
+    uint32_t added        = 0;
+    uint32_t index        = 0;
+
+    while( index < messageCount )
+    {
+        MessageBatch_Message* first = batch->getMessage(index);
+
+        if( first->header.commandCode != MESSAGE_HANDLER_COMMAND_HEARTBEAT )
+        {
+            index++;
+            continue;
+        }
+
+        uint32_t runEnd = index + 1;
+
+        while(   runEnd < messageCount
+              && batch->getMessage(runEnd)->header.commandCode == MESSAGE_HANDLER_COMMAND_HEARTBEAT
+              && batch->getMessage(runEnd)->frameOffset == first->frameOffset + (size_t)(runEnd - index) * first->frameSize
+             )
+        {
+            runEnd++;
+        }
+
+        MessageView view;
+        batch->getView(index, &view);
+
+        if( !this->addFrames(view.getFrame(), first->frameSize, runEnd - index) )
+            break;
+
+        added += runEnd - index;
+        index  = runEnd;
+    }
+
+    return added;
+}
+
+/*
+* @brief Make every column hold at least count entries
+*
+* @param count - entries needed
+* @return      columns are large enough
+*/
+bool HeartbeatColumns::reserve(uint32_t count)
+{
+    if( count <= this->capacity )
+        return true;
+
+    uint32_t capacity = this->capacity ? this->capacity : heartbeatColumns_initialCount;
+
+    while( capacity < count )
+        capacity *= 2;
+
+    // Grow each column in turn; one that grew and one that did not are both still valid
+    void* grown;
+
+    if( (grown = realloc(this->columns.epochTime_seconds, capacity * sizeof(uint32_t))) == NULL )
+        return false;
+    this->columns.epochTime_seconds = (uint32_t*)grown;
+
+    if( (grown = realloc(this->columns.serialNumber, capacity * sizeof(uint32_t))) == NULL )
+        return false;
+    this->columns.serialNumber = (uint32_t*)grown;
+
+    if( (grown = realloc(this->columns.voltage_cV, capacity * sizeof(int16_t))) == NULL )
+        return false;
+    this->columns.voltage_cV = (int16_t*)grown;
+
+    if( (grown = realloc(this->columns.temperature_C, capacity * sizeof(int8_t))) == NULL )
+        return false;
+    this->columns.temperature_C = (int8_t*)grown;
+
+    if( (grown = realloc(this->columns.mode, capacity * sizeof(uint8_t))) == NULL )
+        return false;
+    this->columns.mode = (uint8_t*)grown;
+
+    this->capacity = capacity;
+
+    return true;
+}
+
+
+
+// EOF
@@ -0,0 +1,109 @@
+/* HeartbeatColumns.h
+ *
+ * This defines a columnar store of decoded heartbeats: one array per
+ *   heartbeat field, so aggregation over a field runs over contiguous
+ *   values instead of striding through packed payloads.
+ *
+ *   Heartbeats are decoded straight from their frames into the columns.
+ *   Frames that sit a fixed stride apart, as runs of heartbeats in a
+ *   MessageBatch do, are decoded 8 at a time with AVX2 gathers when the
+ *   CPU has them.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef HeartbeatColumns_h
+#define HeartbeatColumns_h
+
+#include "MessageHandler.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+class MessageBatch;
+
+
+
+/*
+ * @brief initial column length; columns double as they fill
+ */
+enum
+{
+    heartbeatColumns_initialCount = 1024,
+};
+
+/*
+ * @brief the columns; entry i of every column belongs to heartbeat i
+ */
+typedef struct
+{
+    uint32_t* epochTime_seconds;
+    uint32_t* serialNumber;
+    int16_t*  voltage_cV;
+    int8_t*   temperature_C;
+    uint8_t*  mode;
+} HeartbeatColumns_Columns;
+
+
+
+class HeartbeatColumns
+{
+    public:
+
+        HeartbeatColumns();
+        ~HeartbeatColumns();
+
+        /*
+         * @brief Remove every heartbeat, keeping the columns for reuse
+         */
+        void clear(void);
+
+        /*
+         * @brief Get the number of heartbeats in the columns
+         *
+         * @return heartbeat count
+         */
+        uint32_t getCount(void);
+
+        /*
+         * @brief Get the columns; valid until heartbeats are added, or the columns are destroyed
+         *
+         * @param[out] columns - the columns, getCount entries long
+         */
+        void getColumns(HeartbeatColumns_Columns* columns);
+
+        /*
+         * @brief Decode heartbeat frames that sit a fixed distance apart
+         *        The frames must be verified heartbeats.
+         *
+         * @param frames - pointer to the key signature of the first frame
+         * @param stride - bytes from the start of one frame to the start of the next
+         * @param count  - number of frames
+         * @return       heartbeats added; false if the columns could not grow
+         */
+        bool addFrames(const uint8_t* frames, uint32_t stride, uint32_t count);
+
+        /*
+         * @brief Decode every heartbeat in a batch, skipping its other messages
+         *
+         * @param batch - messages to decode
+         * @return      number of heartbeats added
+         */
+        uint32_t addBatch(MessageBatch* batch);
+
+    private:
+        /*
+         * @brief Make every column hold at least count entries
+         *
+         * @param count - entries needed
+         * @return      columns are large enough
+         */
+        bool reserve(uint32_t count);
+
+        HeartbeatColumns_Columns columns;
+        uint32_t                 count;
+        uint32_t                 capacity;
+};
+
+
+#endif // HeartbeatColumns_h
@@ -0,0 +1,314 @@
+/* JsonArena.cpp
+ *
+ * This implements a bump allocator for cJSON trees and the cJSON hooks that use it.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "JsonArena.h"
+#include "cJSON.h"
+
+#include <assert.h>     /* assert */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+
+using namespace std;
+
+
+
+enum
+{
+    jsonArena_maxCachedCount = 64,
+};
+
+/*
+ * @brief Arenas of jsonArena_minSize a thread has released, kept for its next payloads,
+ *        and its scratch arena; they are freed when the thread exits
+ */
+typedef struct ArenaCache
+{
+    JsonArena* arenas[jsonArena_maxCachedCount];
+    uint32_t   count;
+    JsonArena* scratch;
+
+    ~ArenaCache()
+    {
+        for(uint32_t i = 0; i < this->count; i++)
+            free(this->arenas[i]);
+
+        if( this->scratch )
+        {
+            this->scratch->reset();
+            free(this->scratch);
+        }
+
+        // Anything released after this is freed, not cached
+        this->count   = jsonArena_maxCachedCount;
+        this->scratch = NULL;
+    }
+} ArenaCache;
+
+static thread_local ArenaCache arenaCache;
+static thread_local JsonArena* activeArena = NULL;
+
+static atomic<uint64_t> allocationCount(0);
+
+/*
+ * @brief cJSON allocation hooks; they only use the arena the thread is parsing or printing through
+ */
+static void* allocateJson(size_t size)
+{
+    JsonArena* arena = activeArena;
+
+    return arena ? arena->allocate(size) : malloc(size);
+}
+
+static void freeJson(void* pointer)
+{
+    if( activeArena == NULL )
+        free(pointer);
+}
+
+/*
+ * @brief Point cJSON at the hooks before main runs, while there is only one thread
+ */
+static struct JsonHooksInstaller
+{
+    JsonHooksInstaller()
+    {
+        cJSON_Hooks hooks = { allocateJson, freeJson };
+
+        cJSON_InitHooks(&hooks);
+    }
+} jsonHooksInstaller;
+
+static inline size_t alignSize(size_t size)
+{
+    return (size + jsonArena_alignment - 1) & ~(size_t)(jsonArena_alignment - 1);
+}
+
+
+
+JsonArena::JsonArena()
+{
+    this->first     = (uint8_t*)(this + 1);
+    this->firstSize = 0;
+    this->next      = this->first;
+    this->end       = this->first;
+    this->chunks    = NULL;
+}
+
+/*
+* @brief Get an arena with room for text of the given length and its tree
+*        An arena the thread released earlier is reused when it is large enough.
+*
+* @param textLength - length of the JSON text, not counting its NUL
+* @return           arena, NULL if it could not be allocated
+*/
+JsonArena* JsonArena::create(size_t textLength)
+{
+    static_assert( sizeof(JsonArena) % jsonArena_alignment == 0, "the first block must start aligned" );
+
+    size_t size = alignSize(textLength + 1) + textLength * jsonArena_treeBytesPerByte;
+
+    if( size <= jsonArena_minSize )
+    {
+        if( arenaCache.count > 0 )
+            return arenaCache.arenas[--arenaCache.count];
+
+        size = jsonArena_minSize;
+    }
+
+    void* block = malloc(sizeof(JsonArena) + size);
+
+    if( block == NULL )
+        return NULL;
+
+    allocationCount.fetch_add(1, memory_order_relaxed);
+
+    JsonArena* arena = new(block) JsonArena();
+
+    arena->firstSize = size;
+    arena->end       = arena->first + size;
+
+    return arena;
+}
+
+/*
+* @brief Release an arena and everything allocated from it
+*
+* @param arena - arena from create, or NULL
+*/
+void JsonArena::destroy(JsonArena* arena)
+{
+    if( arena == NULL )
+        return;
+
+    arena->reset();
+
+    if( arena->firstSize == jsonArena_minSize && arenaCache.count < jsonArena_maxCachedCount )
+        arenaCache.arenas[arenaCache.count++] = arena;
+    else
+        free(arena);
+}
+
+/*
+* @brief Get the thread's scratch arena, for trees that are only needed briefly
+*        The caller resets it when done.
+*
+* @return scratch arena, NULL if it could not be allocated
+*/
+JsonArena* JsonArena::getScratch(void)
+{
+    if( arenaCache.scratch == NULL )
+        arenaCache.scratch = JsonArena::create(0);
+
+    return arenaCache.scratch;
+}
+
+/*
+* @brief Get how many blocks of memory every arena together has had to allocate
+*
+* @return allocation count since the program started
+*/
+uint64_t JsonArena::getAllocationCount(void)
+{
+    return allocationCount.load(memory_order_relaxed);
+}
+
+/*
+* @brief Allocate from the arena; the memory lasts until the arena is reset or destroyed
+*
+* @param size - bytes needed
+* @return     memory aligned to jsonArena_alignment, NULL if it could not be allocated
+*/
+void* JsonArena::allocate(size_t size)
+{
+    size = alignSize(size);
+
+    if( size > (size_t)(this->end - this->next) )
+        return this->grow(size);
+
+    void* memory = this->next;
+
+    this->next += size;
+
+    return memory;
+}
+
+/*
+* @brief Copy text into the arena
+*
+* @param text   - text to copy
+* @param length - bytes to copy; a NUL is added after them
+* @return       the copy, NULL if it could not be allocated
+*/
+char* JsonArena::copyText(const char* text, size_t length)
+{
+    assert( text );
+
+    char* copy = (char*)this->allocate(length + 1);
+
+    if( copy )
+    {
+        memcpy(copy, text, length);
+        copy[length] = '\0';
+    }
+
+    return copy;
+}
+
+/*
+* @brief Parse JSON text into a tree allocated from the arena, as cJSON_Parse does
+*
+* @param text - NUL terminated JSON text
+* @return     tree, NULL if the text is not valid JSON
+*/
+cJSON* JsonArena::parse(const char* text)
+{
+    assert( text );
+
+    JsonArena* previous = activeArena;
+
+    activeArena = this;
+
+    cJSON* tree = cJSON_Parse(text);
+
+    activeArena = previous;
+
+    return tree;
+}
+
+/*
+* @brief Print a tree into the arena, as cJSON_Print or cJSON_PrintUnformatted does
+*        The string is not freed with cJSON_free; it goes with the arena.
+*
+* @param tree      - tree to print, allocated anywhere
+* @param formatted - print with cJSON_Print's indentation
+* @return          NUL terminated text, NULL if it could not be allocated
+*/
+char* JsonArena::print(const cJSON* tree, bool formatted)
+{
+    assert( tree );
+
+    JsonArena* previous = activeArena;
+
+    activeArena = this;
+
+    char* text = formatted ? cJSON_Print(tree) : cJSON_PrintUnformatted(tree);
+
+    activeArena = previous;
+
+    return text;
+}
+
+/*
+* @brief Release everything allocated from the arena, keeping its first block
+*/
+void JsonArena::reset(void)
+{
+    while( this->chunks )
+    {
+        Chunk* next = this->chunks->next;
+        free(this->chunks);
+        this->chunks = next;
+    }
+
+    this->next = this->first;
+    this->end  = this->first + this->firstSize;
+}
+
+/*
+* @brief Add a block with room for at least size bytes and allocate them from it
+*/
+void* JsonArena::grow(size_t size)
+{
+    size_t chunkSize = this->chunks ? this->chunks->size * 2 : this->firstSize;
+
+    if( chunkSize < size )
+        chunkSize = size;
+
+    Chunk* chunk = (Chunk*)malloc(sizeof(Chunk) + chunkSize);
+
+    if( chunk == NULL )
+        return NULL;
+
+    allocationCount.fetch_add(1, memory_order_relaxed);
+
+    chunk->next  = this->chunks;
+    chunk->size  = chunkSize;
+    this->chunks = chunk;
+
+    this->next = (uint8_t*)(chunk + 1) + size;
+    this->end  = (uint8_t*)(chunk + 1) + chunkSize;
+
+    return chunk + 1;
+}
+
+
+
+// EOF
@@ -0,0 +1,139 @@
+/* JsonArena.h
+ *
+ * This defines a bump allocator for cJSON trees. cJSON's allocation hooks
+ *   are pointed at it once, at startup: while a thread is parsing or
+ *   printing through an arena, every cJSON allocation on that thread comes
+ *   from the arena and every free is ignored; at any other time the hooks
+ *   pass straight through to malloc and free.
+ *
+ *   A Set Sar Mode payload keeps its text and tree in one arena, so the
+ *   whole payload costs one allocation, or none once a thread has released
+ *   a payload before, and is released in one step. Trees built in an arena
+ *   are read only; items must not be added, detached or deleted.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef JsonArena_h
+#define JsonArena_h
+
+#include <cJSON.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+
+/*
+ * @brief arena sizes
+ */
+enum
+{
+    jsonArena_alignment        = 8,     /* enough for everything cJSON allocates */
+    jsonArena_minSize          = 4 * 1024,
+    jsonArena_treeBytesPerByte = 8,     /* room planned for the tree, per byte of text */
+};
+
+
+
+class JsonArena
+{
+    public:
+
+        /*
+         * @brief Get an arena with room for text of the given length and its tree
+         *        An arena the thread released earlier is reused when it is large enough.
+         *
+         * @param textLength - length of the JSON text, not counting its NUL
+         * @return           arena, NULL if it could not be allocated
+         */
+        static JsonArena* create(size_t textLength);
+
+        /*
+         * @brief Release an arena and everything allocated from it
+         *
+         * @param arena - arena from create, or NULL
+         */
+        static void destroy(JsonArena* arena);
+
+        /*
+         * @brief Get the thread's scratch arena, for trees that are only needed briefly
+         *        The caller resets it when done.
+         *
+         * @return scratch arena, NULL if it could not be allocated
+         */
+        static JsonArena* getScratch(void);
+
+        /*
+         * @brief Get how many blocks of memory every arena together has had to allocate
+         *
+         * @return allocation count since the program started
+         */
+        static uint64_t getAllocationCount(void);
+
+        /*
+         * @brief Allocate from the arena; the memory lasts until the arena is reset or destroyed
+         *
+         * @param size - bytes needed
+         * @return     memory aligned to jsonArena_alignment, NULL if it could not be allocated
+         */
+        void* allocate(size_t size);
+
+        /*
+         * @brief Copy text into the arena
+         *
+         * @param text   - text to copy
+         * @param length - bytes to copy; a NUL is added after them
+         * @return       the copy, NULL if it could not be allocated
+         */
+        char* copyText(const char* text, size_t length);
+
+        /*
+         * @brief Parse JSON text into a tree allocated from the arena, as cJSON_Parse does
+         *
+         * @param text - NUL terminated JSON text
+         * @return     tree, NULL if the text is not valid JSON
+         */
+        cJSON* parse(const char* text);
+
+        /*
+         * @brief Print a tree into the arena, as cJSON_Print or cJSON_PrintUnformatted does
+         *        The string is not freed with cJSON_free; it goes with the arena.
+         *
+         * @param tree      - tree to print, allocated anywhere
+         * @param formatted - print with cJSON_Print's indentation
+         * @return          NUL terminated text, NULL if it could not be allocated
+         */
+        char* print(const cJSON* tree, bool formatted);
+
+        /*
+         * @brief Release everything allocated from the arena, keeping its first block
+         */
+        void reset(void);
+
+    private:
+        /*
+         * @brief Blocks added when the first one fills are linked through their start
+         */
+        typedef struct Chunk
+        {
+            struct Chunk* next;
+            size_t        size;
+        } Chunk;
+
+        JsonArena();
+
+        /*
+         * @brief Add a block with room for at least size bytes and allocate them from it
+         */
+        void* grow(size_t size);
+
+        uint8_t* next;
+        uint8_t* end;
+        uint8_t* first;     /* the block allocated with the arena */
+        size_t   firstSize;
+        Chunk*   chunks;
+};
+
+
+#endif // JsonArena_h
@@ -0,0 +1,345 @@
+/* JsonValidator.cpp
+ *
+ * This implements a check of JSON text that builds no tree.
+ *   It follows cJSON's parser step for step, including where cJSON is looser
+ *   than the JSON grammar: a bad hex digit in \u reads as 0, and a number is
+ *   whatever prefix of its first 63 number characters strtod accepts.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "JsonValidator.h"
+#include "cJSON.h"
+
+#include <assert.h>     /* assert */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+
+enum
+{
+    jsonValidator_maxNumberSize = 63,   /* cJSON copies at most this much of a number for strtod */
+};
+
+typedef const unsigned char* JsonCursor;
+
+
+
+static bool checkValue(JsonCursor* cursor, uint32_t depth);
+
+/*
+* @brief Skip whitespace; like cJSON, every control character counts, but the terminator ends it
+*/
+static inline JsonCursor skipWhitespace(JsonCursor next)
+{
+    while( *next != '\0' && *next <= ' ' )
+        next++;
+
+    return next;
+}
+
+static inline bool isNumberCharacter(unsigned char character)
+{
+    return (character >= '0' && character <= '9')
+        || character == '+' || character == '-' || character == 'e' || character == 'E' || character == '.';
+}
+
+static inline bool isDigit(unsigned char character)
+{
+    return character >= '0' && character <= '9';
+}
+
+/*
+* @brief Read 4 hex digits as cJSON does: any bad digit makes the whole value 0
+*/
+static unsigned readHex4(JsonCursor digits)
+{
+    unsigned value = 0;
+
+    for(uint32_t i = 0; i < 4; i++)
+    {
+        unsigned char digit = digits[i];
+
+        value <<= 4;
+
+        if( digit >= '0' && digit <= '9' )
+            value += digit - '0';
+        else if( digit >= 'A' && digit <= 'F' )
+            value += 10 + digit - 'A';
+        else if( digit >= 'a' && digit <= 'f' )
+            value += 10 + digit - 'a';
+        else
+            return 0;
+    }
+
+    return value;
+}
+
+/*
+* @brief Check a string starting at its opening quote
+*/
+static bool checkString(JsonCursor* cursor)
+{
+    JsonCursor start = *cursor;
+
+    if( *start != '"' )
+        return false;
+
+    // Find the closing quote first, stepping over every escaped character
+    JsonCursor end = start + 1;
+
+    while( *end != '\0' && *end != '"' )
+    {
+        if( *end == '\\' )
+        {
+            if( end[1] == '\0' )
+                return false;
+
+            end++;
+        }
+
+        end++;
+    }
+
+    if( *end != '"' )
+        return false;
+
+    for(JsonCursor next = start + 1; next < end; )
+    {
+        if( *next != '\\' )
+        {
+            next++;
+            continue;
+        }
+
+        switch( next[1] )
+        {
+            case 'b':
+            case 'f':
+            case 'n':
+            case 'r':
+            case 't':
+            case '"':
+            case '\\':
+            case '/':
+                next += 2;
+                break;
+
+            case 'u':
+            {
+                if( end - next < 6 )
+                    return false;
+
+                unsigned first = readHex4(&next[2]);
+
+                if( first >= 0xDC00 && first <= 0xDFFF )
+                    return false;
+
+                if( first >= 0xD800 && first <= 0xDBFF )
+                {
+                    if( end - (next + 6) < 6 || next[6] != '\\' || next[7] != 'u' )
+                        return false;
+
+                    unsigned second = readHex4(&next[8]);
+
+                    if( second < 0xDC00 || second > 0xDFFF )
+                        return false;
+
+                    next += 12;
+                }
+                else
+                {
+                    next += 6;
+                }
+                break;
+            }
+
+            default:
+                return false;
+        }
+    }
+
+    *cursor = end + 1;
+
+    return true;
+}
+
+/*
+* @brief Check a number the way strtod reads the characters cJSON gives it
+*/
+static bool checkNumber(JsonCursor* cursor)
+{
+    JsonCursor start = *cursor;
+    JsonCursor limit = start;
+
+    while( limit - start < jsonValidator_maxNumberSize && isNumberCharacter(*limit) )
+        limit++;
+
+    JsonCursor next   = start;
+    bool       digits = false;
+
+    if( next < limit && (*next == '+' || *next == '-') )
+        next++;
+
+    while( next < limit && isDigit(*next) )
+    {
+        next++;
+        digits = true;
+    }
+
+    if( next < limit && *next == '.' )
+    {
+        next++;
+
+        while( next < limit && isDigit(*next) )
+        {
+            next++;
+            digits = true;
+        }
+    }
+
+    if( !digits )
+        return false;
+
+    // An exponent only counts when it has digits
+    if( next < limit && (*next == 'e' || *next == 'E') )
+    {
+        JsonCursor exponent = next + 1;
+
+        if( exponent < limit && (*exponent == '+' || *exponent == '-') )
+            exponent++;
+
+        if( exponent < limit && isDigit(*exponent) )
+        {
+            while( exponent < limit && isDigit(*exponent) )
+                exponent++;
+
+            next = exponent;
+        }
+    }
+
+    *cursor = next;
+
+    return true;
+}
+
+/*
+* @brief Check an array or object starting at its opening bracket
+*/
+static bool checkContainer(JsonCursor* cursor, uint32_t depth, bool object)
+{
+    if( depth >= CJSON_NESTING_LIMIT )
+        return false;
+
+    unsigned char close = object ? '}' : ']';
+    JsonCursor    next  = skipWhitespace(*cursor + 1);
+
+    if( *next == close )
+    {
+        *cursor = next + 1;
+        return true;
+    }
+
+    if( *next == '\0' )
+        return false;
+
+    while( true )
+    {
+        next = skipWhitespace(next);
+
+        if( object )
+        {
+            if( !checkString(&next) )
+                return false;
+
+            next = skipWhitespace(next);
+
+            if( *next != ':' )
+                return false;
+
+            next = skipWhitespace(next + 1);
+        }
+
+        if( !checkValue(&next, depth + 1) )
+            return false;
+
+        next = skipWhitespace(next);
+
+        if( *next != ',' )
+            break;
+
+        next++;
+    }
+
+    if( *next != close )
+        return false;
+
+    *cursor = next + 1;
+
+    return true;
+}
+
+static bool checkValue(JsonCursor* cursor, uint32_t depth)
+{
+    JsonCursor next = *cursor;
+
+    if( strncmp((const char*)next, "null", 4) == 0 || strncmp((const char*)next, "true", 4) == 0 )
+    {
+        *cursor = next + 4;
+        return true;
+    }
+
+    if( strncmp((const char*)next, "false", 5) == 0 )
+    {
+        *cursor = next + 5;
+        return true;
+    }
+
+    switch( *next )
+    {
+        case '"':
+            return checkString(cursor);
+
+        case '[':
+            return checkContainer(cursor, depth, false);
+
+        case '{':
+            return checkContainer(cursor, depth, true);
+
+        default:
+            if( *next == '-' || isDigit(*next) )
+                return checkNumber(cursor);
+
+            return false;
+    }
+}
+
+
+
+/*
+* @brief Check that text holds a JSON value cJSON_Parse would accept, without parsing it
+*
+* @param text - NUL terminated text
+* @return     JSON valid
+*/
+bool isJsonStructureValid(const char* text)
+{
+    assert( text );
+
+    JsonCursor next = (JsonCursor)text;
+
+    // cJSON only looks for a byte order mark in text of at least 4 bytes
+    if( strncmp(text, "\xEF\xBB\xBF", 3) == 0 && text[3] != '\0' )
+        next += 3;
+
+    next = skipWhitespace(next);
+
+    return checkValue(&next, 0);
+}
+
+
+
+// EOF
@@ -0,0 +1,29 @@
+/* JsonValidator.h
+ *
+ * This declares a check of JSON text that builds no tree. It accepts exactly
+ *   the text cJSON_Parse accepts: one value after optional whitespace and a
+ *   UTF-8 byte order mark, with anything after the value ignored, nesting up
+ *   to CJSON_NESTING_LIMIT, and numbers as far as strtod reads them.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef JsonValidator_h
+#define JsonValidator_h
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+
+/*
+ * @brief Check that text holds a JSON value cJSON_Parse would accept, without parsing it
+ *
+ * @param text - NUL terminated text
+ * @return     JSON valid
+ */
+bool isJsonStructureValid(const char* text);
+
+
+#endif // JsonValidator_h
@@ -0,0 +1,156 @@
+/* MessageBatch.cpp
+ *
+ * This implements a reusable container of decoded messages.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "MessageBatch.h"
+#include "MessageView.h"
+#include "MessageRegistry.h"
+
+#include <assert.h>     /* assert */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+
+MessageBatch::MessageBatch()
+{
+    this->messages        = NULL;
+    this->messageCount    = 0;
+    this->messageCapacity = 0;
+
+    this->frames          = NULL;
+    this->frameBytes      = 0;
+    this->frameCapacity   = 0;
+}
+
+MessageBatch::~MessageBatch()
+{
+    this->releasePayloads();
+
+    if( this->messages )
+        free(this->messages);
+
+    if( this->frames )
+        free(this->frames);
+}
+
+/*
+* @brief Remove every message, keeping the storage for reuse
+*/
+void MessageBatch::clear(void)
+{
+    this->releasePayloads();
+
+    this->messageCount = 0;
+    this->frameBytes   = 0;
+}
+
+/*
+* @brief Get the number of messages in the batch
+*
+* @return message count
+*/
+uint32_t MessageBatch::getCount(void)
+{
+    return this->messageCount;
+}
+
+/*
+* @brief Get a message; valid until the batch is added to, cleared or destroyed
+*
+* @param index - index of the message, below getCount
+* @return      message
+*/
+MessageBatch_Message* MessageBatch::getMessage(uint32_t index)
+{
+    assert( index < this->messageCount );
+
+    return &this->messages[index];
+}
+
+/*
+* @brief Get a view of the raw bytes of a message; valid as long as getMessage's result
+*
+* @param[in]  index - index of the message, below getCount
+* @param[out] view  - view of the message
+*/
+void MessageBatch::getView(uint32_t index, MessageView* view)
+{
+    assert( index < this->messageCount );
+    assert( view );
+
+    *view = MessageView(&this->frames[this->messages[index].frameOffset], this->messages[index].frameSize);
+}
+
+/*
+* @brief Add a message, copying its raw bytes into the batch
+*        The caller fills in the rest of the returned message.
+*
+* @param frame     - pointer to the key signature of the message
+* @param frameSize - prefix, header and payload size in bytes
+* @return          the new message, NULL if the batch could not grow
+*/
+MessageBatch_Message* MessageBatch::add(const uint8_t* frame, uint32_t frameSize)
+{
+    assert( frame );
+
+    if( this->messageCount == this->messageCapacity )
+    {
+        uint32_t capacity = this->messageCapacity ? this->messageCapacity * 2 : messageBatch_initialMessageCount;
+        void*    grown    = realloc(this->messages, capacity * sizeof(MessageBatch_Message));
+
+        if( grown == NULL )
+            return NULL;
+
+        this->messages        = (MessageBatch_Message*)grown;
+        this->messageCapacity = capacity;
+    }
+
+    if( this->frameBytes + frameSize > this->frameCapacity )
+    {
+        size_t capacity = this->frameCapacity ? this->frameCapacity : messageBatch_initialFrameBytes;
+
+        while( capacity < this->frameBytes + frameSize )
+            capacity *= 2;
+
+        void* grown = realloc(this->frames, capacity);
+
+        if( grown == NULL )
+            return NULL;
+
+        this->frames        = (uint8_t*)grown;
+        this->frameCapacity = capacity;
+    }
+
+    MessageBatch_Message* message = &this->messages[this->messageCount++];
+
+    memcpy(&this->frames[this->frameBytes], frame, frameSize);
+
+    memset(message, 0, sizeof(MessageBatch_Message));
+    message->frameOffset = this->frameBytes;
+    message->frameSize   = frameSize;
+
+    this->frameBytes += frameSize;
+
+    return message;
+}
+
+/*
+* @brief Release the payloads the batch owns
+*/
+void MessageBatch::releasePayloads(void)
+{
+    for(uint32_t i = 0; i < this->messageCount; i++)
+    {
+        findMessageType(this->messages[i].header.commandCode)->release(&this->messages[i].payload);
+    }
+}
+
+
+
+// EOF
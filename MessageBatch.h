@@ -0,0 +1,109 @@
+/* MessageBatch.h
+ *
+ * This defines a reusable container of decoded messages, filled by
+ *   MessageHandler::parseAll. Messages are kept in one array and their raw
+ *   bytes back to back in one buffer, and clearing the batch keeps both,
+ *   so a batch that is reused stops allocating once it has grown to size.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef MessageBatch_h
+#define MessageBatch_h
+
+#include "MessageHandler.h"
+#include <cJSON.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+class MessageView;
+
+
+
+/*
+ * @brief initial sizes; both double as they fill
+ */
+enum
+{
+    messageBatch_initialMessageCount = 64,
+    messageBatch_initialFrameBytes   = 16 * 1024,
+};
+
+/*
+ * @brief one decoded message; the batch owns what payload holds
+ */
+typedef struct
+{
+    MessageHandler_Header  header;
+    uint16_t               headerChecksum;
+    uint16_t               payloadChecksum;
+    MessageHandler_Payload payload;
+    size_t                 frameOffset;
+    uint32_t               frameSize;
+} MessageBatch_Message;
+
+
+
+class MessageBatch
+{
+    public:
+
+        MessageBatch();
+        ~MessageBatch();
+
+        /*
+         * @brief Remove every message, keeping the storage for reuse
+         */
+        void clear(void);
+
+        /*
+         * @brief Get the number of messages in the batch
+         *
+         * @return message count
+         */
+        uint32_t getCount(void);
+
+        /*
+         * @brief Get a message; valid until the batch is added to, cleared or destroyed
+         *
+         * @param index - index of the message, below getCount
+         * @return      message
+         */
+        MessageBatch_Message* getMessage(uint32_t index);
+
+        /*
+         * @brief Get a view of the raw bytes of a message; valid as long as getMessage's result
+         *
+         * @param[in]  index - index of the message, below getCount
+         * @param[out] view  - view of the message
+         */
+        void getView(uint32_t index, MessageView* view);
+
+        /*
+         * @brief Add a message, copying its raw bytes into the batch
+         *        The caller fills in the rest of the returned message.
+         *
+         * @param frame     - pointer to the key signature of the message
+         * @param frameSize - prefix, header and payload size in bytes
+         * @return          the new message, NULL if the batch could not grow
+         */
+        MessageBatch_Message* add(const uint8_t* frame, uint32_t frameSize);
+
+    private:
+        /*
+         * @brief Release the payloads the batch owns
+         */
+        void releasePayloads(void);
+
+        MessageBatch_Message* messages;
+        uint32_t              messageCount;
+        uint32_t              messageCapacity;
+
+        uint8_t*              frames;
+        size_t                frameBytes;
+        size_t                frameCapacity;
+};
+
+
+#endif // MessageBatch_h
@@ -10,6 +10,15 @@
  */
 
 #include "MessageHandler.h"
+#include "MessageView.h"
+#include "MessageBatch.h"
+#include "MessageSink.h"
+#include "MessageRegistry.h"
+#include "FrameCodec.h"
+#include "DeviceTable.h"
+#include "FramePool.h"
+#include "Checksum.h"
+#include "JsonArena.h"
 #include "cJSON.h"
 
 #include <stdio.h>      /* printf */
@@ -17,390 +26,929 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <sys/uio.h>    /* iovec */
 #include <iostream>
 
 using namespace std;
 
 
 
-static uint8_t* readLittle16(uint8_t* bytes, uint16_t* result)
-{
-    assert( bytes );
+/*
+ * @brief Sinks shared by every handler; text to stdout is the default
+ */
+static MessageNullSink nullSink;
+static MessageTextSink stdoutSink(stdout);
 
-    *result = (uint16_t)bytes[0] | (uint16_t)bytes[1] << 8;
+/*
+ * @brief Buffers for messages too large for a handler's own parse buffer
+ */
+static FramePool sharedFramePool;
 
-    return bytes + sizeof(uint16_t);
-}
+/*
+ * @brief Where the zero padding after a payload referenced in place comes from
+ */
+static uint8_t zeroPadding[UINT16_MAX];
 
 
 
-static uint8_t* writeLittle16(uint8_t* bytes, uint16_t value)
+MessageHandler::MessageHandler()
 {
-    assert( bytes );
-
-    bytes[0] = (uint8_t)(value & 0xFF);
-    bytes[1] = (uint8_t)((value >> 8) & 0xFF);
+    this->parseIndex         = 0;
+    this->payloadSum         = 0;
 
-    return bytes + sizeof(uint16_t);
-}
+    this->headerChecksum     = 0;
+    this->payloadChecksum    = 0;
 
+    this->header.commandCode      = 0;
+    this->header.properties.value = 0;
+    this->header.payloadLength    = 0;
 
+    this->payload.json.text    = NULL;
+    this->payload.json.tree    = NULL;
+    this->payload.json.arena   = NULL;
+    this->payload.json.printed = false;
+    this->payloadType          = 0;
+    
+    this->serializedMessage  = NULL;
+    this->serializedCapacity = 0;
+
+    this->sink               = &stdoutSink;
+    this->discardEvents      = false;
+    this->deviceTable        = NULL;
+    this->jsonValidation     = messageHandler_jsonStructural;
+
+    this->frameBuffer          = this->parseBuffer;
+    this->frameBufferSize      = parseBufferSize;
+    this->framePool            = &sharedFramePool;
+
+    this->resyncData           = this->resyncBuffer;
+    this->resyncDataSize       = parseBufferSize;
+    this->resyncIndex          = 0;
+    this->resyncCount          = 0;
+    this->streamOffset         = 0;
+    this->messageOffset        = 0;
+    this->messageBytes         = 0;
+    this->reportedSkippedBytes = 0;
+}
 
-static uint8_t* writeLittle32(uint8_t* bytes, uint32_t value)
+MessageHandler::~MessageHandler()
 {
-    assert( bytes );
+    this->releaseFrameBuffer();
+    this->releaseResyncBuffer();
 
-    bytes[0] = (uint8_t)(value & 0xFF);
-    bytes[1] = (uint8_t)((value >> 8) & 0xFF);
-    bytes[2] = (uint8_t)((value >> 16) & 0xFF);
-    bytes[3] = (uint8_t)((value >> 24) & 0xFF);
+    if( this->serializedMessage )
+        free(this->serializedMessage);
 
-    return bytes + sizeof(uint32_t);
+    this->releasePayload();
 }
 
+MessageHandler::MessageHandler(uint8_t* rawBuffer, uint32_t size)
+{
+    this->parseIndex         = 0;
+    this->payloadSum         = 0;
+
+    this->headerChecksum     = 0;
+    this->payloadChecksum    = 0;
+
+    this->header.commandCode      = 0;
+    this->header.properties.value = 0;
+    this->header.payloadLength    = 0;
 
+    this->payload.json.text    = NULL;
+    this->payload.json.tree    = NULL;
+    this->payload.json.arena   = NULL;
+    this->payload.json.printed = false;
+    this->payloadType          = 0;
+    
+    this->serializedMessage  = NULL;
+    this->serializedCapacity = 0;
+
+    this->sink               = &stdoutSink;
+    this->discardEvents      = false;
+    this->deviceTable        = NULL;
+    this->jsonValidation     = messageHandler_jsonStructural;
+
+    this->frameBuffer          = this->parseBuffer;
+    this->frameBufferSize      = parseBufferSize;
+    this->framePool            = &sharedFramePool;
+
+    this->resyncData           = this->resyncBuffer;
+    this->resyncDataSize       = parseBufferSize;
+    this->resyncIndex          = 0;
+    this->resyncCount          = 0;
+    this->streamOffset         = 0;
+    this->messageOffset        = 0;
+    this->messageBytes         = 0;
+    this->reportedSkippedBytes = 0;
 
-static void printMessageProperties(MessageHandler_MessageProperties* messageProperties)
-{
-    assert( messageProperties );
+    this->parseBytes(rawBuffer, size, NULL);
+}
 
-    printf("    Message Properties: 0x%04X\r\n", messageProperties->value);
-    printf("      priority:       %d\r\n", messageProperties->priority);
-    printf("      ackDesignation: %d\r\n", messageProperties->ackDesignation);
-    printf("      version:        %d\r\n", messageProperties->version);
+/*
+* @brief Outputs the message in human-readable format to stdout
+*/
+void MessageHandler::print(void)
+{   
+    stdoutSink.printMessage(this);
 }
 
+/*
+* @brief Set where parse events are reported
+*
+* @param sink - event sink, NULL to discard every event
+*/
+void MessageHandler::setSink(MessageSink* sink)
+{
+    this->sink          = sink ? sink : &nullSink;
+    this->discardEvents = (this->sink == &nullSink);
+}
 
+/*
+* @brief Set a table every decoded heartbeat is recorded in
+*        The handler's thread becomes the one thread that updates the table.
+*
+* @param deviceTable - table that outlives the handler, NULL to record nothing
+*/
+void MessageHandler::setDeviceTable(DeviceTable* deviceTable)
+{
+    this->deviceTable = deviceTable;
+}
 
-static void printHeader(MessageHandler_Header* header)
+/*
+* @brief Set how Set Sar Mode payloads are checked as they are decoded
+*
+* @param jsonValidation - check to make; messageHandler_jsonStructural by default
+*/
+void MessageHandler::setJsonValidation(MessageHandler_JsonValidation jsonValidation)
 {
-    cout << "  Header:" << endl;
-    printMessageProperties(&header->properties);
-    cout << "    Command Code:   0x" << hex << header->commandCode << endl;
-    cout << "    Payload Length: "   << dec << header->payloadLength << endl;
+    this->jsonValidation = jsonValidation;
 }
 
+/*
+* @brief Set where buffers for messages larger than the handler's own parse buffer come from
+*
+* @param framePool - buffer pool that outlives the handler, NULL for the pool shared by every handler
+*/
+void MessageHandler::setFramePool(FramePool* framePool)
+{
+    this->releaseFrameBuffer();
+    this->releaseResyncBuffer();
 
+    this->framePool = framePool ? framePool : &sharedFramePool;
+}
 
-static void printHeartbeat(MessageHandler_HeartbeatPayload* heartbeat)
+/*
+* @brief: Parse a single byte as part of a stream of bytes
+*         Messages recovered from the bytes of a rejected message can complete on the
+*         same byte; each one goes to the sink and the handler keeps the last.
+*
+* @param[out] byte - pointer to array to add to parseBuffer
+* @return     full message compiled
+*/
+bool MessageHandler::parseByte(char byte)
 {
-    assert( heartbeat );
+    const uint8_t input        = (uint8_t)byte;
+    bool          messageValid = false;
+    size_t        consumed;
 
-    cout << "    Heartbeat:" << endl;
-    cout << "      Epoch Time:    "   << dec<< heartbeat->epochTime_seconds << " seconds" << endl;
-    cout << "      Serial Number: 0x" << hex << heartbeat->serialNumber << endl;
-    cout << "      Voltage:       "   << dec << heartbeat->voltage_cV << " cV" << endl;
-    cout << "      Temperature:   "   << dec << +heartbeat->temperature_C << " degrees C" << endl;
+    // A message held back by resync can complete ahead of this byte, so keep going until it is used
+    do
+    {
+        MessageView view;
 
-    if( heartbeat->mode == 0 )
-        cout << "      Mode:          " << "Standby" << endl;
-    else 
-        cout << "      Mode:          " << "SAR" << endl;
-}
+        if( this->parseView(&input, sizeof(input), &consumed, &view) )
+            messageValid = this->decodePayload(&view) || messageValid;
 
+    } while( consumed == 0 );
 
+    return messageValid;
+}
 
-static void printPayload(MessageHandler_Payload* payload, uint16_t payloadType)
+/*
+* @brief: Parse bytes as they come in, handles multiple calls
+*
+* @param[in] buffer           - pointer to array to add to parseBuffer
+* @param[in]  size            - size of the input buffer
+* @param[out] remainingBuffer - a pointer to the remaining items in the buffer if a full message is found
+* @return     full message compiled
+*/
+bool MessageHandler::parseBytes(uint8_t* buffer, uint32_t size, uint8_t** remainingBuffer)
 {
-    assert( payload );
-
-    cout << "  Payload:" << endl;
+    size_t consumed;
 
-    if( payloadType == MESSAGE_HANDLER_COMMAND_SETSARMODE )
-    {
-        char* string = cJSON_Print(payload->json);
-        cout << string << endl;
-    }
-    else if( payloadType == MESSAGE_HANDLER_COMMAND_SETSTANDBYSTATE )
+    if( this->parseBlock(buffer, size, &consumed) )
     {
-        cout << "    Enable Standby State: " << payload->enableStandby << endl;
+        if( remainingBuffer && (size > consumed) )
+        {
+            *remainingBuffer = &buffer[consumed];
+        }
+
+        return true;
     }
-    else if( payloadType == MESSAGE_HANDLER_COMMAND_HEARTBEAT )
+
+    return false;
+}
+
+/*
+* @brief: Parse a block of bytes, scanning for the key signature and skipping over payloads
+*         Produces the same messages as feeding each byte to parseByte, and carries a
+*         partially received message over to the next call.
+*         Messages that verify but fail to decode are reported and passed over; once that
+*         has used limit bytes, the search stops there, so a caller parsing up to a known
+*         message end does not run on past it. Bytes past limit are still read to settle a
+*         message that starts before it.
+*
+* @param[in]  buffer   - pointer to the bytes to parse
+* @param[in]  size     - number of bytes in buffer
+* @param[out] consumed - number of bytes used from buffer; less than size when a message completes early
+* @param[in]  limit    - bytes after which no further message is searched for
+* @return     full message compiled
+*/
+bool MessageHandler::parseBlock(const uint8_t* buffer, size_t size, size_t* consumed, size_t limit)
+{
+    assert( consumed );
+
+    MessageView view;
+    size_t      position = 0;
+
+    while( position < size && position < limit )
     {
-        printHeartbeat(&payload->heartbeat);
+        size_t viewConsumed;
+        bool   messageFound = this->parseView(&buffer[position], size - position, &viewConsumed, &view);
+
+        position += viewConsumed;
+
+        if( !messageFound )
+            break;
+
+        if( this->decodePayload(&view) )
+        {
+            *consumed = position;
+            return true;
+        }
     }
-}
 
+    *consumed = position;
 
+    return false;
+}
 
-static uint16_t generateChecksum(uint8_t* buffer, uint32_t size)
+/*
+* @brief: Parse every message in a block of bytes into a batch
+*         Each message is decoded and reported as parseBlock would, then added to the
+*         end of batch; a partially received message at the end is carried over to the
+*         next call. Set Sar Mode payloads are handed over to the batch, so getPayloadJson
+*         returns NULL afterward.
+*
+* @param buffer - pointer to the bytes to parse
+* @param size   - number of bytes in buffer
+* @param batch  - batch the messages are added to; it is not cleared first
+* @return       number of messages added
+*/
+uint32_t MessageHandler::parseAll(const uint8_t* buffer, size_t size, MessageBatch* batch)
 {
-    assert( buffer );
+    assert( buffer || size == 0 );
+    assert( batch );
 
-    uint16_t checksum = 0;
+    MessageView view;
+    size_t      position     = 0;
+    uint32_t    messageCount = 0;
 
-    for(uint32_t i = 0; i < size; i++)
+    while( position < size )
     {
-        checksum += buffer[i];
-    }
+        size_t viewConsumed;
 
-    return checksum;
-}
+        if( !this->parseView(&buffer[position], size - position, &viewConsumed, &view) )
+            break;
 
+        position += viewConsumed;
 
+        if( !this->decodePayload(&view) )
+            continue;
 
-MessageHandler::MessageHandler()
-{
-    this->parseIndex         = 0;
+        MessageBatch_Message* message = batch->add(view.getFrame(), view.getFrameSize());
 
-    this->headerChecksum     = 0;
-    this->payloadChecksum    = 0;
+        if( message == NULL )
+            continue;
 
-    this->header.commandCode      = 0;
-    this->header.properties.value = 0;
-    this->header.payloadLength    = 0;
+        message->header          = this->header;
+        message->headerChecksum  = this->headerChecksum;
+        message->payloadChecksum = this->payloadChecksum;
+        message->payload         = this->payload;
 
-    this->payload.json = NULL;
-    
-    this->serializedMessage  = NULL;
-    this->serializedSize     = 0;
-}
+        // The batch releases the payload now
+        this->payloadType = 0;
 
-MessageHandler::~MessageHandler()
-{
-    if( this->serializedMessage )
-        free(this->serializedMessage);
+        messageCount++;
+    }
 
-    if( this->payload.json )
-        cJSON_free(this->payload.json);
+    return messageCount;
 }
 
-MessageHandler::MessageHandler(uint8_t* rawBuffer, uint32_t size)
+/*
+* @brief: Find the next message in a block of bytes without decoding or copying its payload
+*         The header and checksums are verified; the payload is left for the caller to decode
+*         through the view. When the message is contiguous in buffer the view points into
+*         buffer, otherwise it points into the handler's parse buffer. Either way it is only
+*         valid until the next parse call.
+*         After a message fails validation, scanning resumes one byte past its key signature,
+*         so a message that starts inside the rejected bytes is still found. This can return
+*         a message held back from an earlier block with nothing consumed from buffer.
+*
+* @param[in]  buffer   - pointer to the bytes to parse
+* @param[in]  size     - number of bytes in buffer
+* @param[out] consumed - number of bytes used from buffer; less than size when a message completes early
+* @param[out] view     - the message found
+* @return     full message found
+*/
+bool MessageHandler::parseView(const uint8_t* buffer, size_t size, size_t* consumed, MessageView* view)
 {
-    this->parseIndex         = 0;
+    assert( buffer || size == 0 );
+    assert( consumed );
+    assert( view );
 
-    this->headerChecksum     = 0;
-    this->payloadChecksum    = 0;
+    size_t position     = 0;
+    bool   messageFound = false;
 
-    this->header.commandCode      = 0;
-    this->header.properties.value = 0;
-    this->header.payloadLength    = 0;
+    // Views returned by the last call are no longer needed, so pooled buffers can go back
+    if( this->parseIndex == 0 && this->frameBuffer != this->parseBuffer )
+        this->releaseFrameBuffer();
 
-    this->payload.json = NULL;
-    
-    this->serializedMessage  = NULL;
-    this->serializedSize     = 0;
+    if( this->resyncIndex == this->resyncCount && this->resyncCount != 0 )
+        this->releaseResyncBuffer();
 
-    this->parseBytes(rawBuffer, size, NULL);
+    while( !messageFound )
+    {
+        size_t used;
+
+        if( this->resyncIndex < this->resyncCount )
+        {
+            // Bytes held back from a rejected message come before anything new
+            messageFound       = this->scanBlock(&this->resyncData[this->resyncIndex], this->resyncCount - this->resyncIndex, &used, view);
+            this->resyncIndex += used;
+        }
+        else if( position < size )
+        {
+            messageFound = this->scanBlock(&buffer[position], size - position, &used, view);
+            position    += used;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    *consumed           = position;
+    this->streamOffset += position;
+
+    if( messageFound )
+    {
+        this->messageBytes += view->getFrameSize();
+
+        // The message ends just before whatever is still held back to be scanned
+        this->messageOffset = this->streamOffset - this->parseIndex - (this->resyncCount - this->resyncIndex) - view->getFrameSize();
+
+        uint64_t skippedBytes = this->getSkippedBytes();
+
+        if( skippedBytes != this->reportedSkippedBytes )
+        {
+            this->sink->bytesSkipped(skippedBytes - this->reportedSkippedBytes);
+            this->reportedSkippedBytes = skippedBytes;
+        }
+    }
+
+    return messageFound;
 }
 
 /*
-* @brief Outputs the message in human-readable format to stdout
+* @brief Get the number of bytes that were not part of any verified message
+*        This counts noise between messages and every byte of a rejected message
+*        that did not turn out to belong to a later message.
+*
+* @return skipped byte count since the handler was created
 */
-void MessageHandler::print(void)
-{   
-    cout << "Message:" << endl;
-    cout << "  Key Signature:    " << this->packetSignature << endl;
-    cout << "  Header Checksum:  0x" << hex << this->headerChecksum << endl;
-    cout << "  Payload Checksum: 0x" << hex << this->payloadChecksum << endl;
-    printHeader(&this->header);
-    printPayload(&this->payload, this->header.commandCode);
+uint64_t MessageHandler::getSkippedBytes(void)
+{
+    return this->streamOffset - this->messageBytes - this->parseIndex - (this->resyncCount - this->resyncIndex);
 }
 
 /*
-* @brief: Parse a single byte as part of a stream of bytes
+* @brief Get where the message the last parse call returned starts in the stream
 *
-* @param[out] byte - pointer to array to add to parseBuffer
-* @return     full message compiled
+* @return offset of its key signature, counting every byte given to the handler
 */
-bool MessageHandler::parseByte(char byte)
+uint64_t MessageHandler::getMessageOffset(void)
 {
-    this->parseBuffer[this->parseIndex++] = byte;
+    return this->messageOffset;
+}
 
-    if( this->parseIndex <= fieldSize_keySignature )
+/*
+* @brief Scan one block of bytes for the next message
+*        When a message that began in an earlier block is rejected, its bytes after the key
+*        signature are held in resyncData and the scan stops with *consumed set to 0,
+*        so they can be rescanned ahead of this block.
+*
+* @param[in]  buffer   - pointer to the bytes to scan
+* @param[in]  size     - number of bytes in buffer
+* @param[out] consumed - number of bytes used from buffer
+* @param[out] view     - the message found
+* @return     full message found
+*/
+bool MessageHandler::scanBlock(const uint8_t* buffer, size_t size, size_t* consumed, MessageView* view)
+{
+    size_t  position   = 0;
+    int64_t frameStart = -(int64_t)this->parseIndex;   // negative when the message began in an earlier block
+
+    while( position < size )
     {
-        if( (char)byte != 'T' )
+        bool messageRejected = false;
+
+        if( this->parseIndex == 0 )
         {
-            this->parseIndex = 0;
+            const uint8_t* frame = (const uint8_t*)memchr(&buffer[position], this->packetSignature[0], size - position);
+
+            if( frame == NULL )
+                break;
+
+            position   = frame - buffer;
+            frameStart = position;
+
+            // The whole prefix and header are in the block, so validate them in one step
+            if( size - position >= fieldIndex_payload )
+            {
+                if(   frame[1] != (uint8_t)this->packetSignature[1]
+                   || this->checkCommandCode(frame) != messageHandler_statusValid
+                   || this->checkHeader(frame) != messageHandler_statusValid )
+                {
+                    position++;
+                    continue;
+                }
+
+                size_t frameSize = fieldIndex_payload + this->header.payloadLength;
+
+                if( size - position >= frameSize )
+                {
+                    if( this->verifyPayload(generateChecksum(&frame[fieldIndex_payload], this->header.payloadLength)) )
+                    {
+                        *view     = MessageView(frame, frameSize);
+                        *consumed = position + frameSize;
+                        return true;
+                    }
+
+                    position++;
+                    continue;
+                }
+
+                // The payload runs past the end of the block; hold on to what is here
+                if( !this->reserveFrameBuffer(frameSize + 1) )
+                {
+                    position++;
+                    continue;
+                }
+
+                memcpy(this->frameBuffer, frame, size - position);
+                this->payloadSum = generateChecksum(&frame[fieldIndex_payload], size - position - fieldIndex_payload);
+                this->parseIndex = size - position;
+                position = size;
+                continue;
+            }
         }
-        else if( this->parseIndex == fieldSize_keySignature )
+
+        if( this->parseIndex < fieldIndex_payload )
         {
-            cout << "Receiving Message:" << endl;
-            cout << "  Key Signature:    " << this->packetSignature << endl;
+            // Partial prefix or header, either carried over or at the end of the block
+            if( this->acceptByte(buffer[position++]) )
+            {
+                *view     = MessageView(this->frameBuffer, fieldIndex_payload + this->header.payloadLength);
+                *consumed = position;
+                return true;
+            }
+
+            messageRejected = (this->parseIndex == 0);
+        }
+        else
+        {
+            size_t needed = fieldIndex_payload + this->header.payloadLength - this->parseIndex;
+            size_t count  = (size - position < needed) ? size - position : needed;
+
+            memcpy(&this->frameBuffer[this->parseIndex], &buffer[position], count);
+            this->payloadSum += generateChecksum(&buffer[position], count);
+            this->parseIndex += count;
+            position         += count;
+
+            if( count == needed )
+            {
+                if( this->verifyPayload(this->payloadSum) )
+                {
+                    *view     = MessageView(this->frameBuffer, fieldIndex_payload + this->header.payloadLength);
+                    *consumed = position;
+                    return true;
+                }
+
+                messageRejected = true;
+            }
         }
-    }
-    else if( this->parseIndex == (fieldIndex_headerChecksum + fieldSize_headerChecksum) )
-    {
-        readLittle16(&this->parseBuffer[fieldIndex_headerChecksum], &this->headerChecksum);
-        cout << "  Header Checksum:  0x" << hex << this->headerChecksum << endl;
-    }
-    else if( this->parseIndex == (fieldIndex_dataChecksum + fieldSize_dataChecksum) )
-    {
-        readLittle16(&this->parseBuffer[fieldIndex_dataChecksum], &this->payloadChecksum);
-        cout << "  Payload Checksum: 0x" << hex << this->payloadChecksum << endl;
-    }
-    else if( this->parseIndex == (fieldIndex_messageProperties + fieldSize_messageProperties) )
-    {
-        readLittle16(&this->parseBuffer[fieldIndex_messageProperties], &this->header.properties.value);
 
-        cout << "  Header:" << endl;
+        if( messageRejected )
+        {
+            if( frameStart >= 0 )
+            {
+                position = frameStart + 1;
+            }
+            else if( frameStart < -1 )
+            {
+                // The rejected message began in an earlier block; those bytes are only in frameBuffer now
+                assert( this->resyncIndex == this->resyncCount );
+
+                this->releaseResyncBuffer();
+
+                if( this->frameBuffer != this->parseBuffer )
+                {
+                    // Hand the pooled buffer over rather than copying out of it
+                    this->resyncData      = this->frameBuffer;
+                    this->resyncDataSize  = this->frameBufferSize;
+                    this->frameBuffer     = this->parseBuffer;
+                    this->frameBufferSize = parseBufferSize;
+                }
+                else
+                {
+                    memcpy(this->resyncBuffer, this->parseBuffer, (size_t)-frameStart);
+                }
+
+                this->resyncCount = (uint32_t)-frameStart;
+                this->resyncIndex = 1;
+
+                *consumed = 0;
+                return false;
+            }
+            else
+            {
+                position = 0;
+            }
 
-        printMessageProperties(&this->header.properties);
+            frameStart = position;
+        }
     }
-    else if( this->parseIndex == (fieldIndex_commandCode + fieldSize_commandCode) )
+
+    *consumed = size;
+
+    return false;
+}
+
+/*
+* @brief Add a single byte to frameBuffer and validate each field as it completes
+*
+* @param byte - next byte of the stream
+* @return     a message with a verified payload checksum is in frameBuffer
+*/
+bool MessageHandler::acceptByte(uint8_t byte)
+{
+    this->frameBuffer[this->parseIndex++] = byte;
+
+    if( this->parseIndex > fieldIndex_payload )
     {
-        readLittle16(&parseBuffer[fieldIndex_commandCode], &this->header.commandCode);
+        this->payloadSum += byte;
+    }
 
-        if(   this->header.commandCode != MESSAGE_HANDLER_COMMAND_SETSARMODE 
-           && this->header.commandCode != MESSAGE_HANDLER_COMMAND_SETSTANDBYSTATE 
-           && this->header.commandCode != MESSAGE_HANDLER_COMMAND_HEARTBEAT
-          )
+    if( this->parseIndex <= fieldSize_keySignature )
+    {
+        if( byte != (uint8_t)this->packetSignature[this->parseIndex - 1] )
         {
-            printf("Error - Invalid command code: 0x%04X\r\n\r\n", this->header.commandCode);
             this->parseIndex = 0;
         }
-        else
+    }
+    else if( this->parseIndex == (fieldIndex_commandCode + fieldSize_commandCode) )
+    {
+        if( this->checkCommandCode(this->frameBuffer) != messageHandler_statusValid )
         {
-            printf("    Command Code:   0x%04X\r\n", this->header.commandCode);
+            this->parseIndex = 0;
         }
     }
     else if( this->parseIndex == (fieldIndex_payloadSize + fieldSize_payloadSize) )
     {
-        readLittle16(&this->parseBuffer[fieldIndex_payloadSize], &this->header.payloadLength);
-
-        cout << "    Payload Length: " << dec << this->header.payloadLength << endl;
-
-        if( this->header.commandCode == MESSAGE_HANDLER_COMMAND_SETSTANDBYSTATE && this->header.payloadLength != sizeof(uint8_t) )
+        if(   this->checkHeader(this->frameBuffer) != messageHandler_statusValid
+           || !this->reserveFrameBuffer(fieldIndex_payload + this->header.payloadLength + 1) )
         {
-            printf("Error - invalid payload size for \"Set Standby State\" message\r\n\r\n");
             this->parseIndex = 0;
         }
-        else if( this->header.commandCode == MESSAGE_HANDLER_COMMAND_HEARTBEAT && this->header.payloadLength != sizeof(MessageHandler_HeartbeatPayload) )
+        else
         {
-            printf("Error - invalid payload size for \"Heartbeat\" message\r\n\r\n");
-            this->parseIndex = 0;
-        }
-
-        uint16_t headerChecksum = generateChecksum(this->header.headerBytes, messageHandler_headerSize);
+            this->payloadSum = 0;
 
-        if( headerChecksum != this->headerChecksum )
-        {
-            printf("Error - invalid header checksum; discontinuing parse\r\n\r\n");
-            this->parseIndex = 0;
+            if( this->header.payloadLength == 0 )
+                return this->verifyPayload(this->payloadSum);
         }
     }
     else if( this->parseIndex == (uint32_t)(fieldIndex_payload + this->header.payloadLength) )
     {
-        bool messageValid = true;
+        return this->verifyPayload(this->payloadSum);
+    }
 
-        uint16_t payloadChecksum = generateChecksum(&this->parseBuffer[fieldIndex_payload], this->header.payloadLength);
+    return false;
+}
 
-        if( payloadChecksum != this->payloadChecksum )
-        {
-            printf("Error - invalid payload checksum (0x%X != 0x%X)\r\n\r\n", payloadChecksum, this->payloadChecksum);
-            this->parseIndex = 0;
-            messageValid = false;
-        }
+/*
+* @brief Validate the prefix and header fields up through the command code
+*
+* @param frame - pointer to at least fieldIndex_payloadSize bytes of a message
+* @return      status of the command code
+*/
+MessageHandler_Status MessageHandler::checkCommandCode(const uint8_t* frame)
+{
+    assert( frame );
 
-        if( this->header.commandCode == MESSAGE_HANDLER_COMMAND_SETSARMODE )
-        {
-            messageValid = this->setPayloadJson((char*)&this->parseBuffer[fieldIndex_payload]);
-            if( !messageValid )
-            {
-                printf("Error - invalid JSON in \"Set Sar Mode\" message\r\n");
-                cout << endl << "  " << (char*)&this->parseBuffer[fieldIndex_payload] << endl;
-            }
-        }
-        else if( this->header.commandCode == MESSAGE_HANDLER_COMMAND_SETSTANDBYSTATE )
-        {
-            this->setPayloadStandbyEnabled(this->parseBuffer[fieldIndex_payload]);
-        }
-        else if( this->header.commandCode == MESSAGE_HANDLER_COMMAND_HEARTBEAT )
-        {
-            this->setHeartbeat((MessageHandler_HeartbeatPayload*)&this->parseBuffer[fieldIndex_payload]);
-        }
+    this->headerChecksum          = frameCodec_headerChecksum::read(frame);
+    this->payloadChecksum         = frameCodec_dataChecksum::read(frame);
+    this->header.properties.value = frameCodec_messageProperties::read(frame);
+    this->header.commandCode      = frameCodec_commandCode::read(frame);
 
-        if( messageValid )
-            printPayload(&this->payload, this->header.commandCode);
+    // Not read until checkHeader; keep whatever came before out of the events
+    this->header.payloadLength = 0;
 
-        this->parseIndex = 0;
+    if( !this->discardEvents )
+        this->sink->frameStart(&this->header, this->headerChecksum, this->payloadChecksum);
 
-        return messageValid;
+    if( !isMessageTypeKnown(this->header.commandCode) )
+    {
+        this->reportError(messageHandler_statusInvalidCommandCode, 0, NULL);
+        return messageHandler_statusInvalidCommandCode;
     }
 
-    return false;
+    return messageHandler_statusValid;
 }
 
 /*
-* @brief: Parse bytes as they come in, handles multiple calls
+* @brief Validate the payload length and header checksum
 *
-* @param[in] buffer           - pointer to array to add to parseBuffer
-* @param[in]  size            - size of the input buffer
-* @param[out] remainingBuffer - a pointer to the remaining items in the buffer if a full message is found
-* @return     full message compiled
+* @param frame - pointer to at least fieldIndex_payload bytes of a message
+* @return      status of the header
 */
-bool MessageHandler::parseBytes(uint8_t* buffer, uint32_t size, uint8_t** remainingBuffer)
+MessageHandler_Status MessageHandler::checkHeader(const uint8_t* frame)
+{
+    assert( frame );
+
+    MessageHandler_Status status = messageHandler_statusValid;
+
+    this->header.payloadLength = frameCodec_payloadSize::read(frame);
+
+    if( !this->discardEvents )
+        this->sink->headerDecoded(&this->header);
+
+    if( !isPayloadSizeValid(findMessageType(this->header.commandCode), this->header.payloadLength) )
+    {
+        status = messageHandler_statusInvalidPayloadSize;
+        this->reportError(status, 0, NULL);
+    }
+
+    uint16_t headerChecksum = generateChecksum(&frame[fieldIndex_messageProperties], messageHandler_headerSize);
+
+    if( headerChecksum != this->headerChecksum )
+    {
+        this->reportError(messageHandler_statusInvalidHeaderChecksum, headerChecksum, NULL);
+
+        if( status == messageHandler_statusValid )
+            status = messageHandler_statusInvalidHeaderChecksum;
+    }
+
+    return status;
+}
+
+/*
+* @brief Check the payload checksum of a message whose header passed checkHeader
+*        This ends the message in frameBuffer either way.
+*
+* @param payloadChecksum - checksum of the header.payloadLength bytes of payload received
+* @return                payload checksum valid
+*/
+bool MessageHandler::verifyPayload(uint16_t payloadChecksum)
+{
+    this->parseIndex = 0;
+
+    if( payloadChecksum != this->payloadChecksum )
+    {
+        this->reportError(messageHandler_statusInvalidPayloadChecksum, payloadChecksum, NULL);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+* @brief Decode a verified payload into the message
+*
+* @param view - the verified message
+* @return     full message valid
+*/
+bool MessageHandler::decodePayload(MessageView* view)
 {
-    for(uint32_t j = 0; j < size; j++)
+    assert( view );
+
+    const MessageRegistry_Type* type         = findMessageType(this->header.commandCode);
+    const uint8_t*              payloadBytes = view->getPayload();
+    bool                        messageValid = true;
+
+    this->releasePayload();
+    this->payloadType = this->header.commandCode;
+
+    if( type->terminatedPayload )
     {
-        if( this->parseByte(buffer[j]) )
+        // The payload does not carry a terminator; add one past it in frameBuffer
+        uint8_t* terminated = &this->frameBuffer[fieldIndex_payload];
+
+        if( payloadBytes != terminated )
         {
-            if( remainingBuffer && (size > j + 1) )
-            {
-                *remainingBuffer = &buffer[j + 1];
-            }
+            messageValid = this->reserveFrameBuffer(fieldIndex_payload + this->header.payloadLength + 1);
+            terminated   = &this->frameBuffer[fieldIndex_payload];
 
-            return true;
+            if( messageValid )
+                memcpy(terminated, payloadBytes, this->header.payloadLength);
         }
+
+        if( messageValid )
+            terminated[this->header.payloadLength] = '\0';
+
+        payloadBytes = terminated;
     }
 
-    return false;
+    if( messageValid )
+        messageValid = type->decode(payloadBytes, this->header.payloadLength, this->jsonValidation, &this->payload);
+
+    if( !messageValid )
+    {
+        this->reportError(type->decodeError, 0, view);
+        return false;
+    }
+
+    if( this->deviceTable && this->header.commandCode == MESSAGE_HANDLER_COMMAND_HEARTBEAT )
+        this->deviceTable->update(&this->payload.heartbeat);
+
+    if( !this->discardEvents )
+        this->sink->frameComplete(this, view);
+
+    return messageValid;
+}
+
+/*
+* @brief Report a message that failed validation to the sink
+*
+* @param status           - what failed
+* @param computedChecksum - checksum calculated over the received bytes, for checksum errors
+* @param view             - the whole message, when it was received
+*/
+void MessageHandler::reportError(MessageHandler_Status status, uint16_t computedChecksum, MessageView* view)
+{
+    MessageSink_Error error;
+
+    error.status           = status;
+    error.header           = &this->header;
+    error.receivedChecksum = (status == messageHandler_statusInvalidHeaderChecksum) ? this->headerChecksum : this->payloadChecksum;
+    error.computedChecksum = computedChecksum;
+    error.view             = view;
+
+    this->sink->frameError(&error);
 }
 
 /*
 * @brief: Serialize a message built by originally
+*         The buffer belongs to the handler and is reused, growing only when a
+*         message does not fit; it is valid until the next call.
 *
 * @param[out] buffer - this is a double pointer to be able return a new pointer to the serialization of object
 * @return     size   - serialization size
 */
 uint32_t MessageHandler::getSerialized(uint8_t** buffer)
 {
-    if( this->serializedMessage != NULL )
-        free(this->serializedMessage);
+    uint32_t serializedSize = messageHandler_headerSize + messageHandler_prefixSize + this->header.payloadLength;
+
+    this->reserveSerialized(serializedSize);
+    this->serializeInto(this->serializedMessage, this->serializedCapacity);
 
-    this->serializedSize = messageHandler_headerSize + messageHandler_prefixSize + this->header.payloadLength;
+    *buffer = this->serializedMessage;
+    
+    return serializedSize;
+}
+
+/*
+* @brief: Serialize the message into a buffer the caller provides, without allocating
+*         Nothing is written unless the whole message fits.
+*
+* @param buffer   - where the message goes
+* @param capacity - number of bytes in buffer
+* @return         serialization size; more than capacity when the message did not fit
+*/
+uint32_t MessageHandler::serializeInto(uint8_t* buffer, size_t capacity)
+{
+    assert( buffer || capacity == 0 );
+
+    uint32_t serializedSize = messageHandler_headerSize + messageHandler_prefixSize + this->header.payloadLength;
 
-    this->serializedMessage = (uint8_t*)malloc(this->serializedSize);
+    if( serializedSize > capacity )
+        return serializedSize;
 
-    this->headerChecksum = generateChecksum(this->header.headerBytes, messageHandler_headerSize);
+    this->encodeHeader(buffer);
 
-    writeLittle16(&this->serializedMessage[fieldIndex_keySignature], *(uint16_t*)this->packetSignature);
-    writeLittle16(&this->serializedMessage[fieldIndex_headerChecksum], this->headerChecksum);
-    writeLittle16(&this->serializedMessage[fieldIndex_messageProperties], this->header.properties.value);
-    writeLittle16(&this->serializedMessage[fieldIndex_commandCode], this->header.commandCode);
-    writeLittle16(&this->serializedMessage[fieldIndex_payloadSize], this->header.payloadLength);
+    findMessageType(this->header.commandCode)->encode(&this->payload, &buffer[fieldIndex_payload], this->header.payloadLength);
 
-    if( this->header.commandCode == MESSAGE_HANDLER_COMMAND_SETSARMODE )
+    this->payloadChecksum = generateChecksum(&buffer[fieldIndex_payload], this->header.payloadLength);
+    frameCodec_dataChecksum::write(buffer, this->payloadChecksum);
+
+    return serializedSize;
+}
+
+/*
+* @brief: Serialize the message as a gather list for writev, with the checksums computed in place
+*         The prefix and header go in the handler's serialize buffer. A payload the message
+*         already holds as it goes out, such as JSON given to setPayloadJson, is referenced
+*         where it is, followed by any zero padding; any other payload is encoded after the
+*         header. The vectors stay valid until the message changes or is serialized again.
+*
+* @param[out] vectors - messageHandler_maxSerializedVectors entries
+* @return     number of vectors filled, 0 if the serialize buffer could not be allocated
+*/
+uint32_t MessageHandler::getSerializedVectors(struct iovec* vectors)
+{
+    assert( vectors );
+
+    const MessageRegistry_Type* type          = findMessageType(this->header.commandCode);
+    uint16_t                    payloadLength = this->header.payloadLength;
+    uint16_t                    heldSize      = 0;
+    const uint8_t*              held          = type->reference(&this->payload, payloadLength, &heldSize);
+    uint32_t                    vectorCount   = 0;
+
+    if( !this->reserveSerialized(fieldIndex_payload + (held ? 0 : payloadLength)) )
+        return 0;
+
+    uint8_t* frame = this->serializedMessage;
+
+    this->encodeHeader(frame);
+
+    vectors[vectorCount].iov_base = frame;
+    vectors[vectorCount].iov_len  = fieldIndex_payload;
+    vectorCount++;
+
+    if( held == NULL )
     {
-        strncpy((char*)&this->serializedMessage[fieldIndex_payload], 
-                cJSON_PrintUnformatted(this->payload.json),
-                this->header.payloadLength
-               );
+        // Encoded right after the header, so the two could go out as one vector
+        type->encode(&this->payload, &frame[fieldIndex_payload], payloadLength);
+
+        held     = &frame[fieldIndex_payload];
+        heldSize = payloadLength;
     }
-    else if( this->header.commandCode == MESSAGE_HANDLER_COMMAND_SETSTANDBYSTATE )
+
+    // The zero padding adds nothing to the checksum
+    this->payloadChecksum = generateChecksum(held, heldSize);
+    frameCodec_dataChecksum::write(frame, this->payloadChecksum);
+
+    if( heldSize > 0 )
     {
-        this->serializedMessage[fieldIndex_payload] = (uint8_t)this->payload.enableStandby;
+        vectors[vectorCount].iov_base = (void*)held;
+        vectors[vectorCount].iov_len  = heldSize;
+        vectorCount++;
     }
-    else if( this->header.commandCode == MESSAGE_HANDLER_COMMAND_HEARTBEAT )
+
+    if( heldSize < payloadLength )
     {
-        uint8_t* nextPtr = writeLittle32(&this->serializedMessage[fieldIndex_payload], this->payload.heartbeat.epochTime_seconds);
-        nextPtr          = writeLittle32(nextPtr, this->payload.heartbeat.epochTime_seconds);
-        nextPtr          = writeLittle32(nextPtr, this->payload.heartbeat.serialNumber);
-        nextPtr          = writeLittle16(nextPtr, this->payload.heartbeat.voltage_cV);
-        *nextPtr++       = (uint8_t)this->payload.heartbeat.temperature_C;
-        *nextPtr         = this->payload.heartbeat.mode;
+        vectors[vectorCount].iov_base = zeroPadding;
+        vectors[vectorCount].iov_len  = payloadLength - heldSize;
+        vectorCount++;
     }
-    else
-    {
+
+    return vectorCount;
+}
+
+/*
+* @brief Write the key signature, header and header checksum at the start of frame
+*
+* @param frame - at least fieldIndex_payload bytes
+*/
+void MessageHandler::encodeHeader(uint8_t* frame)
+{
+    memcpy(&frame[fieldIndex_keySignature], this->packetSignature, fieldSize_keySignature);
+    frameCodec_header::encode(&this->header, frame);
+
+    // Checksum the header as it goes out, not as the host holds it
+    this->headerChecksum = generateChecksum(&frame[fieldIndex_messageProperties], messageHandler_headerSize);
+    frameCodec_headerChecksum::write(frame, this->headerChecksum);
+}
+
+/*
+* @brief Make serializedMessage hold at least size bytes; what it held is lost when it grows
+*
+* @param size - bytes needed
+* @return     serializedMessage is large enough
+*/
+bool MessageHandler::reserveSerialized(uint32_t size)
+{
+    if( size <= this->serializedCapacity )
+        return true;
+
+    if( this->serializedMessage != NULL )
         free(this->serializedMessage);
-    }
 
-    this->payloadChecksum = generateChecksum(&this->serializedMessage[fieldIndex_payload], this->header.payloadLength);
-    writeLittle16(&this->serializedMessage[fieldIndex_dataChecksum], this->payloadChecksum);
+    this->serializedMessage  = (uint8_t*)malloc(size);
+    this->serializedCapacity = this->serializedMessage ? size : 0;
 
-    *buffer = this->serializedMessage;
-    
-    return this->serializedSize;
+    return this->serializedMessage != NULL;
 }
 
 
@@ -418,6 +966,8 @@ uint32_t MessageHandler::getSerialized(uint8_t** buffer)
 void MessageHandler::setHeartbeat(MessageHandler_HeartbeatPayload* heartbeat)
 {
     assert( heartbeat );
+    this->releasePayload();
+    this->payloadType          = MESSAGE_HANDLER_COMMAND_HEARTBEAT;
     this->header.commandCode   = MESSAGE_HANDLER_COMMAND_HEARTBEAT;
     this->header.payloadLength = sizeof(MessageHandler_HeartbeatPayload);
     memcpy(&this->payload.heartbeat, heartbeat, sizeof(MessageHandler_HeartbeatPayload));
@@ -453,10 +1003,12 @@ bool MessageHandler::setPayloadJson(char* jsonString)
 
     assert( jsonString );
 
+    this->releasePayload();
+    this->payloadType = MESSAGE_HANDLER_COMMAND_SETSARMODE;
     this->header.commandCode = MESSAGE_HANDLER_COMMAND_SETSARMODE;
-    this->payload.json = cJSON_Parse(jsonString);
     this->header.payloadLength = strnlen(jsonString, MAX_STRING_LENGTH);
-    if( this->payload.json )
+
+    if( this->decodePayloadJson(jsonString) )
     {
         return true;
     }
@@ -466,6 +1018,38 @@ bool MessageHandler::setPayloadJson(char* jsonString)
     return false;
 }
 
+/*
+* @brief Replace the JSON payload with the tree parsed from jsonString and the text it prints to
+*
+* @param jsonString - NUL terminated JSON string
+* @return           JSON valid
+*/
+bool MessageHandler::decodePayloadJson(const char* jsonString)
+{
+    assert( jsonString );
+
+    MessageHandler_JsonPayload* json = &this->payload.json;
+
+    json->arena = JsonArena::create(strlen(jsonString));
+
+    if( json->arena == NULL )
+        return false;
+
+    json->tree = json->arena->parse(jsonString);
+
+    // Keep the text as it will be sent, so serializing it is a copy
+    if( json->tree )
+    {
+        json->text    = json->arena->print(json->tree, false);
+        json->printed = json->text != NULL;
+    }
+
+    if( json->text == NULL )
+        json->text = json->arena->copyText(jsonString, strlen(jsonString));
+
+    return json->tree != NULL;
+}
+
 /*
 * @brief retrieve a pointer the JSON payload of the message
 *
@@ -473,12 +1057,40 @@ bool MessageHandler::setPayloadJson(char* jsonString)
 */
 char* MessageHandler::getPayloadJsonString(void)
 {
-    if( this->payload.json )
-        return cJSON_PrintUnformatted(this->payload.json);
+    cJSON* tree = this->getPayloadJson();
+
+    if( tree )
+        return cJSON_PrintUnformatted(tree);
     else
         return NULL;
 }
 
+/*
+* @brief retrieve the JSON payload tree of the message; it stays owned by the message
+*        The tree is parsed from the payload text on the first call.
+*
+* @return JSON tree, NULL if the message holds no JSON payload or it is not valid JSON
+*/
+cJSON* MessageHandler::getPayloadJson(void)
+{
+    if( this->payloadType == MESSAGE_HANDLER_COMMAND_SETSARMODE )
+        return loadJsonPayloadTree(&this->payload.json);
+    else
+        return NULL;
+}
+
+/*
+* @brief retrieve the decoded payload of the message; JSON text and tree in it stay owned by the message
+*
+* @param[out] payload - payload, as read by the message type of getCommandCode
+*/
+void MessageHandler::getPayload(MessageHandler_Payload* payload)
+{
+    assert( payload );
+
+    *payload = this->payload;
+}
+
 /*
 * @brief set the message type to enable/disable standby state
 *
@@ -486,6 +1098,8 @@ char* MessageHandler::getPayloadJsonString(void)
 */
 void MessageHandler::setPayloadStandbyEnabled(bool enable)
 {
+    this->releasePayload();
+    this->payloadType           = MESSAGE_HANDLER_COMMAND_SETSTANDBYSTATE;
     this->header.commandCode    = MESSAGE_HANDLER_COMMAND_SETSTANDBYSTATE;
     this->payload.enableStandby = enable;
     this->header.payloadLength  = 1;
@@ -511,6 +1125,26 @@ uint16_t MessageHandler::getPayloadLength(void)
     return this->header.payloadLength;
 }
 
+/*
+* @brief Get the header checksum received with, or generated for, the message
+*
+* @return header checksum
+*/
+uint16_t MessageHandler::getHeaderChecksum(void)
+{
+    return this->headerChecksum;
+}
+
+/*
+* @brief Get the payload checksum received with, or generated for, the message
+*
+* @return payload checksum
+*/
+uint16_t MessageHandler::getPayloadChecksum(void)
+{
+    return this->payloadChecksum;
+}
+
 /*
 * @brief Retrieve the command code that specifies the message data type
 *
@@ -545,6 +1179,74 @@ void MessageHandler::getMessageProperties(MessageHandler_MessageProperties* prop
     memcpy(properties, &this->header.properties, sizeof(MessageHandler_MessageProperties));
 }
 
+/*
+* @brief Make frameBuffer hold at least size bytes, keeping the parseIndex bytes already in it
+*        Messages that fit parseBuffer never touch the pool.
+*
+* @param size - bytes needed
+* @return     frameBuffer is large enough
+*/
+bool MessageHandler::reserveFrameBuffer(uint32_t size)
+{
+    if( size <= this->frameBufferSize )
+        return true;
+
+    uint32_t capacity;
+    uint8_t* buffer = this->framePool->acquire(size, &capacity);
+
+    if( buffer == NULL )
+        return false;
+
+    memcpy(buffer, this->frameBuffer, this->parseIndex);
+
+    this->releaseFrameBuffer();
+
+    this->frameBuffer     = buffer;
+    this->frameBufferSize = capacity;
+
+    return true;
+}
+
+/*
+* @brief Return a pooled frameBuffer and go back to parseBuffer
+*/
+void MessageHandler::releaseFrameBuffer(void)
+{
+    if( this->frameBuffer != this->parseBuffer )
+        this->framePool->release(this->frameBuffer, this->frameBufferSize);
+
+    this->frameBuffer     = this->parseBuffer;
+    this->frameBufferSize = parseBufferSize;
+}
+
+/*
+* @brief Return a pooled resyncData and go back to resyncBuffer
+*/
+void MessageHandler::releaseResyncBuffer(void)
+{
+    if( this->resyncData != this->resyncBuffer )
+        this->framePool->release(this->resyncData, this->resyncDataSize);
+
+    this->resyncData     = this->resyncBuffer;
+    this->resyncDataSize = parseBufferSize;
+    this->resyncIndex    = 0;
+    this->resyncCount    = 0;
+}
+
+/*
+* @brief Release anything owned by the current payload before it is overwritten
+*/
+void MessageHandler::releasePayload(void)
+{
+    findMessageType(this->payloadType)->release(&this->payload);
+
+    this->payload.json.text    = NULL;
+    this->payload.json.tree    = NULL;
+    this->payload.json.arena   = NULL;
+    this->payload.json.printed = false;
+    this->payloadType          = 0;
+}
+
 
 
 // EOF
\ No newline at end of file
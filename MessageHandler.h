@@ -46,6 +46,27 @@ enum
     fieldIndex_payload     = 12,
 };
 
+/*
+ * @brief heartbeat payload field indeces, from the start of the payload, and sizes
+ */
+enum
+{
+    heartbeatIndex_epochTime    = 0,
+    heartbeatSize_epochTime     = 4,
+
+    heartbeatIndex_serialNumber = 4,
+    heartbeatSize_serialNumber  = 4,
+
+    heartbeatIndex_voltage      = 8,
+    heartbeatSize_voltage       = 2,
+
+    heartbeatIndex_temperature  = 10,
+    heartbeatSize_temperature   = 1,
+
+    heartbeatIndex_mode         = 11,
+    heartbeatSize_mode          = 1,
+};
+
 enum
 {
     messageHandler_prefixSize = 6,
@@ -57,6 +78,36 @@ enum
     parseBufferSize = 1024,
 };
 
+enum
+{
+    messageHandler_maxSerializedVectors = 3,    /* header, payload, zero padding */
+};
+
+/*
+ * @brief result of validating each stage of a received message
+ */
+typedef enum
+{
+    messageHandler_statusValid = 0,
+    messageHandler_statusInvalidCommandCode,
+    messageHandler_statusInvalidPayloadSize,
+    messageHandler_statusInvalidHeaderChecksum,
+    messageHandler_statusInvalidPayloadChecksum,
+    messageHandler_statusInvalidJson,
+} MessageHandler_Status;
+
+/*
+ * @brief how a Set Sar Mode payload is checked as it is decoded
+ *        Only messageHandler_jsonParse builds the cJSON tree while decoding; otherwise it
+ *        is built from the payload text the first time something asks for it.
+ */
+typedef enum
+{
+    messageHandler_jsonStructural = 0,  /* reject what cJSON_Parse would, without building a tree */
+    messageHandler_jsonParse,           /* build the tree while decoding */
+    messageHandler_jsonUnchecked,       /* accept any text */
+} MessageHandler_JsonValidation;
+
 
 #pragma pack(push, 1)
 typedef union 
@@ -96,14 +147,39 @@ typedef struct
 } MessageHandler_HeartbeatPayload;
 #pragma pack(pop)
 
+class JsonArena;
+
+/*
+ * @brief a Set Sar Mode payload: the received text, and its tree once something has asked for it
+ *        Both live in arena and go with it; when both are set they hold the same JSON.
+ *        printed is set when text is the tree as cJSON_PrintUnformatted gives it, so it
+ *        can be sent as it is.
+ */
+typedef struct
+{
+    char*      text;
+    cJSON*     tree;
+    JsonArena* arena;
+    bool       printed;
+} MessageHandler_JsonPayload;
+
 typedef union
 {
-    cJSON*                          json;
+    MessageHandler_JsonPayload      json;
     bool                            enableStandby;
     MessageHandler_HeartbeatPayload heartbeat;
 } MessageHandler_Payload;
 
 
+struct iovec;
+
+class MessageView;
+class MessageSink;
+class FramePool;
+class DeviceTable;
+class MessageBatch;
+
+
 
 class MessageHandler
 {
@@ -119,8 +195,39 @@ class MessageHandler
          */
         void print(void);
 
+        /*
+         * @brief Set where parse events are reported; the default prints text to stdout
+         *
+         * @param sink - event sink, NULL to discard every event
+         */
+        void setSink(MessageSink* sink);
+
+        /*
+         * @brief Set where buffers for messages larger than the handler's own parse buffer come from
+         *
+         * @param framePool - buffer pool that outlives the handler, NULL for the pool shared by every handler
+         */
+        void setFramePool(FramePool* framePool);
+
+        /*
+         * @brief Set a table every decoded heartbeat is recorded in
+         *        The handler's thread becomes the one thread that updates the table.
+         *
+         * @param deviceTable - table that outlives the handler, NULL to record nothing
+         */
+        void setDeviceTable(DeviceTable* deviceTable);
+
+        /*
+         * @brief Set how Set Sar Mode payloads are checked as they are decoded
+         *
+         * @param jsonValidation - check to make; messageHandler_jsonStructural by default
+         */
+        void setJsonValidation(MessageHandler_JsonValidation jsonValidation);
+
         /*
          * @brief: Parse a single byte as part of a stream of bytes
+         *         Messages recovered from the bytes of a rejected message can complete on the
+         *         same byte; each one goes to the sink and the handler keeps the last.
          *
          * @param[out] byte - pointer to array to add to parseBuffer
          * @return     full message compiled
@@ -135,14 +242,103 @@ class MessageHandler
          */
         bool parseBytes(uint8_t* buffer, uint32_t size, uint8_t** remainingBuffer);
 
+        /*
+         * @brief: Parse a block of bytes, scanning for the key signature and skipping over payloads
+         *         Produces the same messages as feeding each byte to parseByte, and carries a
+         *         partially received message over to the next call.
+         *         Messages that verify but fail to decode are reported and passed over; once that
+         *         has used limit bytes, the search stops there, so a caller parsing up to a known
+         *         message end does not run on past it. Bytes past limit are still read to settle a
+         *         message that starts before it.
+         *
+         * @param[in]  buffer   - pointer to the bytes to parse
+         * @param[in]  size     - number of bytes in buffer
+         * @param[out] consumed - number of bytes used from buffer; less than size when a message completes early
+         * @param[in]  limit    - bytes after which no further message is searched for
+         * @return     full message compiled
+         */
+        bool parseBlock(const uint8_t* buffer, size_t size, size_t* consumed, size_t limit = SIZE_MAX);
+
+        /*
+         * @brief: Find the next message in a block of bytes without decoding or copying its payload
+         *         The header and checksums are verified; the payload is left for the caller to decode
+         *         through the view. When the message is contiguous in buffer the view points into
+         *         buffer, otherwise it points into the handler's parse buffer. Either way it is only
+         *         valid until the next parse call.
+         *         After a message fails validation, scanning resumes one byte past its key signature,
+         *         so a message that starts inside the rejected bytes is still found. This can return
+         *         a message held back from an earlier block with nothing consumed from buffer.
+         *
+         * @param[in]  buffer   - pointer to the bytes to parse
+         * @param[in]  size     - number of bytes in buffer
+         * @param[out] consumed - number of bytes used from buffer; less than size when a message completes early
+         * @param[out] view     - the message found
+         * @return     full message found
+         */
+        bool parseView(const uint8_t* buffer, size_t size, size_t* consumed, MessageView* view);
+
+        /*
+         * @brief: Parse every message in a block of bytes into a batch
+         *         Each message is decoded and reported as parseBlock would, then added to the
+         *         end of batch; a partially received message at the end is carried over to the
+         *         next call. Payloads are handed over to the batch, so getPayloadJson returns
+         *         NULL afterward.
+         *
+         * @param buffer - pointer to the bytes to parse
+         * @param size   - number of bytes in buffer
+         * @param batch  - batch the messages are added to; it is not cleared first
+         * @return       number of messages added
+         */
+        uint32_t parseAll(const uint8_t* buffer, size_t size, MessageBatch* batch);
+
+        /*
+         * @brief Get the number of bytes that were not part of any verified message
+         *        This counts noise between messages and every byte of a rejected message
+         *        that did not turn out to belong to a later message.
+         *
+         * @return skipped byte count since the handler was created
+         */
+        uint64_t getSkippedBytes(void);
+
+        /*
+         * @brief Get where the message the last parse call returned starts in the stream
+         *
+         * @return offset of its key signature, counting every byte given to the handler
+         */
+        uint64_t getMessageOffset(void);
+
         /*
          * @brief: Serialize a message built by originally
+         *         The buffer belongs to the handler and is reused, growing only when a
+         *         message does not fit; it is valid until the next call.
          *
          * @param[out] bufferPtr - this is a double pointer to be able return a new pointer to the raw
          * @return     size      - serialization size
          */
         uint32_t getSerialized(uint8_t** buffer);
 
+        /*
+         * @brief: Serialize the message into a buffer the caller provides, without allocating
+         *         Nothing is written unless the whole message fits.
+         *
+         * @param buffer   - where the message goes
+         * @param capacity - number of bytes in buffer
+         * @return         serialization size; more than capacity when the message did not fit
+         */
+        uint32_t serializeInto(uint8_t* buffer, size_t capacity);
+
+        /*
+         * @brief: Serialize the message as a gather list for writev, with the checksums computed in place
+         *         The prefix and header go in the handler's serialize buffer. A payload the message
+         *         already holds as it goes out, such as JSON given to setPayloadJson, is referenced
+         *         where it is, followed by any zero padding; any other payload is encoded after the
+         *         header. The vectors stay valid until the message changes or is serialized again.
+         *
+         * @param[out] vectors - messageHandler_maxSerializedVectors entries
+         * @return     number of vectors filled, 0 if the serialize buffer could not be allocated
+         */
+        uint32_t getSerializedVectors(struct iovec* vectors);
+
         /*
          * @brief Set the hearbeat member of the message
          *        This will also set the message type to heartbeat.
@@ -183,6 +379,21 @@ class MessageHandler
          */
         char* getPayloadJsonString(void);
 
+        /*
+         * @brief retrieve the JSON payload tree of the message; it stays owned by the message
+         *        The tree is parsed from the payload text on the first call.
+         *
+         * @return JSON tree, NULL if the message holds no JSON payload or it is not valid JSON
+         */
+        cJSON* getPayloadJson(void);
+
+        /*
+         * @brief retrieve the decoded payload of the message; JSON text and tree in it stay owned by the message
+         *
+         * @param[out] payload - payload, as read by the message type of getCommandCode
+         */
+        void getPayload(MessageHandler_Payload* payload);
+
         /*
          * @brief set the message type to enable/disable standby state
          *
@@ -204,6 +415,20 @@ class MessageHandler
          */
         uint16_t getPayloadLength(void);
 
+        /*
+         * @brief Get the header checksum received with, or generated for, the message
+         *
+         * @return header checksum
+         */
+        uint16_t getHeaderChecksum(void);
+
+        /*
+         * @brief Get the payload checksum received with, or generated for, the message
+         *
+         * @return payload checksum
+         */
+        uint16_t getPayloadChecksum(void);
+
         /*
          * @brief Retrieve the command code that specifies the message data type
          *
@@ -226,11 +451,145 @@ class MessageHandler
         void getMessageProperties(MessageHandler_MessageProperties* properties);
 
     private:
+        /*
+         * @brief Validate the prefix and header fields up through the command code
+         *
+         * @param frame - pointer to at least fieldIndex_payloadSize bytes of a message
+         * @return      status of the command code
+         */
+        MessageHandler_Status checkCommandCode(const uint8_t* frame);
+
+        /*
+         * @brief Validate the payload length and header checksum
+         *
+         * @param frame - pointer to at least fieldIndex_payload bytes of a message
+         * @return      status of the header
+         */
+        MessageHandler_Status checkHeader(const uint8_t* frame);
+
+        /*
+         * @brief Scan one block of bytes for the next message
+         *        When a message that began in an earlier block is rejected, its bytes after the key
+         *        signature are held in resyncData and the scan stops with *consumed set to 0,
+         *        so they can be rescanned ahead of this block.
+         *
+         * @param[in]  buffer   - pointer to the bytes to scan
+         * @param[in]  size     - number of bytes in buffer
+         * @param[out] consumed - number of bytes used from buffer
+         * @param[out] view     - the message found
+         * @return     full message found
+         */
+        bool scanBlock(const uint8_t* buffer, size_t size, size_t* consumed, MessageView* view);
+
+        /*
+         * @brief Add a single byte to frameBuffer and validate each field as it completes
+         *
+         * @param byte - next byte of the stream
+         * @return     a message with a verified payload checksum is in frameBuffer
+         */
+        bool acceptByte(uint8_t byte);
+
+        /*
+         * @brief Check the payload checksum of a message whose header passed checkHeader
+         *        This ends the message in frameBuffer either way.
+         *
+         * @param payloadChecksum - checksum of the header.payloadLength bytes of payload received
+         * @return                payload checksum valid
+         */
+        bool verifyPayload(uint16_t payloadChecksum);
+
+        /*
+         * @brief Decode a verified payload into the message
+         *
+         * @param view - the verified message
+         * @return     full message valid
+         */
+        bool decodePayload(MessageView* view);
+
+        /*
+         * @brief Report a message that failed validation to the sink
+         *
+         * @param status           - what failed
+         * @param computedChecksum - checksum calculated over the received bytes, for checksum errors
+         * @param view             - the whole message, when it was received
+         */
+        void reportError(MessageHandler_Status status, uint16_t computedChecksum, MessageView* view);
+
+        /*
+         * @brief Replace the JSON payload with the tree parsed from jsonString and the text it prints to
+         *
+         * @param jsonString - NUL terminated JSON string
+         * @return           JSON valid
+         */
+        bool decodePayloadJson(const char* jsonString);
+
+        /*
+         * @brief Write the key signature, header and header checksum at the start of frame
+         *
+         * @param frame - at least fieldIndex_payload bytes
+         */
+        void encodeHeader(uint8_t* frame);
+
+        /*
+         * @brief Make serializedMessage hold at least size bytes; what it held is lost when it grows
+         *
+         * @param size - bytes needed
+         * @return     serializedMessage is large enough
+         */
+        bool reserveSerialized(uint32_t size);
+
+        /*
+         * @brief Make frameBuffer hold at least size bytes, keeping the parseIndex bytes already in it
+         *        Messages that fit parseBuffer never touch the pool.
+         *
+         * @param size - bytes needed
+         * @return     frameBuffer is large enough
+         */
+        bool reserveFrameBuffer(uint32_t size);
+
+        /*
+         * @brief Return a pooled frameBuffer and go back to parseBuffer
+         */
+        void releaseFrameBuffer(void);
+
+        /*
+         * @brief Return a pooled resyncData and go back to resyncBuffer
+         */
+        void releaseResyncBuffer(void);
+
+        /*
+         * @brief Release anything owned by the current payload before it is overwritten
+         */
+        void releasePayload(void);
+
+        /*
+         * @brief The message being received; frameBuffer is parseBuffer unless
+         *        the message is too large for it, then it comes from framePool.
+         *        payloadSum is the checksum of the payload bytes in it so far, kept
+         *        as they arrive so the last byte does not cost a pass over the payload.
+         */
         uint8_t               parseBuffer[parseBufferSize];
+        uint8_t*              frameBuffer;
+        uint32_t              frameBufferSize;
         uint32_t              parseIndex;
+        uint16_t              payloadSum;
+        FramePool*            framePool;
+
+        /*
+         * @brief Bytes of a rejected message still to be rescanned, and stream accounting
+         */
+        uint8_t               resyncBuffer[parseBufferSize];
+        uint8_t*              resyncData;
+        uint32_t              resyncDataSize;
+        uint32_t              resyncIndex;
+        uint32_t              resyncCount;
+        uint64_t              streamOffset;
+        uint64_t              messageOffset;
+        uint64_t              messageBytes;
+        uint64_t              reportedSkippedBytes;
 
         uint8_t*              serializedMessage;
-        uint32_t              serializedSize;
+        uint32_t              serializedCapacity;
 
         /*
          * @brief These are all of the fields that make up a message
@@ -241,6 +600,12 @@ class MessageHandler
 
         MessageHandler_Header header;
         MessageHandler_Payload payload;
+        uint16_t              payloadType;
+
+        MessageSink*          sink;
+        bool                  discardEvents;    /* sink is the null sink, so per-frame events are not sent */
+        DeviceTable*          deviceTable;
+        MessageHandler_JsonValidation jsonValidation;
 };
 
 
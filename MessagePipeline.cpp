@@ -0,0 +1,371 @@
+/* MessagePipeline.cpp
+ *
+ * This implements a class that parses a capture on reader, parser and consumer
+ *   threads linked by SpscRings.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "MessagePipeline.h"
+
+#include <assert.h>     /* assert */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+
+
+
+/*
+ * @brief How long a stage spins before it yields, and yields before it sleeps
+ */
+enum
+{
+    backOff_spinCount  = 64,
+    backOff_yieldCount = 128,
+    backOff_sleepTime  = 50,    /* microseconds */
+};
+
+/*
+* @brief Wait a little longer each time a stage finds nothing to do
+*
+* @param attempt - number of times in a row the stage has waited
+*/
+static void backOff(uint32_t attempt)
+{
+    if( attempt < backOff_spinCount )
+        return;
+
+    if( attempt < backOff_yieldCount )
+        this_thread::yield();
+    else
+        this_thread::sleep_for(chrono::microseconds(backOff_sleepTime));
+}
+
+
+
+MessagePipeline::MessagePipeline()
+{
+    this->sinkFactory    = NULL;
+    this->sinkContext    = NULL;
+    this->jsonValidation = messageHandler_jsonStructural;
+    this->outputStream   = NULL;
+
+    this->pendingOutput.data     = NULL;
+    this->pendingOutput.size     = 0;
+    this->pendingOutput.capacity = 0;
+
+    for(uint32_t i = 0; i < messagePipeline_bufferCount; i++)
+    {
+        this->buffers[i].data     = NULL;
+        this->buffers[i].size     = 0;
+        this->buffers[i].capacity = 0;
+    }
+
+    memset(&this->stats, 0, sizeof(this->stats));
+}
+
+MessagePipeline::~MessagePipeline()
+{
+    for(uint32_t i = 0; i < messagePipeline_bufferCount; i++)
+    {
+        if( this->buffers[i].data )
+            free(this->buffers[i].data);
+    }
+}
+
+/*
+* @brief Set how the parser's sink is made; without a factory every event
+*        is discarded and nothing is written
+*
+* @param factory - sink factory, NULL to discard every event
+* @param context - passed to factory
+*/
+void MessagePipeline::setSinkFactory(MessageSink_Factory factory, void* context)
+{
+    this->sinkFactory = factory;
+    this->sinkContext = context;
+}
+
+/*
+* @brief Set how Set Sar Mode payloads are checked as they are decoded
+*
+* @param jsonValidation - check to make; messageHandler_jsonStructural by default
+*/
+void MessagePipeline::setJsonValidation(MessageHandler_JsonValidation jsonValidation)
+{
+    this->jsonValidation = jsonValidation;
+}
+
+/*
+* @brief Parse a capture from its current position to the end
+*
+* @param capture - an open capture
+* @param output  - where sink output is written; may be NULL without a factory
+* @return        number of messages parsed and decoded, as counted from parseBlock
+*/
+uint64_t MessagePipeline::run(CaptureFile* capture, FILE* output)
+{
+    assert( capture );
+    assert( output || this->sinkFactory == NULL );
+
+    memset(&this->stats, 0, sizeof(this->stats));
+
+    for(uint32_t i = 0; i < messagePipeline_bufferCount; i++)
+    {
+        if( this->buffers[i].data == NULL )
+        {
+            this->buffers[i].data     = (uint8_t*)malloc(messagePipeline_bufferSize);
+            this->buffers[i].capacity = messagePipeline_bufferSize;
+
+            if( this->buffers[i].data == NULL )
+                return 0;
+        }
+
+        this->freeRing.push(this->buffers[i]);
+    }
+
+    thread reader(&MessagePipeline::readerStage, this, capture);
+    thread parser(&MessagePipeline::parserStage, this);
+    thread consumer(&MessagePipeline::consumerStage, this, output);
+
+    reader.join();
+    parser.join();
+    consumer.join();
+
+    // Every buffer is back in freeRing; empty it for the next run
+    Block buffer;
+
+    while( this->freeRing.pop(&buffer) )
+    {
+    }
+
+    this->stats.inputPeakDepth  = this->inputRing.getPeakDepth();
+    this->stats.outputPeakDepth = this->outputRing.getPeakDepth();
+
+    return this->stats.messageCount;
+}
+
+/*
+* @brief Get what happened in the last run
+*
+* @param[out] stats - stage and ring statistics
+*/
+void MessagePipeline::getStats(MessagePipeline_Stats* stats)
+{
+    assert( stats );
+
+    *stats = this->stats;
+}
+
+void MessagePipeline::readerStage(CaptureFile* capture)
+{
+    const uint8_t* span;
+    size_t         spanSize;
+    Block          buffer;
+
+    while( capture->nextSpan(&span, &spanSize) )
+    {
+        // Hand over whatever arrived at once; on a live link a span may be only a few bytes
+        while( spanSize > 0 )
+        {
+            for(uint32_t attempt = 0; !this->freeRing.pop(&buffer); attempt++)
+            {
+                if( attempt == 0 )
+                    this->stats.readerStalls++;
+
+                backOff(attempt);
+            }
+
+            buffer.size = (spanSize < buffer.capacity) ? spanSize : buffer.capacity;
+            memcpy(buffer.data, span, buffer.size);
+
+            span     += buffer.size;
+            spanSize -= buffer.size;
+
+            this->stats.bytesRead += buffer.size;
+
+            // There are only as many buffers as slots, so this always has room
+            this->inputRing.push(buffer);
+        }
+    }
+
+    buffer.data = NULL;
+    buffer.size = 0;
+
+    for(uint32_t attempt = 0; !this->inputRing.push(buffer); attempt++)
+        backOff(attempt);
+}
+
+void MessagePipeline::parserStage(void)
+{
+    MessageHandler handler;
+    MessageSink*   sink = NULL;
+
+    if( this->sinkFactory )
+    {
+        cookie_io_functions_t functions = { NULL, MessagePipeline::writeOutput, NULL, NULL };
+
+        this->outputStream = fopencookie(this, "w", functions);
+
+        if( this->outputStream )
+        {
+            setvbuf(this->outputStream, NULL, _IOFBF, messagePipeline_outputBufferSize);
+            sink = this->sinkFactory(this->outputStream, this->sinkContext);
+        }
+    }
+
+    handler.setSink(sink);
+    handler.setJsonValidation(this->jsonValidation);
+
+    while( true )
+    {
+        Block buffer;
+
+        for(uint32_t attempt = 0; !this->inputRing.pop(&buffer); attempt++)
+        {
+            if( attempt == 0 )
+            {
+                // Nothing to parse, so let what has been parsed reach the consumer now
+                this->stats.parserIdles++;
+                this->flushOutput(false);
+            }
+
+            backOff(attempt);
+        }
+
+        if( buffer.data == NULL )
+            break;
+
+        const uint8_t* block     = buffer.data;
+        size_t         remaining = buffer.size;
+
+        while( remaining > 0 )
+        {
+            size_t consumed;
+
+            if( handler.parseBlock(block, remaining, &consumed) )
+                this->stats.messageCount++;
+
+            block     += consumed;
+            remaining -= consumed;
+        }
+
+        this->freeRing.push(buffer);
+
+        this->flushOutput(false);
+    }
+
+    handler.setSink(NULL);
+    delete sink;
+
+    if( this->outputStream )
+    {
+        fclose(this->outputStream);
+        this->outputStream = NULL;
+    }
+
+    this->flushOutput(true);
+
+    Block end = { NULL, 0, 0 };
+
+    for(uint32_t attempt = 0; !this->outputRing.push(end); attempt++)
+        backOff(attempt);
+}
+
+void MessagePipeline::consumerStage(FILE* output)
+{
+    while( true )
+    {
+        Block block;
+
+        for(uint32_t attempt = 0; !this->outputRing.pop(&block); attempt++)
+        {
+            // Caught up; push out what has been written so far
+            if( attempt == 0 && output )
+                fflush(output);
+
+            backOff(attempt);
+        }
+
+        if( block.data == NULL )
+            break;
+
+        fwrite(block.data, 1, block.size, output);
+        free(block.data);
+    }
+
+    if( output )
+        fflush(output);
+}
+
+/*
+* @brief Hand the output written so far to the consumer
+*
+* @param wait - wait for room in the output ring even with little output held back
+*/
+void MessagePipeline::flushOutput(bool wait)
+{
+    if( this->outputStream )
+        fflush(this->outputStream);
+
+    if( this->pendingOutput.size == 0 )
+        return;
+
+    if( !this->outputRing.push(this->pendingOutput) )
+    {
+        if( !wait && this->pendingOutput.size < messagePipeline_maxPendingOutput )
+        {
+            this->stats.outputDeferrals++;
+            return;
+        }
+
+        this->stats.parserStalls++;
+
+        for(uint32_t attempt = 0; !this->outputRing.push(this->pendingOutput); attempt++)
+            backOff(attempt);
+    }
+
+    this->pendingOutput.data     = NULL;
+    this->pendingOutput.size     = 0;
+    this->pendingOutput.capacity = 0;
+}
+
+/*
+* @brief fopencookie write function appending to pendingOutput
+*/
+ssize_t MessagePipeline::writeOutput(void* cookie, const char* data, size_t size)
+{
+    MessagePipeline* pipeline = (MessagePipeline*)cookie;
+    Block*           pending  = &pipeline->pendingOutput;
+
+    if( pending->size + size > pending->capacity )
+    {
+        size_t   capacity = pending->capacity ? pending->capacity : messagePipeline_bufferSize;
+        uint8_t* grown;
+
+        while( capacity < pending->size + size )
+            capacity *= 2;
+
+        grown = (uint8_t*)realloc(pending->data, capacity);
+        if( grown == NULL )
+            return 0;
+
+        pending->data     = grown;
+        pending->capacity = capacity;
+    }
+
+    memcpy(&pending->data[pending->size], data, size);
+    pending->size += size;
+
+    return (ssize_t)size;
+}
+
+
+
+// EOF
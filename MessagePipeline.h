@@ -0,0 +1,144 @@
+/* MessagePipeline.h
+ *
+ * This defines a class that parses a capture on three threads linked by SpscRings:
+ *   reader   - copies the capture into a fixed set of large buffers
+ *   parser   - frames and decodes the buffers with one MessageHandler, its sink
+ *              writing into output blocks in memory
+ *   consumer - writes the output blocks out
+ *
+ *   Input buffers circulate between the reader and the parser, so a parser that
+ *   falls behind holds the reader back. The parser never waits on a slow consumer
+ *   while it has less than messagePipeline_maxPendingOutput bytes of output held
+ *   back; it keeps adding to the block it cannot hand over yet instead.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef MessagePipeline_h
+#define MessagePipeline_h
+
+#include "MessageHandler.h"
+#include "MessageSink.h"
+#include "CaptureFile.h"
+#include "SpscRing.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+
+/*
+ * @brief buffer and ring sizes
+ */
+enum
+{
+    messagePipeline_bufferSize       = 1024 * 1024,
+    messagePipeline_bufferCount      = 8,
+    messagePipeline_outputRingSize   = 8,
+    messagePipeline_outputBufferSize = 64 * 1024,         /* stdio buffer in front of the output blocks */
+    messagePipeline_maxPendingOutput = 64 * 1024 * 1024,
+};
+
+/*
+ * @brief what each stage waited on, and how full the rings got
+ */
+typedef struct
+{
+    uint64_t bytesRead;
+    uint64_t messageCount;
+    uint64_t readerStalls;      /* times the reader waited for the parser to free a buffer */
+    uint64_t parserIdles;       /* times the parser waited for input */
+    uint64_t outputDeferrals;   /* times the output ring was full and the parser kept buffering */
+    uint64_t parserStalls;      /* times the parser waited for the consumer with too much output held */
+    uint32_t inputPeakDepth;
+    uint32_t outputPeakDepth;
+} MessagePipeline_Stats;
+
+
+
+class MessagePipeline
+{
+    public:
+
+        MessagePipeline();
+        ~MessagePipeline();
+
+        /*
+         * @brief Set how the parser's sink is made; without a factory every event
+         *        is discarded and nothing is written
+         *
+         * @param factory - sink factory, NULL to discard every event
+         * @param context - passed to factory
+         */
+        void setSinkFactory(MessageSink_Factory factory, void* context);
+
+        /*
+         * @brief Set how Set Sar Mode payloads are checked as they are decoded
+         *
+         * @param jsonValidation - check to make; messageHandler_jsonStructural by default
+         */
+        void setJsonValidation(MessageHandler_JsonValidation jsonValidation);
+
+        /*
+         * @brief Parse a capture from its current position to the end
+         *
+         * @param capture - an open capture
+         * @param output  - where sink output is written; may be NULL without a factory
+         * @return        number of messages parsed and decoded, as counted from parseBlock
+         */
+        uint64_t run(CaptureFile* capture, FILE* output);
+
+        /*
+         * @brief Get what happened in the last run
+         *
+         * @param[out] stats - stage and ring statistics
+         */
+        void getStats(MessagePipeline_Stats* stats);
+
+    private:
+        /*
+         * @brief An input buffer or an output block; data is NULL at the end of the stream
+         */
+        typedef struct
+        {
+            uint8_t* data;
+            size_t   size;
+            size_t   capacity;
+        } Block;
+
+        /*
+         * @brief Thread bodies for the three stages
+         */
+        void readerStage(CaptureFile* capture);
+        void parserStage(void);
+        void consumerStage(FILE* output);
+
+        /*
+         * @brief Hand the output written so far to the consumer
+         *
+         * @param wait - wait for room in the output ring even with little output held back
+         */
+        void flushOutput(bool wait);
+
+        /*
+         * @brief fopencookie write function appending to pendingOutput
+         */
+        static ssize_t writeOutput(void* cookie, const char* data, size_t size);
+
+        SpscRing<Block, messagePipeline_bufferCount>    freeRing;
+        SpscRing<Block, messagePipeline_bufferCount>    inputRing;
+        SpscRing<Block, messagePipeline_outputRingSize> outputRing;
+        Block                                           buffers[messagePipeline_bufferCount];
+
+        MessageSink_Factory                             sinkFactory;
+        void*                                           sinkContext;
+        MessageHandler_JsonValidation                   jsonValidation;
+        FILE*                                           outputStream;
+        Block                                           pendingOutput;
+
+        MessagePipeline_Stats                           stats;
+};
+
+
+#endif // MessagePipeline_h
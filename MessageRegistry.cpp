@@ -0,0 +1,362 @@
+/* MessageRegistry.cpp
+ *
+ * This implements the message types MessageHandler knows and builds their table.
+ *   To add a type, define a struct like the ones below and add it to KnownMessageTypes.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "MessageRegistry.h"
+#include "FrameCodec.h"
+#include "JsonArena.h"
+#include "JsonValidator.h"
+#include "cJSON.h"
+
+#include <assert.h>     /* assert */
+#include <stdio.h>      /* fprintf */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+
+/*
+ * @brief Print a JSON payload into scratch, parsing its text there if it holds no tree yet
+ *
+ * @return text, NULL if there is no valid JSON to print
+ */
+static char* printJsonPayload(const MessageHandler_JsonPayload* json, JsonArena* scratch, bool formatted)
+{
+    cJSON* tree = json->tree;
+
+    if( tree == NULL && json->text )
+        tree = scratch->parse(json->text);
+
+    return tree ? scratch->print(tree, formatted) : NULL;
+}
+
+/*
+ * @brief Set Sar Mode; the payload is JSON text of any length, held as received and
+ *        parsed into a cJSON tree only when something asks for one. Text and tree
+ *        are allocated from one JsonArena per message.
+ */
+struct SetSarModeMessage
+{
+    static constexpr uint16_t              commandCode       = MESSAGE_HANDLER_COMMAND_SETSARMODE;
+    static constexpr uint16_t              minPayloadSize    = 0;
+    static constexpr uint16_t              maxPayloadSize    = UINT16_MAX;
+    static constexpr bool                  terminatedPayload = true;
+    static constexpr MessageHandler_Status decodeError       = messageHandler_statusInvalidJson;
+    static constexpr const char*           name              = "Set Sar Mode";
+
+    static bool decode(const uint8_t* bytes, uint16_t length, MessageHandler_JsonValidation jsonValidation, MessageHandler_Payload* payload)
+    {
+        MessageHandler_JsonPayload* json = &payload->json;
+
+        json->text    = NULL;
+        json->tree    = NULL;
+        json->arena   = NULL;
+        json->printed = false;
+
+        if( jsonValidation == messageHandler_jsonStructural && !isJsonStructureValid((const char*)bytes) )
+            return false;
+
+        json->arena = JsonArena::create(length);
+
+        if( json->arena == NULL )
+            return false;
+
+        json->text = json->arena->copyText((const char*)bytes, length);
+
+        if( json->text == NULL )
+            return false;
+
+        if( jsonValidation == messageHandler_jsonParse )
+        {
+            json->tree = json->arena->parse(json->text);
+
+            return json->tree != NULL;
+        }
+
+        return true;
+    }
+
+    static void encode(const MessageHandler_Payload* payload, uint8_t* bytes, uint16_t length)
+    {
+        if( payload->json.printed )
+        {
+            strncpy((char*)bytes, payload->json.text, length);
+            return;
+        }
+
+        JsonArena* scratch = JsonArena::getScratch();
+        cJSON*     tree    = payload->json.tree;
+
+        if( tree == NULL && payload->json.text && scratch )
+            tree = scratch->parse(payload->json.text);
+
+        // The payload is the unformatted JSON cut off or zero padded to length; print it
+        // straight into place when it fits with its NUL, through scratch when it does not
+        if( tree && length > 0 && cJSON_PrintPreallocated(tree, (char*)bytes, length, false) )
+        {
+            size_t printed = strlen((const char*)bytes);
+
+            memset(&bytes[printed], 0, length - printed);
+        }
+        else
+        {
+            char* string = (tree && scratch) ? scratch->print(tree, false) : NULL;
+
+            strncpy((char*)bytes, string ? string : "", length);
+        }
+
+        if( scratch )
+            scratch->reset();
+    }
+
+    static const uint8_t* reference(const MessageHandler_Payload* payload, uint16_t length, uint16_t* size)
+    {
+        if( !payload->json.printed )
+            return NULL;
+
+        *size = (uint16_t)strnlen(payload->json.text, length);
+
+        return (const uint8_t*)payload->json.text;
+    }
+
+    static void print(FILE* stream, const MessageHandler_Payload* payload)
+    {
+        JsonArena* scratch = JsonArena::getScratch();
+        char*      string  = scratch ? printJsonPayload(&payload->json, scratch, true) : NULL;
+
+        if( string )
+        {
+            fprintf(stream, "%s\n", string);
+        }
+        else if( payload->json.text )
+        {
+            // Only unchecked text gets here
+            fprintf(stream, "%s\n", payload->json.text);
+        }
+
+        if( scratch )
+            scratch->reset();
+    }
+
+    static void release(MessageHandler_Payload* payload)
+    {
+        JsonArena::destroy(payload->json.arena);
+
+        payload->json.text    = NULL;
+        payload->json.tree    = NULL;
+        payload->json.arena   = NULL;
+        payload->json.printed = false;
+    }
+};
+
+/*
+ * @brief Set Standby State; the payload is one byte, non-zero to enable standby
+ */
+struct SetStandbyStateMessage
+{
+    static constexpr uint16_t              commandCode       = MESSAGE_HANDLER_COMMAND_SETSTANDBYSTATE;
+    static constexpr uint16_t              minPayloadSize    = sizeof(uint8_t);
+    static constexpr uint16_t              maxPayloadSize    = sizeof(uint8_t);
+    static constexpr bool                  terminatedPayload = false;
+    static constexpr MessageHandler_Status decodeError       = messageHandler_statusValid;
+    static constexpr const char*           name              = "Set Standby State";
+
+    static bool decode(const uint8_t* bytes, uint16_t length, MessageHandler_JsonValidation jsonValidation, MessageHandler_Payload* payload)
+    {
+        payload->enableStandby = bytes[0];
+
+        return true;
+    }
+
+    static void encode(const MessageHandler_Payload* payload, uint8_t* bytes, uint16_t length)
+    {
+        bytes[0] = (uint8_t)payload->enableStandby;
+    }
+
+    static const uint8_t* reference(const MessageHandler_Payload* payload, uint16_t length, uint16_t* size)
+    {
+        return NULL;
+    }
+
+    static void print(FILE* stream, const MessageHandler_Payload* payload)
+    {
+        fprintf(stream, "    Enable Standby State: %d\n", payload->enableStandby);
+    }
+
+    static void release(MessageHandler_Payload* payload)
+    {
+    }
+};
+
+/*
+ * @brief Heartbeat; the payload is a packed MessageHandler_HeartbeatPayload
+ */
+struct HeartbeatMessage
+{
+    static constexpr uint16_t              commandCode       = MESSAGE_HANDLER_COMMAND_HEARTBEAT;
+    static constexpr uint16_t              minPayloadSize    = sizeof(MessageHandler_HeartbeatPayload);
+    static constexpr uint16_t              maxPayloadSize    = sizeof(MessageHandler_HeartbeatPayload);
+    static constexpr bool                  terminatedPayload = false;
+    static constexpr MessageHandler_Status decodeError       = messageHandler_statusValid;
+    static constexpr const char*           name              = "Heartbeat";
+
+    static bool decode(const uint8_t* bytes, uint16_t length, MessageHandler_JsonValidation jsonValidation, MessageHandler_Payload* payload)
+    {
+        frameCodec_heartbeat::decode(bytes, &payload->heartbeat);
+
+        return true;
+    }
+
+    static void encode(const MessageHandler_Payload* payload, uint8_t* bytes, uint16_t length)
+    {
+        frameCodec_heartbeat::encode(&payload->heartbeat, bytes);
+    }
+
+    static const uint8_t* reference(const MessageHandler_Payload* payload, uint16_t length, uint16_t* size)
+    {
+        return NULL;
+    }
+
+    static void print(FILE* stream, const MessageHandler_Payload* payload)
+    {
+        const MessageHandler_HeartbeatPayload* heartbeat = &payload->heartbeat;
+
+        fprintf(stream, "    Heartbeat:\n");
+        fprintf(stream, "      Epoch Time:    %u seconds\n", heartbeat->epochTime_seconds);
+        fprintf(stream, "      Serial Number: 0x%x\n", heartbeat->serialNumber);
+        fprintf(stream, "      Voltage:       %d cV\n", heartbeat->voltage_cV);
+        fprintf(stream, "      Temperature:   %d degrees C\n", heartbeat->temperature_C);
+
+        if( heartbeat->mode == 0 )
+            fprintf(stream, "      Mode:          Standby\n");
+        else
+            fprintf(stream, "      Mode:          SAR\n");
+    }
+
+    static void release(MessageHandler_Payload* payload)
+    {
+    }
+};
+
+/*
+ * @brief What an unknown command code finds; it has no size rule and its payload is left alone
+ */
+struct UnknownMessage
+{
+    static constexpr uint16_t              commandCode       = 0;
+    static constexpr uint16_t              minPayloadSize    = 0;
+    static constexpr uint16_t              maxPayloadSize    = UINT16_MAX;
+    static constexpr bool                  terminatedPayload = false;
+    static constexpr MessageHandler_Status decodeError       = messageHandler_statusInvalidCommandCode;
+    static constexpr const char*           name              = "Unknown";
+
+    static bool decode(const uint8_t* bytes, uint16_t length, MessageHandler_JsonValidation jsonValidation, MessageHandler_Payload* payload)
+    {
+        return false;
+    }
+
+    static void encode(const MessageHandler_Payload* payload, uint8_t* bytes, uint16_t length)
+    {
+        memset(bytes, 0, length);
+    }
+
+    static const uint8_t* reference(const MessageHandler_Payload* payload, uint16_t length, uint16_t* size)
+    {
+        return NULL;
+    }
+
+    static void print(FILE* stream, const MessageHandler_Payload* payload)
+    {
+    }
+
+    static void release(MessageHandler_Payload* payload)
+    {
+    }
+};
+
+
+
+/*
+ * @brief Builds the table for a list of message types at compile time
+ */
+template <typename... Types>
+struct MessageRegistry_Builder
+{
+    template <typename Type>
+    static constexpr MessageRegistry_Type describe(void)
+    {
+        return { Type::commandCode, Type::minPayloadSize, Type::maxPayloadSize, Type::terminatedPayload,
+                 Type::decodeError, Type::name,
+                 Type::decode, Type::encode, Type::reference, Type::print, Type::release };
+    }
+
+    static constexpr bool slotsUnique(void)
+    {
+        const uint16_t codes[] = { Types::commandCode... };
+
+        for(uint32_t i = 0; i < sizeof...(Types); i++)
+        {
+            for(uint32_t j = i + 1; j < sizeof...(Types); j++)
+            {
+                if( (codes[i] & messageRegistry_slotMask) == (codes[j] & messageRegistry_slotMask) )
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    static constexpr MessageRegistry_Table build(void)
+    {
+        MessageRegistry_Table      table   = {};
+        const MessageRegistry_Type types[] = { describe<Types>()... };
+
+        table.unknownType = describe<UnknownMessage>();
+
+        for(uint32_t slot = 0; slot < messageRegistry_tableSize; slot++)
+        {
+            table.types[slot]             = table.unknownType;
+            table.types[slot].commandCode = (uint16_t)(slot ^ messageRegistry_slotMask);
+        }
+
+        for(const MessageRegistry_Type& type : types)
+            table.types[type.commandCode & messageRegistry_slotMask] = type;
+
+        return table;
+    }
+};
+
+typedef MessageRegistry_Builder<SetSarModeMessage, SetStandbyStateMessage, HeartbeatMessage> KnownMessageTypes;
+
+static_assert( KnownMessageTypes::slotsUnique(), "two message types share a slot; the low bytes of their command codes must differ" );
+
+constexpr MessageRegistry_Table messageRegistry = KnownMessageTypes::build();
+
+
+
+/*
+* @brief Get the tree of a JSON payload, parsing it from the payload text the first time
+*        The tree is kept in json and released with the rest of the payload.
+*
+* @param json - JSON payload
+* @return     JSON tree, NULL if the text is not valid JSON
+*/
+cJSON* loadJsonPayloadTree(MessageHandler_JsonPayload* json)
+{
+    assert( json );
+
+    if( json->tree == NULL && json->text )
+        json->tree = json->arena->parse(json->text);
+
+    return json->tree;
+}
+
+
+
+// EOF
@@ -0,0 +1,124 @@
+/* MessageRegistry.h
+ *
+ * This defines the table of message types MessageHandler knows. Each type
+ *   declares its command code, payload size rule, and how its payload is
+ *   decoded, encoded, printed and released; MessageRegistry.cpp lists the
+ *   types, and the table is built from that list at compile time.
+ *
+ *   A command code is looked up by indexing the table with its low byte and
+ *   comparing the code stored there, so finding a type, or rejecting an
+ *   unknown code, costs the same no matter how many types there are. The
+ *   build fails if two types would share a slot.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef MessageRegistry_h
+#define MessageRegistry_h
+
+#include "MessageHandler.h"
+#include <stdint.h>
+#include <stdio.h>
+
+
+
+/*
+ * @brief table size; a command code's slot is its low byte
+ */
+enum
+{
+    messageRegistry_tableSize = 256,
+    messageRegistry_slotMask  = messageRegistry_tableSize - 1,
+};
+
+/*
+ * @brief everything MessageHandler and the sinks need to know about one message type
+ *
+ *   The payload size is valid from minPayloadSize to maxPayloadSize inclusive; the
+ *   two are the same for a fixed size payload. When terminatedPayload is set, decode
+ *   is handed a payload followed by a '\0' that is not counted in length. Types without
+ *   a JSON payload ignore jsonValidation.
+ *
+ *   reference finds the payload bytes when the payload already holds them exactly as
+ *   encode would write them: *size bytes at the pointer returned, then zeros up to
+ *   length. It returns NULL when the payload has to be encoded.
+ */
+typedef struct
+{
+    uint16_t              commandCode;
+    uint16_t              minPayloadSize;
+    uint16_t              maxPayloadSize;
+    bool                  terminatedPayload;
+    MessageHandler_Status decodeError;      /* reported when decode fails */
+    const char*           name;
+
+    bool (*decode)(const uint8_t* bytes, uint16_t length, MessageHandler_JsonValidation jsonValidation, MessageHandler_Payload* payload);
+    void (*encode)(const MessageHandler_Payload* payload, uint8_t* bytes, uint16_t length);
+    const uint8_t* (*reference)(const MessageHandler_Payload* payload, uint16_t length, uint16_t* size);
+    void (*print)(FILE* stream, const MessageHandler_Payload* payload);
+    void (*release)(MessageHandler_Payload* payload);
+} MessageRegistry_Type;
+
+/*
+ * @brief the table; slots no type uses hold unknownType with a command code
+ *        that can never hash to the slot, so the compare in findMessageType fails
+ */
+typedef struct
+{
+    MessageRegistry_Type types[messageRegistry_tableSize];
+    MessageRegistry_Type unknownType;
+} MessageRegistry_Table;
+
+extern const MessageRegistry_Table messageRegistry;
+
+
+
+/*
+ * @brief Check whether a command code belongs to a known message type
+ *
+ * @param commandCode - command code to check
+ * @return            command code known
+ */
+static inline bool isMessageTypeKnown(uint16_t commandCode)
+{
+    return messageRegistry.types[commandCode & messageRegistry_slotMask].commandCode == commandCode;
+}
+
+/*
+ * @brief Find the message type for a command code
+ *
+ * @param commandCode - command code to look up
+ * @return            the message type, messageRegistry.unknownType for an unknown code
+ */
+static inline const MessageRegistry_Type* findMessageType(uint16_t commandCode)
+{
+    const MessageRegistry_Type* type = &messageRegistry.types[commandCode & messageRegistry_slotMask];
+
+    return (type->commandCode == commandCode) ? type : &messageRegistry.unknownType;
+}
+
+/*
+ * @brief Check a payload length against a message type's size rule
+ *
+ * @param type   - message type
+ * @param length - payload length
+ * @return       payload length valid
+ */
+static inline bool isPayloadSizeValid(const MessageRegistry_Type* type, uint16_t length)
+{
+    // Lengths below the minimum wrap around past the range
+    return (uint16_t)(length - type->minPayloadSize) <= (uint16_t)(type->maxPayloadSize - type->minPayloadSize);
+}
+
+/*
+ * @brief Get the tree of a JSON payload, parsing it from the payload text the first time
+ *        The tree is kept in json and released with the rest of the payload.
+ *
+ * @param json - JSON payload
+ * @return     JSON tree, NULL if the text is not valid JSON
+ */
+cJSON* loadJsonPayloadTree(MessageHandler_JsonPayload* json);
+
+
+#endif // MessageRegistry_h
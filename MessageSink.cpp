@@ -0,0 +1,283 @@
+/* MessageSink.cpp
+ *
+ * This implements the parse event sinks that ship with MessageHandler.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "MessageSink.h"
+#include "MessageView.h"
+#include "MessageRegistry.h"
+
+#include <stdio.h>      /* fprintf */
+#include <assert.h>     /* assert */
+#include <stdlib.h>
+#include <stdint.h>
+
+
+
+static uint8_t* writeLittle16(uint8_t* bytes, uint16_t value)
+{
+    assert( bytes );
+
+    bytes[0] = (uint8_t)(value & 0xFF);
+    bytes[1] = (uint8_t)((value >> 8) & 0xFF);
+
+    return bytes + sizeof(uint16_t);
+}
+
+
+
+static uint8_t* writeLittle32(uint8_t* bytes, uint32_t value)
+{
+    assert( bytes );
+
+    bytes[0] = (uint8_t)(value & 0xFF);
+    bytes[1] = (uint8_t)((value >> 8) & 0xFF);
+    bytes[2] = (uint8_t)((value >> 16) & 0xFF);
+    bytes[3] = (uint8_t)((value >> 24) & 0xFF);
+
+    return bytes + sizeof(uint32_t);
+}
+
+
+
+MessageSink::~MessageSink()
+{
+}
+
+
+
+void MessageNullSink::frameStart(MessageHandler_Header* header, uint16_t headerChecksum, uint16_t payloadChecksum)
+{
+}
+
+void MessageNullSink::headerDecoded(MessageHandler_Header* header)
+{
+}
+
+void MessageNullSink::frameError(MessageSink_Error* error)
+{
+}
+
+void MessageNullSink::bytesSkipped(uint64_t count)
+{
+}
+
+void MessageNullSink::frameComplete(MessageHandler* message, MessageView* view)
+{
+}
+
+
+
+MessageTextSink::MessageTextSink(FILE* stream)
+{
+    assert( stream );
+
+    this->stream = stream;
+}
+
+void MessageTextSink::frameStart(MessageHandler_Header* header, uint16_t headerChecksum, uint16_t payloadChecksum)
+{
+    assert( header );
+
+    fprintf(this->stream, "Receiving Message:\n");
+    fprintf(this->stream, "  Key Signature:    TT\n");
+    fprintf(this->stream, "  Header Checksum:  0x%x\n", headerChecksum);
+    fprintf(this->stream, "  Payload Checksum: 0x%x\n", payloadChecksum);
+    fprintf(this->stream, "  Header:\n");
+
+    this->printMessageProperties(&header->properties);
+}
+
+void MessageTextSink::headerDecoded(MessageHandler_Header* header)
+{
+    assert( header );
+
+    fprintf(this->stream, "    Command Code:   0x%04X\r\n", header->commandCode);
+    fprintf(this->stream, "    Payload Length: %u\n", header->payloadLength);
+}
+
+void MessageTextSink::frameError(MessageSink_Error* error)
+{
+    assert( error );
+
+    switch( error->status )
+    {
+        case messageHandler_statusInvalidCommandCode:
+            fprintf(this->stream, "Error - Invalid command code: 0x%04X\r\n\r\n", error->header->commandCode);
+            break;
+
+        case messageHandler_statusInvalidPayloadSize:
+        {
+            const MessageRegistry_Type* type = findMessageType(error->header->commandCode);
+
+            if( type->minPayloadSize == type->maxPayloadSize )
+                fprintf(this->stream, "Error - invalid payload size for \"%s\" message\r\n\r\n", type->name);
+            else
+                fprintf(this->stream, "Error - invalid payload size %u\r\n\r\n", error->header->payloadLength);
+            break;
+        }
+
+        case messageHandler_statusInvalidHeaderChecksum:
+            fprintf(this->stream, "Error - invalid header checksum; discontinuing parse\r\n\r\n");
+            break;
+
+        case messageHandler_statusInvalidPayloadChecksum:
+            fprintf(this->stream, "Error - invalid payload checksum (0x%X != 0x%X)\r\n\r\n", error->computedChecksum, error->receivedChecksum);
+            break;
+
+        case messageHandler_statusInvalidJson:
+            fprintf(this->stream, "JSON invalid\n");
+            fprintf(this->stream, "Error - invalid JSON in \"Set Sar Mode\" message\r\n");
+            if( error->view )
+            {
+                fprintf(this->stream, "\n  %.*s\n", error->view->getPayloadLength(), (const char*)error->view->getPayload());
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+void MessageTextSink::bytesSkipped(uint64_t count)
+{
+    // Not part of the text output; the errors already describe what was dropped
+}
+
+void MessageTextSink::frameComplete(MessageHandler* message, MessageView* view)
+{
+    assert( message );
+
+    this->printPayload(message);
+}
+
+/*
+* @brief Outputs a whole message in human-readable format
+*
+* @param message - message to print
+*/
+void MessageTextSink::printMessage(MessageHandler* message)
+{
+    assert( message );
+
+    MessageHandler_MessageProperties properties;
+    message->getMessageProperties(&properties);
+
+    fprintf(this->stream, "Message:\n");
+    fprintf(this->stream, "  Key Signature:    TT\n");
+    fprintf(this->stream, "  Header Checksum:  0x%x\n", message->getHeaderChecksum());
+    fprintf(this->stream, "  Payload Checksum: 0x%x\n", message->getPayloadChecksum());
+    fprintf(this->stream, "  Header:\n");
+    this->printMessageProperties(&properties);
+    fprintf(this->stream, "    Command Code:   0x%x\n", message->getCommandCode());
+    fprintf(this->stream, "    Payload Length: %u\n", message->getPayloadLength());
+
+    this->printPayload(message);
+}
+
+void MessageTextSink::printMessageProperties(MessageHandler_MessageProperties* messageProperties)
+{
+    assert( messageProperties );
+
+    fprintf(this->stream, "    Message Properties: 0x%04X\r\n", messageProperties->value);
+    fprintf(this->stream, "      priority:       %d\r\n", messageProperties->priority);
+    fprintf(this->stream, "      ackDesignation: %d\r\n", messageProperties->ackDesignation);
+    fprintf(this->stream, "      version:        %d\r\n", messageProperties->version);
+}
+
+void MessageTextSink::printPayload(MessageHandler* message)
+{
+    fprintf(this->stream, "  Payload:\n");
+
+    MessageHandler_Payload payload;
+    message->getPayload(&payload);
+
+    findMessageType(message->getCommandCode())->print(this->stream, &payload);
+}
+
+
+
+MessageBinarySink::MessageBinarySink(FILE* stream)
+{
+    assert( stream );
+
+    this->stream          = stream;
+    this->headerChecksum  = 0;
+    this->payloadChecksum = 0;
+}
+
+void MessageBinarySink::frameStart(MessageHandler_Header* header, uint16_t headerChecksum, uint16_t payloadChecksum)
+{
+    this->headerChecksum  = headerChecksum;
+    this->payloadChecksum = payloadChecksum;
+
+    this->writeRecord(messageSink_recordFrameStart, messageHandler_statusValid, header, 0, NULL, 0);
+}
+
+void MessageBinarySink::headerDecoded(MessageHandler_Header* header)
+{
+    this->writeRecord(messageSink_recordHeaderDecoded, messageHandler_statusValid, header, 0, NULL, 0);
+}
+
+void MessageBinarySink::frameError(MessageSink_Error* error)
+{
+    assert( error );
+
+    this->writeRecord(messageSink_recordFrameError, (uint8_t)error->status, error->header, error->computedChecksum, NULL, 0);
+}
+
+void MessageBinarySink::bytesSkipped(uint64_t count)
+{
+    MessageHandler_Header header;
+    header.properties.value = 0;
+    header.commandCode      = 0;
+    header.payloadLength    = 0;
+
+    uint8_t data[sizeof(uint64_t)];
+    writeLittle32(writeLittle32(data, (uint32_t)count), (uint32_t)(count >> 32));
+
+    this->writeRecord(messageSink_recordBytesSkipped, messageHandler_statusValid, &header, 0, data, sizeof(data));
+}
+
+void MessageBinarySink::frameComplete(MessageHandler* message, MessageView* view)
+{
+    assert( view );
+
+    MessageHandler_Header header;
+    view->getMessageProperties(&header.properties);
+    header.commandCode      = view->getCommandCode();
+    header.payloadLength    = view->getPayloadLength();
+
+    this->writeRecord(messageSink_recordFrameComplete, messageHandler_statusValid, &header,
+                      view->getPayloadChecksum(), view->getFrame(), view->getFrameSize());
+}
+
+void MessageBinarySink::writeRecord(uint8_t type, uint8_t status, MessageHandler_Header* header,
+                                    uint16_t computedChecksum, const uint8_t* data, uint32_t dataSize)
+{
+    assert( header );
+
+    uint8_t  record[messageSink_recordSize];
+    uint8_t* nextPtr = record;
+
+    *nextPtr++ = type;
+    *nextPtr++ = status;
+    nextPtr    = writeLittle16(nextPtr, header->commandCode);
+    nextPtr    = writeLittle16(nextPtr, header->payloadLength);
+    nextPtr    = writeLittle16(nextPtr, this->headerChecksum);
+    nextPtr    = writeLittle16(nextPtr, this->payloadChecksum);
+    nextPtr    = writeLittle16(nextPtr, computedChecksum);
+    writeLittle32(nextPtr, dataSize);
+
+    fwrite(record, sizeof(record), 1, this->stream);
+
+    if( dataSize )
+        fwrite(data, dataSize, 1, this->stream);
+}
+
+
+
+// EOF
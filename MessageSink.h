@@ -0,0 +1,187 @@
+/* MessageSink.h
+ *
+ * This defines the interface MessageHandler reports parse events through,
+ *   along with the sinks that ship with it:
+ *     MessageNullSink   - discards every event, for pure parsing
+ *     MessageTextSink   - human-readable text, the same as the handler has always printed
+ *     MessageBinarySink - fixed size little endian records, followed by the frame for completed messages
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef MessageSink_h
+#define MessageSink_h
+
+#include "MessageHandler.h"
+#include <stdint.h>
+#include <stdio.h>
+
+class MessageView;
+
+
+
+/*
+ * @brief details of a message that failed validation
+ */
+typedef struct
+{
+    MessageHandler_Status  status;
+    MessageHandler_Header* header;
+    uint16_t               receivedChecksum;
+    uint16_t               computedChecksum;
+    MessageView*           view;               /* NULL unless the whole message was received */
+} MessageSink_Error;
+
+
+
+class MessageSink
+{
+    public:
+
+        virtual ~MessageSink();
+
+        /*
+         * @brief A key signature was found and the header through the command code was read
+         *
+         * @param header          - header; payloadLength is not decoded yet and reads 0
+         * @param headerChecksum  - header checksum as received
+         * @param payloadChecksum - payload checksum as received
+         */
+        virtual void frameStart(MessageHandler_Header* header, uint16_t headerChecksum, uint16_t payloadChecksum) = 0;
+
+        /*
+         * @brief The whole header was read; any problems with it follow as frameError
+         *
+         * @param header - decoded header
+         */
+        virtual void headerDecoded(MessageHandler_Header* header) = 0;
+
+        /*
+         * @brief A message failed validation and was dropped
+         *
+         * @param error - what failed
+         */
+        virtual void frameError(MessageSink_Error* error) = 0;
+
+        /*
+         * @brief Bytes were skipped over since the previous message, either noise
+         *        or rejected messages; reported just before the next message found
+         *
+         * @param count - number of bytes skipped
+         */
+        virtual void bytesSkipped(uint64_t count) = 0;
+
+        /*
+         * @brief A message was received and decoded
+         *
+         * @param message - the handler holding the decoded message
+         * @param view    - the raw message bytes
+         */
+        virtual void frameComplete(MessageHandler* message, MessageView* view) = 0;
+};
+
+
+
+/*
+ * @brief Make a sink that writes to a stream, for code that runs several handlers
+ *
+ * @param stream  - where the sink must write
+ * @param context - context given along with the factory
+ * @return        new sink, owned and deleted by the caller; NULL to discard every event
+ */
+typedef MessageSink* (*MessageSink_Factory)(FILE* stream, void* context);
+
+
+
+class MessageNullSink : public MessageSink
+{
+    public:
+
+        void frameStart(MessageHandler_Header* header, uint16_t headerChecksum, uint16_t payloadChecksum);
+        void headerDecoded(MessageHandler_Header* header);
+        void frameError(MessageSink_Error* error);
+        void bytesSkipped(uint64_t count);
+        void frameComplete(MessageHandler* message, MessageView* view);
+};
+
+
+
+class MessageTextSink : public MessageSink
+{
+    public:
+
+        /*
+         * @param stream - where the text goes; it is never flushed per line, so
+         *                 make it fully buffered and flush it before mixing in other output
+         */
+        MessageTextSink(FILE* stream);
+
+        void frameStart(MessageHandler_Header* header, uint16_t headerChecksum, uint16_t payloadChecksum);
+        void headerDecoded(MessageHandler_Header* header);
+        void frameError(MessageSink_Error* error);
+        void bytesSkipped(uint64_t count);
+        void frameComplete(MessageHandler* message, MessageView* view);
+
+        /*
+         * @brief Outputs a whole message in human-readable format
+         *
+         * @param message - message to print
+         */
+        void printMessage(MessageHandler* message);
+
+    private:
+        void printMessageProperties(MessageHandler_MessageProperties* messageProperties);
+        void printPayload(MessageHandler* message);
+
+        FILE* stream;
+};
+
+
+
+/*
+ * @brief binary sink record types
+ */
+enum
+{
+    messageSink_recordFrameStart    = 1,
+    messageSink_recordHeaderDecoded = 2,
+    messageSink_recordFrameError    = 3,
+    messageSink_recordFrameComplete = 4,
+    messageSink_recordBytesSkipped  = 5,
+
+    messageSink_recordSize          = 16,
+};
+
+class MessageBinarySink : public MessageSink
+{
+    public:
+
+        /*
+         * @brief Every event is written as a 16 byte little endian record:
+         *          uint8  type, uint8 status, uint16 command code, uint16 payload length,
+         *          uint16 header checksum, uint16 payload checksum, uint16 computed checksum,
+         *          uint32 size of the data that follows (the frame, for completed messages,
+         *          or a uint64 count, for skipped bytes)
+         *
+         * @param stream - where the records go
+         */
+        MessageBinarySink(FILE* stream);
+
+        void frameStart(MessageHandler_Header* header, uint16_t headerChecksum, uint16_t payloadChecksum);
+        void headerDecoded(MessageHandler_Header* header);
+        void frameError(MessageSink_Error* error);
+        void bytesSkipped(uint64_t count);
+        void frameComplete(MessageHandler* message, MessageView* view);
+
+    private:
+        void writeRecord(uint8_t type, uint8_t status, MessageHandler_Header* header,
+                         uint16_t computedChecksum, const uint8_t* data, uint32_t dataSize);
+
+        FILE*    stream;
+        uint16_t headerChecksum;
+        uint16_t payloadChecksum;
+};
+
+
+#endif // MessageSink_h
@@ -0,0 +1,169 @@
+/* MessageView.cpp
+ *
+ * This implements a lightweight, non-owning view of a single received message.
+ *   Every accessor decodes straight from the message bytes.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "MessageView.h"
+#include "FrameCodec.h"
+
+#include <assert.h>     /* assert */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+
+
+MessageView::MessageView()
+{
+    this->frame     = NULL;
+    this->frameSize = 0;
+}
+
+MessageView::MessageView(const uint8_t* frame, uint32_t frameSize)
+{
+    assert( frame );
+    assert( frameSize >= fieldIndex_payload );
+
+    this->frame     = frame;
+    this->frameSize = frameSize;
+}
+
+/*
+* @brief Retrieve the raw bytes of the message
+*
+* @return pointer to the key signature, NULL for an empty view
+*/
+const uint8_t* MessageView::getFrame(void)
+{
+    return this->frame;
+}
+
+/*
+* @brief Get the size of the whole message, prefix through payload
+*
+* @return frame size in bytes
+*/
+uint32_t MessageView::getFrameSize(void)
+{
+    return this->frameSize;
+}
+
+/*
+* @brief Get the header checksum as it was received
+*
+* @return header checksum
+*/
+uint16_t MessageView::getHeaderChecksum(void)
+{
+    return frameCodec_headerChecksum::read(this->frame);
+}
+
+/*
+* @brief Get the payload checksum as it was received
+*
+* @return payload checksum
+*/
+uint16_t MessageView::getPayloadChecksum(void)
+{
+    return frameCodec_dataChecksum::read(this->frame);
+}
+
+/*
+* @brief Retrieve the message properties fields
+*
+* @param[out] properties - a structure that seperates 16 bit value into needed bit fields
+*/
+void MessageView::getMessageProperties(MessageHandler_MessageProperties* properties)
+{
+    assert( properties );
+
+    properties->value = frameCodec_messageProperties::read(this->frame);
+}
+
+/*
+* @brief Retrieve the command code that specifies the message data type
+*
+* @return commandCode
+*/
+uint16_t MessageView::getCommandCode(void)
+{
+    return frameCodec_commandCode::read(this->frame);
+}
+
+/*
+* @brief Get the length of the data section of the message
+*
+* @return message data(payload) length
+*/
+uint16_t MessageView::getPayloadLength(void)
+{
+    return frameCodec_payloadSize::read(this->frame);
+}
+
+/*
+* @brief Retrieve the payload bytes of the message
+*
+* @return pointer to getPayloadLength() bytes of payload
+*/
+const uint8_t* MessageView::getPayload(void)
+{
+    return &this->frame[fieldIndex_payload];
+}
+
+/*
+* @brief Decode the heartbeat payload; the message must be a heartbeat
+*
+* @param[out] heartbeat - decoded heartbeat fields
+*/
+void MessageView::getHeartbeat(MessageHandler_HeartbeatPayload* heartbeat)
+{
+    assert( heartbeat );
+    assert( this->getPayloadLength() == sizeof(MessageHandler_HeartbeatPayload) );
+
+    frameCodec_heartbeat::decode(&this->frame[fieldIndex_payload], heartbeat);
+}
+
+/*
+* @brief Decode the standby enable field; the message must be a set standby state
+*
+* @return standbyEnabled
+*/
+bool MessageView::getPayloadStandbyEnabled(void)
+{
+    assert( this->getPayloadLength() == sizeof(uint8_t) );
+
+    return this->frame[fieldIndex_payload];
+}
+
+/*
+* @brief Parse the JSON payload; the message must be a set SAR mode
+*        The caller owns the returned tree and releases it with cJSON_Delete
+*
+* @return JSON tree, NULL if the payload is not valid JSON
+*/
+cJSON* MessageView::parsePayloadJson(void)
+{
+    uint16_t payloadLength = this->getPayloadLength();
+
+    // cJSON needs a terminated string, and the payload does not carry one
+    char* jsonString = (char*)malloc(payloadLength + 1);
+    if( jsonString == NULL )
+        return NULL;
+
+    memcpy(jsonString, &this->frame[fieldIndex_payload], payloadLength);
+    jsonString[payloadLength] = '\0';
+
+    cJSON* json = cJSON_Parse(jsonString);
+
+    free(jsonString);
+
+    return json;
+}
+
+
+
+// EOF
@@ -0,0 +1,120 @@
+/* MessageView.h
+ *
+ * This defines a lightweight, non-owning view of a single received message.
+ *   The view points at the message bytes where they already are (the caller's
+ *   buffer, a mapped capture or the handler's parse buffer) and decodes fields
+ *   only when they are asked for.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef MessageView_h
+#define MessageView_h
+
+#include "MessageHandler.h"
+#include <cJSON.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+
+class MessageView
+{
+    public:
+
+        MessageView();
+
+        /*
+         * @brief Wrap a complete message; nothing is copied, so frame must outlive the view
+         *
+         * @param frame     - pointer to the key signature of the message
+         * @param frameSize - prefix, header and payload size in bytes
+         */
+        MessageView(const uint8_t* frame, uint32_t frameSize);
+
+        /*
+         * @brief Retrieve the raw bytes of the message
+         *
+         * @return pointer to the key signature, NULL for an empty view
+         */
+        const uint8_t* getFrame(void);
+
+        /*
+         * @brief Get the size of the whole message, prefix through payload
+         *
+         * @return frame size in bytes
+         */
+        uint32_t getFrameSize(void);
+
+        /*
+         * @brief Get the header checksum as it was received
+         *
+         * @return header checksum
+         */
+        uint16_t getHeaderChecksum(void);
+
+        /*
+         * @brief Get the payload checksum as it was received
+         *
+         * @return payload checksum
+         */
+        uint16_t getPayloadChecksum(void);
+
+        /*
+         * @brief Retrieve the message properties fields
+         *
+         * @param[out] properties - a structure that seperates 16 bit value into needed bit fields
+         */
+        void getMessageProperties(MessageHandler_MessageProperties* properties);
+
+        /*
+         * @brief Retrieve the command code that specifies the message data type
+         *
+         * @return commandCode
+         */
+        uint16_t getCommandCode(void);
+
+        /*
+         * @brief Get the length of the data section of the message
+         *
+         * @return message data(payload) length
+         */
+        uint16_t getPayloadLength(void);
+
+        /*
+         * @brief Retrieve the payload bytes of the message
+         *
+         * @return pointer to getPayloadLength() bytes of payload
+         */
+        const uint8_t* getPayload(void);
+
+        /*
+         * @brief Decode the heartbeat payload; the message must be a heartbeat
+         *
+         * @param[out] heartbeat - decoded heartbeat fields
+         */
+        void getHeartbeat(MessageHandler_HeartbeatPayload* heartbeat);
+
+        /*
+         * @brief Decode the standby enable field; the message must be a set standby state
+         *
+         * @return standbyEnabled
+         */
+        bool getPayloadStandbyEnabled(void);
+
+        /*
+         * @brief Parse the JSON payload; the message must be a set SAR mode
+         *        The caller owns the returned tree and releases it with cJSON_Delete
+         *
+         * @return JSON tree, NULL if the payload is not valid JSON
+         */
+        cJSON* parsePayloadJson(void);
+
+    private:
+        const uint8_t* frame;
+        uint32_t       frameSize;
+};
+
+
+#endif // MessageView_h
@@ -0,0 +1,549 @@
+/* ParallelParser.cpp
+ *
+ * This implements a class that parses a capture held in memory on several threads
+ *   and produces exactly what one MessageHandler would, in the same order.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "ParallelParser.h"
+#include "MessageView.h"
+#include "FramePool.h"
+
+#include <assert.h>     /* assert */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <thread>
+
+using namespace std;
+
+
+
+/*
+* @brief Find the next message the scan reaches from position, if it starts before limit
+*        A candidate starting before limit is at most one message long, so the bytes
+*        past limit + framePool_maxFrameSize cannot change the result. The handler must
+*        be fresh or have just found a message; once this returns false it must not be reused.
+*
+* @param[in]  handler  - handler with a null sink following this scan
+* @param[in]  capture  - the capture bytes
+* @param[in]  size     - number of bytes in capture
+* @param[in]  position - scan position to start from, before limit
+* @param[in]  limit    - messages starting at or past this are not wanted
+* @param[out] start    - capture offset of the message found
+* @param[out] end      - capture offset one past the message found
+* @return     message found; when not, the scan reached every position up to limit
+*/
+static bool findMessage(MessageHandler* handler, const uint8_t* capture, uint64_t size,
+                        uint64_t position, uint64_t limit, uint64_t* start, uint64_t* end)
+{
+    assert( position < limit );
+
+    uint64_t    stop = (limit + framePool_maxFrameSize < size) ? limit + framePool_maxFrameSize : size;
+    size_t      consumed;
+    MessageView view;
+
+    if( position >= stop || !handler->parseView(&capture[position], stop - position, &consumed, &view) )
+        return false;
+
+    *end   = position + consumed;
+    *start = *end - view.getFrameSize();
+
+    return *start < limit;
+}
+
+
+
+ParallelParser::ParallelParser(uint32_t threadCount)
+{
+    assert( threadCount > 0 );
+
+    this->threadCount    = threadCount;
+    this->sinkFactory    = NULL;
+    this->sinkContext    = NULL;
+    this->jsonValidation = messageHandler_jsonStructural;
+
+    this->capture      = NULL;
+    this->captureSize  = 0;
+    this->skippedBytes = 0;
+
+    this->nextWork     = 0;
+    this->nextOutput   = 0;
+}
+
+/*
+* @brief Set how the sink for each piece of the capture is made; without
+*        a factory every event is discarded and nothing is written.
+*        Each sink writes to its own stream, which is copied to the output in capture order.
+*
+* @param factory - sink factory, NULL to discard every event
+* @param context - passed to factory
+*/
+void ParallelParser::setSinkFactory(MessageSink_Factory factory, void* context)
+{
+    this->sinkFactory = factory;
+    this->sinkContext = context;
+}
+
+/*
+* @brief Set how Set Sar Mode payloads are checked as they are decoded
+*
+* @param jsonValidation - check to make; messageHandler_jsonStructural by default
+*/
+void ParallelParser::setJsonValidation(MessageHandler_JsonValidation jsonValidation)
+{
+    this->jsonValidation = jsonValidation;
+}
+
+/*
+* @brief Parse a whole capture
+*
+* @param capture     - the capture bytes
+* @param captureSize - number of bytes in capture
+* @param output      - where sink output is written, in capture order; may be NULL without a factory
+* @return            number of messages parsed and decoded, as counted from parseBlock
+*/
+uint64_t ParallelParser::parse(const uint8_t* capture, uint64_t captureSize, FILE* output)
+{
+    assert( capture || captureSize == 0 );
+    assert( output || this->sinkFactory == NULL );
+
+    this->capture      = capture;
+    this->captureSize  = captureSize;
+    this->skippedBytes = 0;
+
+    this->scanChunks();
+    this->joinChunks();
+
+    return this->parseSegments(output);
+}
+
+/*
+* @brief Parse pieces of a capture that each hold nothing but whole messages,
+*        such as the blocks of a block capture; the scan passes are skipped
+*
+* @param capture    - the capture bytes
+* @param pieces     - the pieces, in output order
+* @param pieceCount - number of pieces
+* @param output     - where sink output is written, in piece order; may be NULL without a factory
+* @return           number of messages parsed and decoded, as counted from parseBlock
+*/
+uint64_t ParallelParser::parsePieces(const uint8_t* capture, const ParallelParser_Piece* pieces, size_t pieceCount, FILE* output)
+{
+    assert( pieces || pieceCount == 0 );
+    assert( output || this->sinkFactory == NULL );
+
+    this->capture      = capture;
+    this->captureSize  = 0;
+    this->skippedBytes = 0;
+
+    this->segments.resize(pieceCount);
+
+    for(size_t i = 0; i < pieceCount; i++)
+    {
+        // Pieces hold whole messages, so none needs bytes past its own piece
+        this->segments[i].begin   = pieces[i].begin;
+        this->segments[i].end     = pieces[i].end;
+        this->segments[i].readEnd = pieces[i].end;
+
+        if( pieces[i].end > this->captureSize )
+            this->captureSize = pieces[i].end;
+    }
+
+    return this->parseSegments(output);
+}
+
+/*
+* @brief Get the number of bytes that were not part of any verified message in the last parse
+*
+* @return skipped byte count
+*/
+uint64_t ParallelParser::getSkippedBytes(void)
+{
+    return this->skippedBytes;
+}
+
+/*
+* @brief First pass: split the capture into chunks and scan each one from its first byte
+*/
+void ParallelParser::scanChunks(void)
+{
+    uint64_t chunkSize = (this->captureSize + this->threadCount - 1) / this->threadCount;
+
+    if( chunkSize > parallelParser_maxChunkSize )
+        chunkSize = parallelParser_maxChunkSize;
+
+    if( chunkSize < parallelParser_minChunkSize )
+        chunkSize = parallelParser_minChunkSize;
+
+    this->chunks.clear();
+
+    for(uint64_t begin = 0; begin < this->captureSize; begin += chunkSize)
+    {
+        ChunkScan scan;
+
+        scan.begin        = begin;
+        scan.end          = (this->captureSize - begin < chunkSize) ? this->captureSize : begin + chunkSize;
+        scan.messageFound = false;
+
+        this->chunks.push_back(scan);
+    }
+
+    this->nextWork = 0;
+
+    vector<thread> workers;
+
+    for(uint32_t i = 0; i < this->threadCount; i++)
+        workers.push_back(thread(&ParallelParser::scanWorker, this));
+
+    for(uint32_t i = 0; i < this->threadCount; i++)
+        workers[i].join();
+}
+
+void ParallelParser::scanWorker(void)
+{
+    while( true )
+    {
+        ChunkScan* scan;
+
+        {
+            lock_guard<mutex> guard(this->lock);
+
+            if( this->nextWork >= this->chunks.size() )
+                return;
+
+            scan = &this->chunks[this->nextWork++];
+        }
+
+        this->scanChunk(scan);
+    }
+}
+
+/*
+* @brief Scan one chunk from its first byte
+*
+* @param scan - the chunk; begin and end are set, the rest is filled in
+*/
+void ParallelParser::scanChunk(ChunkScan* scan)
+{
+    assert( scan );
+
+    MessageHandler handler;
+    uint64_t       position = scan->begin;
+
+    handler.setSink(NULL);
+
+    scan->exit = scan->end;
+
+    while( position < scan->end )
+    {
+        uint64_t start;
+        uint64_t end;
+
+        if( !findMessage(&handler, this->capture, this->captureSize, position, scan->end, &start, &end) )
+            break;
+
+        scan->lastMessageStart = start;
+        scan->lastMessageEnd   = end;
+        scan->messageFound     = true;
+
+        position = end;
+
+        if( end >= scan->end )
+            scan->exit = end;
+    }
+}
+
+/*
+* @brief Second pass: carry the true scan position from chunk to chunk, settling messages
+*        that straddle chunk edges, and cut the capture after the last message of each chunk
+*/
+void ParallelParser::joinChunks(void)
+{
+    uint64_t entry = 0;
+    uint64_t begin = 0;
+
+    this->segments.clear();
+
+    for(size_t i = 0; i < this->chunks.size(); i++)
+    {
+        ChunkScan* scan = &this->chunks[i];
+
+        if( entry >= scan->end )
+        {
+            // A message from an earlier chunk covers this whole chunk
+            scan->messageFound = false;
+            scan->exit         = entry;
+            continue;
+        }
+
+        if( entry > scan->begin )
+            this->rescanChunk(scan, entry);
+
+        entry = scan->exit;
+
+        // The scan is at rest right after a message, so a fresh handler can start there
+        if( scan->messageFound && scan->lastMessageEnd < this->captureSize )
+        {
+            Segment segment;
+
+            segment.begin   = begin;
+            segment.end     = scan->lastMessageEnd;
+            segment.readEnd = this->captureSize;
+
+            this->segments.push_back(segment);
+
+            begin = segment.end;
+        }
+    }
+
+    if( begin < this->captureSize )
+    {
+        Segment segment;
+
+        segment.begin   = begin;
+        segment.end     = this->captureSize;
+        segment.readEnd = this->captureSize;
+
+        this->segments.push_back(segment);
+    }
+}
+
+/*
+* @brief Settle a chunk whose true scan position enters past its first byte
+*        The true scan and the chunk's own scan are stepped one message at a time,
+*        always moving whichever is behind, until one reaches a position the other
+*        also reached. Both scan every position between the messages they find, so
+*        that takes no more than a message or two in practice.
+*
+* @param scan  - the chunk, as scanned from its first byte; updated to the true result
+* @param entry - true scan position coming out of the previous chunk
+*/
+void ParallelParser::rescanChunk(ChunkScan* scan, uint64_t entry)
+{
+    assert( scan );
+    assert( entry > scan->begin && entry < scan->end );
+
+    MessageHandler trueHandler;
+    MessageHandler chunkHandler;
+    uint64_t       truePosition     = entry;
+    uint64_t       chunkPosition    = scan->begin;
+    uint64_t       meeting          = 0;
+    bool           met              = false;
+    bool           messageFound     = false;
+    uint64_t       lastMessageStart = 0;
+    uint64_t       lastMessageEnd   = 0;
+
+    trueHandler.setSink(NULL);
+    chunkHandler.setSink(NULL);
+
+    while( !met )
+    {
+        uint64_t start;
+        uint64_t end;
+
+        if( truePosition == chunkPosition )
+        {
+            meeting = truePosition;
+            met     = true;
+        }
+        else if( truePosition < chunkPosition )
+        {
+            uint64_t limit = (chunkPosition < scan->end) ? chunkPosition : scan->end;
+
+            if( findMessage(&trueHandler, this->capture, this->captureSize, truePosition, limit, &start, &end) )
+            {
+                messageFound     = true;
+                lastMessageStart = start;
+                lastMessageEnd   = end;
+                truePosition     = end;
+
+                if( end >= scan->end )
+                {
+                    // This message runs into the next chunk, so nothing of the chunk's own scan is left
+                    scan->exit = end;
+                    break;
+                }
+            }
+            else if( chunkPosition < scan->end )
+            {
+                meeting = chunkPosition;
+                met     = true;
+            }
+            else
+            {
+                scan->exit = scan->end;
+                break;
+            }
+        }
+        else
+        {
+            if( findMessage(&chunkHandler, this->capture, this->captureSize, chunkPosition, truePosition, &start, &end) )
+            {
+                chunkPosition = end;
+            }
+            else
+            {
+                meeting = truePosition;
+                met     = true;
+            }
+        }
+    }
+
+    // From the meeting point on the chunk's own scan is the true one, exit included
+    if( met && scan->messageFound && scan->lastMessageStart >= meeting )
+        return;
+
+    scan->messageFound     = messageFound;
+    scan->lastMessageStart = lastMessageStart;
+    scan->lastMessageEnd   = lastMessageEnd;
+}
+
+/*
+* @brief Third pass: parse every piece on the worker threads and write their output in order
+*
+* @param output - where sink output is written
+* @return       number of messages parsed and decoded
+*/
+uint64_t ParallelParser::parseSegments(FILE* output)
+{
+    uint64_t messageCount = 0;
+
+    for(size_t i = 0; i < this->segments.size(); i++)
+    {
+        this->segments[i].text         = NULL;
+        this->segments[i].textSize     = 0;
+        this->segments[i].messageCount = 0;
+        this->segments[i].skippedBytes = 0;
+        this->segments[i].done         = false;
+    }
+
+    this->nextWork   = 0;
+    this->nextOutput = 0;
+
+    vector<thread> workers;
+
+    for(uint32_t i = 0; i < this->threadCount; i++)
+        workers.push_back(thread(&ParallelParser::segmentWorker, this));
+
+    for(size_t i = 0; i < this->segments.size(); i++)
+    {
+        Segment* segment = &this->segments[i];
+
+        {
+            unique_lock<mutex> guard(this->lock);
+
+            while( !segment->done )
+                this->progress.wait(guard);
+
+            this->nextOutput = i + 1;
+        }
+
+        this->progress.notify_all();
+
+        if( segment->text )
+        {
+            fwrite(segment->text, 1, segment->textSize, output);
+            free(segment->text);
+            segment->text = NULL;
+        }
+
+        messageCount       += segment->messageCount;
+        this->skippedBytes += segment->skippedBytes;
+    }
+
+    for(uint32_t i = 0; i < this->threadCount; i++)
+        workers[i].join();
+
+    return messageCount;
+}
+
+void ParallelParser::segmentWorker(void)
+{
+    size_t aheadLimit = (size_t)this->threadCount * parallelParser_segmentsPerThread;
+
+    while( true )
+    {
+        Segment* segment;
+
+        {
+            unique_lock<mutex> guard(this->lock);
+
+            // Output is held in memory until its turn, so do not run too far ahead of it
+            while( this->nextWork < this->segments.size() && this->nextWork >= this->nextOutput + aheadLimit )
+                this->progress.wait(guard);
+
+            if( this->nextWork >= this->segments.size() )
+                return;
+
+            segment = &this->segments[this->nextWork++];
+        }
+
+        this->parseSegment(segment);
+
+        {
+            lock_guard<mutex> guard(this->lock);
+
+            segment->done = true;
+        }
+
+        this->progress.notify_all();
+    }
+}
+
+/*
+* @brief Parse one piece of the capture with its own handler and sink
+*        The piece starts with the scan at rest, so the handler reports exactly what a
+*        handler parsing the whole capture would between those offsets. Rejected candidates
+*        near the end of the piece may still need bytes past it, so bytes up to
+*        segment->readEnd are offered, but no message is searched for past segment->end;
+*        the last message of the piece ends exactly there, whether or not it decodes.
+*
+* @param segment - the piece; begin, end and readEnd are set, the rest is filled in
+*/
+void ParallelParser::parseSegment(Segment* segment)
+{
+    assert( segment );
+
+    MessageHandler handler;
+    MessageSink*   sink     = NULL;
+    FILE*          stream   = NULL;
+    uint64_t       position = segment->begin;
+
+    if( this->sinkFactory )
+    {
+        stream = open_memstream(&segment->text, &segment->textSize);
+
+        if( stream )
+            sink = this->sinkFactory(stream, this->sinkContext);
+    }
+
+    handler.setSink(sink);
+    handler.setJsonValidation(this->jsonValidation);
+
+    while( position < segment->end )
+    {
+        size_t consumed;
+
+        if( handler.parseBlock(&this->capture[position], segment->readEnd - position, &consumed, segment->end - position) )
+            segment->messageCount++;
+
+        position += consumed;
+    }
+
+    assert( position == segment->end );
+
+    segment->skippedBytes = handler.getSkippedBytes();
+
+    handler.setSink(NULL);
+    delete sink;
+
+    if( stream )
+        fclose(stream);
+}
+
+
+
+// EOF
@@ -0,0 +1,197 @@
+/* ParallelParser.h
+ *
+ * This defines a class that parses a capture held in memory on several threads
+ *   and produces exactly what one MessageHandler would, in the same order.
+ *
+ *   A handler takes the first message that verifies at its position and otherwise
+ *   moves one byte on, so which messages it finds only depends on where it starts.
+ *   Parsing runs in three passes:
+ *     1. Every chunk of the capture is scanned from its first byte for the messages
+ *        that start in it.
+ *     2. Chunk by chunk, the true scan position coming out of the previous chunk is
+ *        followed until it lands on a position the chunk's own scan also reached;
+ *        from there the two agree, so the rest of that chunk's scan is kept.
+ *        Messages that straddle chunk edges are settled here.
+ *     3. The capture is cut at the end of the last message of every chunk, each piece
+ *        is parsed again with a handler reporting to its own sink, and the output of
+ *        each piece is written out in capture order.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef ParallelParser_h
+#define ParallelParser_h
+
+#include "MessageHandler.h"
+#include "MessageSink.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+
+
+/*
+ * @brief chunk sizes; chunks are shrunk to give every thread work on smaller captures
+ */
+enum
+{
+    parallelParser_maxChunkSize = 16 * 1024 * 1024,
+    parallelParser_minChunkSize = 256 * 1024,
+
+    parallelParser_segmentsPerThread = 2,   /* how far parsing may run ahead of output */
+};
+
+/*
+ * @brief a piece of a capture that holds nothing but whole messages
+ */
+typedef struct
+{
+    uint64_t begin;
+    uint64_t end;
+} ParallelParser_Piece;
+
+class ParallelParser
+{
+    public:
+
+        /*
+         * @param threadCount - number of worker threads, at least 1
+         */
+        ParallelParser(uint32_t threadCount);
+
+        /*
+         * @brief Set how the sink for each piece of the capture is made; without
+         *        a factory every event is discarded and nothing is written.
+         *        Each sink writes to its own stream, which is copied to the output in capture order.
+         *
+         * @param factory - sink factory, NULL to discard every event
+         * @param context - passed to factory
+         */
+        void setSinkFactory(MessageSink_Factory factory, void* context);
+
+        /*
+         * @brief Set how Set Sar Mode payloads are checked as they are decoded
+         *
+         * @param jsonValidation - check to make; messageHandler_jsonStructural by default
+         */
+        void setJsonValidation(MessageHandler_JsonValidation jsonValidation);
+
+        /*
+         * @brief Parse a whole capture
+         *
+         * @param capture     - the capture bytes
+         * @param captureSize - number of bytes in capture
+         * @param output      - where sink output is written, in capture order; may be NULL without a factory
+         * @return            number of messages parsed and decoded, as counted from parseBlock
+         */
+        uint64_t parse(const uint8_t* capture, uint64_t captureSize, FILE* output);
+
+        /*
+         * @brief Parse pieces of a capture that each hold nothing but whole messages,
+         *        such as the blocks of a block capture; the scan passes are skipped
+         *
+         * @param capture    - the capture bytes
+         * @param pieces     - the pieces, in output order
+         * @param pieceCount - number of pieces
+         * @param output     - where sink output is written, in piece order; may be NULL without a factory
+         * @return           number of messages parsed and decoded, as counted from parseBlock
+         */
+        uint64_t parsePieces(const uint8_t* capture, const ParallelParser_Piece* pieces, size_t pieceCount, FILE* output);
+
+        /*
+         * @brief Get the number of bytes that were not part of any verified message in the last parse
+         *
+         * @return skipped byte count
+         */
+        uint64_t getSkippedBytes(void);
+
+    private:
+        /*
+         * @brief Where the scan of one chunk stopped and the last message it found
+         */
+        typedef struct
+        {
+            uint64_t begin;
+            uint64_t end;
+            uint64_t exit;                  /* first scan position at or past end */
+            uint64_t lastMessageStart;
+            uint64_t lastMessageEnd;
+            bool     messageFound;
+        } ChunkScan;
+
+        /*
+         * @brief One piece of the capture and the output of parsing it
+         */
+        typedef struct
+        {
+            uint64_t begin;
+            uint64_t end;
+            uint64_t readEnd;               /* bytes past end, up to here, may settle a candidate */
+            char*    text;
+            size_t   textSize;
+            uint64_t messageCount;
+            uint64_t skippedBytes;
+            bool     done;
+        } Segment;
+
+        /*
+         * @brief The three passes described at the top of this file
+         */
+        void scanChunks(void);
+        void joinChunks(void);
+        uint64_t parseSegments(FILE* output);
+
+        /*
+         * @brief Scan one chunk from its first byte
+         *
+         * @param scan - the chunk; begin and end are set, the rest is filled in
+         */
+        void scanChunk(ChunkScan* scan);
+
+        /*
+         * @brief Settle a chunk whose true scan position enters past its first byte
+         *
+         * @param scan  - the chunk, as scanned from its first byte; updated to the true result
+         * @param entry - true scan position coming out of the previous chunk
+         */
+        void rescanChunk(ChunkScan* scan, uint64_t entry);
+
+        /*
+         * @brief Parse one piece of the capture with its own handler and sink
+         *
+         * @param segment - the piece; begin, end and readEnd are set, the rest is filled in
+         */
+        void parseSegment(Segment* segment);
+
+        /*
+         * @brief Thread bodies; each takes the next chunk or piece until there are none left
+         */
+        void scanWorker(void);
+        void segmentWorker(void);
+
+        uint32_t                   threadCount;
+        MessageSink_Factory        sinkFactory;
+        void*                      sinkContext;
+        MessageHandler_JsonValidation jsonValidation;
+
+        const uint8_t*             capture;
+        uint64_t                   captureSize;
+        uint64_t                   skippedBytes;
+
+        /*
+         * @brief Work is handed out in order; lock guards nextWork, nextOutput and Segment::done
+         */
+        std::vector<ChunkScan>     chunks;
+        std::vector<Segment>       segments;
+        size_t                     nextWork;
+        size_t                     nextOutput;
+        std::mutex                 lock;
+        std::condition_variable    progress;
+};
+
+
+#endif // ParallelParser_h
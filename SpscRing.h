@@ -0,0 +1,131 @@
+/* SpscRing.h
+ *
+ * This defines a bounded lock-free ring for passing items from exactly one
+ *   producer thread to exactly one consumer thread. Neither side ever waits
+ *   inside the ring; push and pop fail instead, and the caller decides whether
+ *   to wait, retry later or do something else.
+ *
+ * Copyright 2018 Jesse Bahr
+ * All rights reserved.
+ */
+
+#ifndef SpscRing_h
+#define SpscRing_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+
+
+
+/*
+ * @brief Keeps the indexes each side writes on separate cache lines
+ */
+enum
+{
+    spscRing_cacheLineSize = 64,
+};
+
+
+
+template <typename Item, uint32_t capacity>
+class SpscRing
+{
+    static_assert( capacity > 0 && (capacity & (capacity - 1)) == 0, "capacity must be a power of 2" );
+
+    public:
+
+        SpscRing()
+        {
+            this->head      = 0;
+            this->tail      = 0;
+            this->peakDepth = 0;
+            this->fullCount = 0;
+        }
+
+        /*
+         * @brief Add an item; producer only
+         *
+         * @param item - item to add
+         * @return     item added; false when the ring is full
+         */
+        bool push(const Item& item)
+        {
+            uint32_t tail = this->tail.load(std::memory_order_relaxed);
+            uint32_t head = this->head.load(std::memory_order_acquire);
+
+            if( tail - head == capacity )
+            {
+                this->fullCount.store(this->fullCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return false;
+            }
+
+            this->items[tail & (capacity - 1)] = item;
+            this->tail.store(tail + 1, std::memory_order_release);
+
+            if( tail + 1 - head > this->peakDepth.load(std::memory_order_relaxed) )
+                this->peakDepth.store(tail + 1 - head, std::memory_order_relaxed);
+
+            return true;
+        }
+
+        /*
+         * @brief Take the oldest item; consumer only
+         *
+         * @param[out] item - the item taken
+         * @return     item taken; false when the ring is empty
+         */
+        bool pop(Item* item)
+        {
+            uint32_t head = this->head.load(std::memory_order_relaxed);
+            uint32_t tail = this->tail.load(std::memory_order_acquire);
+
+            if( head == tail )
+                return false;
+
+            *item = this->items[head & (capacity - 1)];
+            this->head.store(head + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        /*
+         * @brief Get the number of items in the ring; exact only when both sides are idle
+         *
+         * @return depth
+         */
+        uint32_t getDepth(void)
+        {
+            return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire);
+        }
+
+        /*
+         * @brief Get the most items the ring has held at once
+         *
+         * @return peak depth
+         */
+        uint32_t getPeakDepth(void)
+        {
+            return this->peakDepth.load(std::memory_order_relaxed);
+        }
+
+        /*
+         * @brief Get how many pushes found the ring full
+         *
+         * @return full count
+         */
+        uint64_t getFullCount(void)
+        {
+            return this->fullCount.load(std::memory_order_relaxed);
+        }
+
+    private:
+        alignas(spscRing_cacheLineSize) std::atomic<uint32_t> head;    /* written by the consumer */
+        alignas(spscRing_cacheLineSize) std::atomic<uint32_t> tail;    /* written by the producer */
+        std::atomic<uint32_t>                                 peakDepth;
+        std::atomic<uint64_t>                                 fullCount;
+        alignas(spscRing_cacheLineSize) Item                  items[capacity];
+};
+
+
+#endif // SpscRing_h
@@ -0,0 +1,185 @@
+/* captureCodecBenchmark.cpp
+ *
+ * This compresses the verified messages of a capture in memory, then times
+ *   decoding it and prints the compression ratio and decode throughput.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "CaptureCodec.h"
+#include "CaptureFile.h"
+#include "MessageHandler.h"
+#include "MessageView.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+
+enum
+{
+    decodeBufferSize = 1024 * 1024,
+    bytesPerSample   = 1024 * 1024 * 1024,
+    minimumRepeats   = 4,
+};
+
+
+
+static uint64_t readNanoseconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * @brief Decode a whole compressed capture, throwing the messages away
+ *
+ * @return bytes of messages decoded; 0 if the capture is damaged
+ */
+static uint64_t decodeAll(const uint8_t* compressed, size_t compressedSize, uint8_t* buffer)
+{
+    CaptureDecoder decoder;
+    uint64_t       decoded  = 0;
+    size_t         position = captureCodec_headerSize;
+
+    if( !decoder.begin(compressed, compressedSize) )
+        return 0;
+
+    while( position < compressedSize )
+    {
+        size_t consumed;
+        size_t produced;
+
+        if( !decoder.decode(&compressed[position], compressedSize - position, &consumed, buffer, decodeBufferSize, &produced) )
+            return 0;
+
+        position += consumed;
+        decoded  += produced;
+    }
+
+    return decoded;
+}
+
+
+
+/*
+ * usage: captureCodecBenchmark.exe <capture>
+ *   Reading a compressed capture beats reading the raw one from any disk slower
+ *   than the break-even rate printed at the end.
+ */
+int main(int argc, char *argv[])
+{
+    CaptureFile    dataFile;
+    CaptureEncoder encoder;
+    MessageHandler handler;
+
+    if( argc < 2 || !dataFile.open(argv[1]) )
+    {
+        fprintf(stderr, "usage: captureCodecBenchmark.exe <capture>\n");
+        return 1;
+    }
+
+    vector<uint8_t> messages;
+    vector<uint8_t> compressed(captureCodec_headerSize);
+    vector<uint8_t> record(captureCodec_maxFrameSize + captureCodec_recordOverhead);
+    uint64_t        messageCount = 0;
+    const uint8_t*  span;
+    size_t          spanSize;
+
+    encoder.begin(compressed.data());
+    handler.setSink(NULL);
+
+    while( dataFile.nextSpan(&span, &spanSize) )
+    {
+        for(size_t position = 0; position < spanSize; )
+        {
+            MessageView view;
+            size_t      consumed;
+            bool        found = handler.parseView(&span[position], spanSize - position, &consumed, &view);
+
+            position += consumed;
+
+            if( !found )
+                continue;
+
+            size_t size = encoder.encodeFrame(view.getFrame(), view.getFrameSize(), record.data());
+
+            messages.insert(messages.end(), view.getFrame(), view.getFrame() + view.getFrameSize());
+            compressed.insert(compressed.end(), record.begin(), record.begin() + size);
+            messageCount++;
+        }
+    }
+
+    uint8_t* buffer = (uint8_t*)malloc(decodeBufferSize);
+
+    if( buffer == NULL || messages.empty() )
+    {
+        fprintf(stderr, "Nothing to compress in %s\n", argv[1]);
+        free(buffer);
+        return 1;
+    }
+
+    // Check the round trip before timing it
+    CaptureDecoder  decoder;
+    vector<uint8_t> roundTrip;
+    size_t          position = captureCodec_headerSize;
+
+    decoder.begin(compressed.data(), compressed.size());
+
+    while( position < compressed.size() )
+    {
+        size_t consumed;
+        size_t produced;
+
+        if( !decoder.decode(&compressed[position], compressed.size() - position, &consumed, buffer, decodeBufferSize, &produced) )
+            break;
+
+        roundTrip.insert(roundTrip.end(), buffer, buffer + produced);
+        position += consumed;
+    }
+
+    if( roundTrip != messages )
+    {
+        fprintf(stderr, "Error - decoded messages do not match the originals\n");
+        free(buffer);
+        return 1;
+    }
+
+    uint32_t repeats = (uint32_t)(bytesPerSample / messages.size());
+
+    if( repeats < minimumRepeats )
+        repeats = minimumRepeats;
+
+    volatile uint64_t sink = decodeAll(compressed.data(), compressed.size(), buffer);
+
+    uint64_t startNs = readNanoseconds();
+
+    for(uint32_t r = 0; r < repeats; r++)
+        sink += decodeAll(compressed.data(), compressed.size(), buffer);
+
+    uint64_t ns     = readNanoseconds() - startNs;
+    double   ratio  = (double)messages.size() / compressed.size();
+    double   decode = ns ? (double)messages.size() * repeats / ns : 0.0;
+
+    printf("messages:        %llu\n", (unsigned long long)messageCount);
+    printf("message bytes:   %llu\n", (unsigned long long)messages.size());
+    printf("compressed:      %llu\n", (unsigned long long)compressed.size());
+    printf("ratio:           %.2f\n", ratio);
+    printf("decode:          %.2f GB/s of messages\n", decode);
+    printf("break-even disk: %.2f GB/s\n", decode * (1.0 - 1.0 / ratio));
+
+    free(buffer);
+
+    return 0;
+}
+
+
+
+// EOF
@@ -0,0 +1,123 @@
+/* checksumBenchmark.cpp
+ *
+ * This times every checksum kernel the CPU supports over payload sizes from
+ *   1 byte to 64 KB and prints the throughput of each.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "Checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+enum
+{
+    maxBufferSize   = 64 * 1024,
+    bytesPerSample  = 64 * 1024 * 1024,
+    minimumRepeats  = 64,
+};
+
+static const uint32_t bufferSizes[] =
+{
+    1, 2, 4, 8, 12, 16, 32, 64, 128, 256, 512, 1024, 4096, 16384, 65535, 65536,
+};
+
+
+
+static uint64_t readNanoseconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t readCycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+
+/*
+ * usage: checksumBenchmark.exe
+ *   Cycles are TSC ticks, which run at the nominal clock rather than the core clock
+ */
+int main(int argc, char *argv[])
+{
+    uint8_t* buffer = (uint8_t*)malloc(maxBufferSize);
+
+    if( buffer == NULL )
+        return 1;
+
+    srand(1);
+
+    for(uint32_t i = 0; i < maxBufferSize; i++)
+    {
+        buffer[i] = (uint8_t)rand();
+    }
+
+    printf("generateChecksum uses %s\n\n", getChecksumKernelName(getChecksumKernel()));
+    printf("%-8s %8s %12s %12s %12s\n", "kernel", "bytes", "ns/call", "bytes/cycle", "GB/s");
+
+    volatile uint16_t sink = 0;
+
+    for(int kernel = checksum_kernelScalar; kernel < checksum_kernelCount; kernel++)
+    {
+        if( !isChecksumKernelSupported((Checksum_Kernel)kernel) )
+            continue;
+
+        for(uint32_t i = 0; i < sizeof(bufferSizes) / sizeof(bufferSizes[0]); i++)
+        {
+            uint32_t size    = bufferSizes[i];
+            uint32_t repeats = bytesPerSample / size;
+
+            if( repeats < minimumRepeats )
+                repeats = minimumRepeats;
+
+            // Warm the caches and the branch predictors
+            for(uint32_t r = 0; r < minimumRepeats; r++)
+                sink += generateChecksumWith((Checksum_Kernel)kernel, buffer, size);
+
+            uint64_t startNs     = readNanoseconds();
+            uint64_t startCycles = readCycles();
+
+            for(uint32_t r = 0; r < repeats; r++)
+                sink += generateChecksumWith((Checksum_Kernel)kernel, buffer, size);
+
+            uint64_t cycles = readCycles() - startCycles;
+            uint64_t ns     = readNanoseconds() - startNs;
+            double   bytes  = (double)size * repeats;
+
+            printf("%-8s %8u %12.2f %12.2f %12.2f\n",
+                   getChecksumKernelName((Checksum_Kernel)kernel), size,
+                   (double)ns / repeats,
+                   cycles ? bytes / cycles : 0.0,
+                   ns ? bytes / ns : 0.0);
+        }
+
+        printf("\n");
+    }
+
+    free(buffer);
+
+    return 0;
+}
+
+
+
+// EOF
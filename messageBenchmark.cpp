@@ -0,0 +1,638 @@
+/* messageBenchmark.cpp
+ *
+ * This times the parser, the serializer, the checksum, the JSON paths, the
+ *   columnar heartbeat decode and the device table over captures of one command code at several
+ *   payload sizes and over a mix of command codes, and prints MB/s, frames/s
+ *   and ns/frame for each. The results
+ *   are also written as CSV, one row per benchmark and capture, so runs of
+ *   different builds can be compared.
+ *
+ *   The captures come from BulkGenerator with a fixed seed, so every run times
+ *   the same bytes.
+ *
+ * Copyright 2018 Jesse Bahr
+ *  All rights reserved.
+ */
+
+#include "MessageHandler.h"
+#include "MessageBatch.h"
+#include "HeartbeatColumns.h"
+#include "DeviceTable.h"
+#include "BulkGenerator.h"
+#include "FrameCodec.h"
+#include "Checksum.h"
+#include "JsonArena.h"
+#include "JsonValidator.h"
+#include <cJSON.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+enum
+{
+    framesPerCapture   = 100000,
+    serializedFrames   = 4096,              /* handlers kept decoded for the serializer */
+    receiveSize        = 4096,              /* bytes handed to parseBytes at a time */
+    minimumRepeats     = 3,
+    minimumSampleTime  = 200 * 1000 * 1000, /* ns */
+};
+
+/*
+ * @brief a capture to time: the weight of each command code, and the Set Sar Mode payload sizes
+ */
+typedef struct
+{
+    const char* name;
+    uint32_t    heartbeatWeight;
+    uint32_t    sarModeWeight;
+    uint32_t    standbyWeight;
+    uint16_t    minJsonSize;
+    uint16_t    maxJsonSize;
+} Workload;
+
+static const Workload workloads[] =
+{
+    { "heartbeat", 1,  0, 0, bulkGenerator_minJsonSize, bulkGenerator_minJsonSize },
+    { "standby",   0,  0, 1, bulkGenerator_minJsonSize, bulkGenerator_minJsonSize },
+    { "json16",    0,  1, 0, 16,                        16                        },
+    { "json64",    0,  1, 0, 64,                        64                        },
+    { "json256",   0,  1, 0, 256,                       256                       },
+    { "mixed",     90, 5, 5, bulkGenerator_minJsonSize, bulkGenerator_maxJsonSize },
+};
+
+/*
+ * @brief a capture held in memory, with where each frame is
+ */
+typedef struct
+{
+    vector<uint8_t>  bytes;
+    vector<uint32_t> frameOffsets;
+    uint64_t         payloadBytes;
+    vector<char>     jsonTexts;         /* every Set Sar Mode payload, NUL terminated */
+    vector<uint32_t> jsonOffsets;
+    uint64_t         jsonBytes;
+} Capture;
+
+/*
+ * @brief what one benchmark does in one pass over a capture
+ */
+typedef struct
+{
+    uint64_t frames;
+    uint64_t bytes;
+} PassSize;
+
+static volatile uint64_t sink;
+
+
+
+static uint64_t readNanoseconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static bool appendFrames(const uint8_t* frames, size_t size, void* context)
+{
+    vector<uint8_t>* bytes = (vector<uint8_t>*)context;
+
+    bytes->insert(bytes->end(), frames, frames + size);
+
+    return true;
+}
+
+/*
+ * @brief Generate a workload's capture and find its frames and JSON payloads
+ */
+static bool buildCapture(const Workload* workload, Capture* capture)
+{
+    BulkGenerator_Spec spec;
+
+    BulkGenerator::setDefaultSpec(&spec);
+
+    spec.messageCount = framesPerCapture;
+    spec.deviceCount  = 64;
+    spec.mixCount     = 0;
+    spec.minJsonSize  = workload->minJsonSize;
+    spec.maxJsonSize  = workload->maxJsonSize;
+
+    const uint16_t commandCodes[] = { MESSAGE_HANDLER_COMMAND_HEARTBEAT, MESSAGE_HANDLER_COMMAND_SETSARMODE, MESSAGE_HANDLER_COMMAND_SETSTANDBYSTATE };
+    const uint32_t weights[]      = { workload->heartbeatWeight, workload->sarModeWeight, workload->standbyWeight };
+
+    for(uint32_t i = 0; i < bulkGenerator_maxMixEntries; i++)
+    {
+        if( weights[i] == 0 )
+            continue;
+
+        spec.mix[spec.mixCount].commandCode = commandCodes[i];
+        spec.mix[spec.mixCount].weight      = weights[i];
+        spec.mixCount++;
+    }
+
+    BulkGenerator generator(&spec, 1);
+
+    if( !generator.generate(appendFrames, &capture->bytes) )
+        return false;
+
+    capture->payloadBytes = 0;
+    capture->jsonBytes    = 0;
+
+    for(size_t position = 0; position < capture->bytes.size(); )
+    {
+        const uint8_t* frame         = &capture->bytes[position];
+        uint16_t       payloadLength = frameCodec_payloadSize::read(frame);
+
+        capture->frameOffsets.push_back((uint32_t)position);
+        capture->payloadBytes += payloadLength;
+
+        if( frameCodec_commandCode::read(frame) == MESSAGE_HANDLER_COMMAND_SETSARMODE )
+        {
+            capture->jsonOffsets.push_back((uint32_t)capture->jsonTexts.size());
+            capture->jsonTexts.insert(capture->jsonTexts.end(), frame + fieldIndex_payload, frame + fieldIndex_payload + payloadLength);
+            capture->jsonTexts.push_back('\0');
+            capture->jsonBytes += payloadLength;
+        }
+
+        position += fieldIndex_payload + payloadLength;
+    }
+
+    return capture->frameOffsets.size() == framesPerCapture;
+}
+
+/*
+ * @brief Time repeated passes of a benchmark after one pass to warm up, then print
+ *        and record the result
+ *
+ * @param csv      - where the row goes
+ * @param name     - benchmark name
+ * @param workload - capture name
+ * @param size     - what one pass does; nothing is timed when it has no frames
+ * @param pass     - runs one pass, returning the frames it handled
+ * @return         every pass handled the frames expected
+ */
+template <typename Pass>
+static bool timePasses(FILE* csv, const char* name, const Workload* workload, PassSize size, Pass pass)
+{
+    if( size.frames == 0 )
+        return true;
+
+    if( pass() != size.frames )
+    {
+        fprintf(stderr, "Error - %s on %s handled the wrong number of frames\n", name, workload->name);
+        return false;
+    }
+
+    uint64_t passes = 0;
+    uint64_t start  = readNanoseconds();
+    uint64_t ns     = 0;
+
+    while( passes < minimumRepeats || ns < minimumSampleTime )
+    {
+        if( pass() != size.frames )
+        {
+            fprintf(stderr, "Error - %s on %s handled the wrong number of frames\n", name, workload->name);
+            return false;
+        }
+
+        passes++;
+        ns = readNanoseconds() - start;
+    }
+
+    double frames = (double)size.frames * passes;
+    double bytes  = (double)size.bytes * passes;
+
+    double megabytesPerSecond = bytes * 1e3 / ns;
+    double framesPerSecond    = frames * 1e9 / ns;
+    double nsPerFrame         = ns / frames;
+
+    printf("%-24s %-10s %10.0f %12.0f %10.1f\n", name, workload->name, megabytesPerSecond, framesPerSecond, nsPerFrame);
+
+    fprintf(csv, "%s,%s,%.1f,%llu,%llu,%llu,%llu,%.3f,%.0f,%.2f\n",
+            name, workload->name, (double)size.bytes / size.frames,
+            (unsigned long long)size.frames, (unsigned long long)size.bytes, (unsigned long long)passes, (unsigned long long)ns,
+            megabytesPerSecond, framesPerSecond, nsPerFrame);
+
+    return true;
+}
+
+/*
+ * @brief Check a device table filled while another thread reads it, then time filling one
+ *        The reader fails on any copy of a device that mixes two updates; the table at
+ *        the end must count what a pass over the heartbeats counts.
+ */
+static bool benchmarkDeviceTable(FILE* csv, const Workload* workload, Capture* capture, const vector<uint32_t>& heartbeatOffsets)
+{
+    uint8_t*       bytes          = capture->bytes.data();
+    size_t         size           = capture->bytes.size();
+    uint64_t       frameCount     = capture->frameOffsets.size();
+    uint64_t       heartbeatCount = heartbeatOffsets.size();
+    DeviceTable    table;
+    MessageHandler handler;
+    atomic<bool>   parsing(true);
+    atomic<bool>   torn(false);
+
+    if( heartbeatCount == 0 )
+        return true;
+
+    handler.setSink(NULL);
+    handler.setDeviceTable(&table);
+
+    thread reader([&]()
+    {
+        vector<DeviceTable_Device> devices(deviceTable_defaultCapacity);
+
+        while( parsing.load() )
+        {
+            uint32_t count = table.snapshot(devices.data(), (uint32_t)devices.size());
+
+            for(uint32_t i = 0; i < count; i++)
+            {
+                DeviceTable_Device* device = &devices[i];
+
+                if(   device->heartbeat.serialNumber != device->serialNumber
+                   || device->heartbeatCount == 0
+                   || device->modeTransitions >= device->heartbeatCount
+                   || device->outOfOrderCount >= device->heartbeatCount
+                  )
+                {
+                    torn.store(true);
+                }
+            }
+        }
+    });
+
+    for(size_t position = 0; position < size; )
+    {
+        size_t consumed;
+
+        handler.parseBlock(&bytes[position], size - position, &consumed);
+        position += consumed;
+    }
+
+    parsing.store(false);
+    reader.join();
+
+    // The same counts, one heartbeat at a time in capture order
+    unordered_map<uint32_t, DeviceTable_Device> expected;
+
+    for(uint64_t i = 0; i < heartbeatCount; i++)
+    {
+        MessageHandler_HeartbeatPayload heartbeat;
+
+        frameCodec_heartbeat::decode(&bytes[heartbeatOffsets[i] + fieldIndex_payload], &heartbeat);
+
+        DeviceTable_Device* device = &expected[heartbeat.serialNumber];
+
+        if( device->heartbeatCount == 0 )
+        {
+            device->serialNumber     = heartbeat.serialNumber;
+            device->lastSeen_seconds = heartbeat.epochTime_seconds;
+        }
+        else if( heartbeat.mode != device->heartbeat.mode )
+        {
+            device->modeTransitions++;
+        }
+
+        if( heartbeat.epochTime_seconds < device->lastSeen_seconds )
+            device->outOfOrderCount++;
+        else
+            device->lastSeen_seconds = heartbeat.epochTime_seconds;
+
+        device->heartbeat = heartbeat;
+        device->heartbeatCount++;
+    }
+
+    bool matched = !torn.load() && table.getCount() == expected.size();
+
+    for(auto i = expected.begin(); matched && i != expected.end(); ++i)
+    {
+        DeviceTable_Device found;
+
+        matched =    table.find(i->first, &found)
+                  && found.heartbeatCount == i->second.heartbeatCount
+                  && found.modeTransitions == i->second.modeTransitions
+                  && found.outOfOrderCount == i->second.outOfOrderCount
+                  && found.lastSeen_seconds == i->second.lastSeen_seconds;
+    }
+
+    if( !matched )
+    {
+        fprintf(stderr, "Error - DeviceTable on %s does not hold what its heartbeats record\n", workload->name);
+        return false;
+    }
+
+    return timePasses(csv, "parseBlock+DeviceTable", workload, { frameCount, size }, [&]()
+    {
+        uint64_t found = 0;
+
+        for(size_t position = 0; position < size; )
+        {
+            size_t consumed;
+
+            found    += handler.parseBlock(&bytes[position], size - position, &consumed);
+            position += consumed;
+        }
+
+        return found;
+    });
+}
+
+/*
+ * @brief Time every benchmark over one capture
+ */
+static bool benchmarkCapture(FILE* csv, const Workload* workload, Capture* capture)
+{
+    uint8_t*       bytes      = capture->bytes.data();
+    size_t         size       = capture->bytes.size();
+    uint64_t       frameCount = capture->frameOffsets.size();
+    uint64_t       jsonCount  = capture->jsonOffsets.size();
+    MessageHandler handler;
+
+    handler.setSink(NULL);
+
+    bool timed = timePasses(csv, "parseByte", workload, { frameCount, size }, [&]()
+    {
+        uint64_t found = 0;
+
+        for(size_t i = 0; i < size; i++)
+            found += handler.parseByte((char)bytes[i]);
+
+        return found;
+    });
+
+    timed = timed && timePasses(csv, "parseBytes", workload, { frameCount, size }, [&]()
+    {
+        uint64_t found = 0;
+
+        // As a receive loop would: a read at a time, every message in it in turn
+        for(size_t offset = 0; offset < size; offset += receiveSize)
+        {
+            uint8_t* next = &bytes[offset];
+            uint8_t* end  = &bytes[min(offset + receiveSize, size)];
+
+            while( next < end )
+            {
+                uint8_t* remaining = end;
+
+                found += handler.parseBytes(next, (uint32_t)(end - next), &remaining);
+                next   = remaining;
+            }
+        }
+
+        return found;
+    });
+
+    timed = timed && timePasses(csv, "parseBlock", workload, { frameCount, size }, [&]()
+    {
+        uint64_t found = 0;
+
+        for(size_t position = 0; position < size; )
+        {
+            size_t consumed;
+
+            found    += handler.parseBlock(&bytes[position], size - position, &consumed);
+            position += consumed;
+        }
+
+        return found;
+    });
+
+    // Each handler holds one decoded message, as it would after parsing it
+    uint64_t               handlerCount = min<uint64_t>(frameCount, serializedFrames);
+    vector<MessageHandler> handlers(handlerCount);
+    uint64_t               serializedBytes = 0;
+
+    for(uint64_t i = 0; i < handlerCount; i++)
+    {
+        const uint8_t* frame     = &bytes[capture->frameOffsets[i]];
+        uint32_t       frameSize = fieldIndex_payload + frameCodec_payloadSize::read(frame);
+        size_t         consumed;
+
+        handlers[i].setSink(NULL);
+
+        if( !handlers[i].parseBlock(frame, frameSize, &consumed) )
+            return false;
+
+        serializedBytes += frameSize;
+    }
+
+    timed = timed && timePasses(csv, "getSerialized", workload, { handlerCount, serializedBytes }, [&]()
+    {
+        uint8_t* serialized;
+
+        for(uint64_t i = 0; i < handlerCount; i++)
+            sink += handlers[i].getSerialized(&serialized);
+
+        return handlerCount;
+    });
+
+    timed = timed && timePasses(csv, "generateChecksum", workload, { frameCount, capture->payloadBytes }, [&]()
+    {
+        for(uint64_t i = 0; i < frameCount; i++)
+        {
+            const uint8_t* frame = &bytes[capture->frameOffsets[i]];
+
+            sink += generateChecksum(&frame[fieldIndex_payload], frameCodec_payloadSize::read(frame));
+        }
+
+        return frameCount;
+    });
+
+    const char* texts = capture->jsonTexts.data();
+
+    timed = timed && timePasses(csv, "cJSON_Parse", workload, { jsonCount, capture->jsonBytes }, [&]()
+    {
+        for(uint64_t i = 0; i < jsonCount; i++)
+        {
+            cJSON* tree = cJSON_Parse(&texts[capture->jsonOffsets[i]]);
+
+            sink += (tree != NULL);
+            cJSON_Delete(tree);
+        }
+
+        return jsonCount;
+    });
+
+    JsonArena* arena = JsonArena::create(bulkGenerator_maxJsonSize);
+
+    if( arena == NULL )
+        return false;
+
+    timed = timed && timePasses(csv, "JsonArena::parse", workload, { jsonCount, capture->jsonBytes }, [&]()
+    {
+        for(uint64_t i = 0; i < jsonCount; i++)
+        {
+            sink += (arena->parse(&texts[capture->jsonOffsets[i]]) != NULL);
+            arena->reset();
+        }
+
+        return jsonCount;
+    });
+
+    JsonArena::destroy(arena);
+
+    timed = timed && timePasses(csv, "isJsonStructureValid", workload, { jsonCount, capture->jsonBytes }, [&]()
+    {
+        for(uint64_t i = 0; i < jsonCount; i++)
+            sink += isJsonStructureValid(&texts[capture->jsonOffsets[i]]);
+
+        return jsonCount;
+    });
+
+    vector<cJSON*> trees(jsonCount);
+
+    for(uint64_t i = 0; i < jsonCount; i++)
+        trees[i] = cJSON_Parse(&texts[capture->jsonOffsets[i]]);
+
+    timed = timed && timePasses(csv, "cJSON_PrintUnformatted", workload, { jsonCount, capture->jsonBytes }, [&]()
+    {
+        for(uint64_t i = 0; i < jsonCount; i++)
+        {
+            char* text = cJSON_PrintUnformatted(trees[i]);
+
+            sink += (text != NULL);
+            cJSON_free(text);
+        }
+
+        return jsonCount;
+    });
+
+    for(uint64_t i = 0; i < jsonCount; i++)
+        cJSON_Delete(trees[i]);
+
+    // The columns must hold what decoding each heartbeat on its own gives, before either is timed
+    vector<uint32_t> heartbeatOffsets;
+    uint64_t         heartbeatBytes = 0;
+
+    for(uint64_t i = 0; i < frameCount; i++)
+    {
+        const uint8_t* frame = &bytes[capture->frameOffsets[i]];
+
+        if( frameCodec_commandCode::read(frame) != MESSAGE_HANDLER_COMMAND_HEARTBEAT )
+            continue;
+
+        heartbeatOffsets.push_back(capture->frameOffsets[i]);
+        heartbeatBytes += fieldIndex_payload + frameCodec_payloadSize::read(frame);
+    }
+
+    uint64_t         heartbeatCount = heartbeatOffsets.size();
+    MessageBatch     batch;
+    HeartbeatColumns columns;
+
+    handler.parseAll(bytes, size, &batch);
+
+    if( columns.addBatch(&batch) != heartbeatCount )
+    {
+        fprintf(stderr, "Error - HeartbeatColumns on %s decoded the wrong number of heartbeats\n", workload->name);
+        return false;
+    }
+
+    HeartbeatColumns_Columns decoded;
+    columns.getColumns(&decoded);
+
+    for(uint64_t i = 0; i < heartbeatCount; i++)
+    {
+        MessageHandler_HeartbeatPayload heartbeat;
+
+        frameCodec_heartbeat::decode(&bytes[heartbeatOffsets[i] + fieldIndex_payload], &heartbeat);
+
+        if(   decoded.epochTime_seconds[i] != heartbeat.epochTime_seconds
+           || decoded.serialNumber[i] != heartbeat.serialNumber
+           || decoded.voltage_cV[i] != heartbeat.voltage_cV
+           || decoded.temperature_C[i] != heartbeat.temperature_C
+           || decoded.mode[i] != heartbeat.mode
+          )
+        {
+            fprintf(stderr, "Error - HeartbeatColumns on %s differs from frameCodec_heartbeat at heartbeat %llu\n",
+                    workload->name, (unsigned long long)i);
+            return false;
+        }
+    }
+
+    timed = timed && timePasses(csv, "frameCodec_heartbeat", workload, { heartbeatCount, heartbeatBytes }, [&]()
+    {
+        for(uint64_t i = 0; i < heartbeatCount; i++)
+        {
+            MessageHandler_HeartbeatPayload heartbeat;
+
+            frameCodec_heartbeat::decode(&bytes[heartbeatOffsets[i] + fieldIndex_payload], &heartbeat);
+
+            sink += heartbeat.voltage_cV;
+        }
+
+        return heartbeatCount;
+    });
+
+    timed = timed && timePasses(csv, "HeartbeatColumns", workload, { heartbeatCount, heartbeatBytes }, [&]()
+    {
+        columns.clear();
+
+        return (uint64_t)columns.addBatch(&batch);
+    });
+
+    return timed && benchmarkDeviceTable(csv, workload, capture, heartbeatOffsets);
+}
+
+
+
+/*
+ * usage: messageBenchmark.exe [results file]
+ *   Results are written as CSV to the file named, build/bench.csv by default.
+ *   Bytes are whole frames for the parsers, the serializer and the heartbeat
+ *   decodes, payloads for the checksum, and JSON text for the JSON paths.
+ *   The columnar heartbeat decode is checked against the scalar one, and the
+ *   device table against a concurrent reader and a recount, before they are
+ *   timed.
+ */
+int main(int argc, char *argv[])
+{
+    const char* resultsPath = (argc > 1) ? argv[1] : "build/bench.csv";
+    FILE*       csv         = fopen(resultsPath, "w");
+
+    if( csv == NULL )
+    {
+        fprintf(stderr, "Error - unable to write %s\n", resultsPath);
+        return 1;
+    }
+
+    fprintf(csv, "benchmark,capture,bytesPerFrame,framesPerPass,bytesPerPass,passes,ns,MBps,framesPerSecond,nsPerFrame\n");
+
+    printf("generateChecksum uses %s\n\n", getChecksumKernelName(getChecksumKernel()));
+    printf("%-24s %-10s %10s %12s %10s\n", "benchmark", "capture", "MB/s", "frames/s", "ns/frame");
+
+    bool timed = true;
+
+    for(uint32_t i = 0; timed && i < sizeof(workloads) / sizeof(workloads[0]); i++)
+    {
+        Capture capture;
+
+        timed = buildCapture(&workloads[i], &capture) && benchmarkCapture(csv, &workloads[i], &capture);
+    }
+
+    timed = (fclose(csv) == 0) && timed;
+
+    if( !timed )
+    {
+        fprintf(stderr, "Error - benchmark did not complete\n");
+        return 1;
+    }
+
+    printf("\nResults written to %s\n", resultsPath);
+
+    return 0;
+}
+
+
+
+// EOF
@@ -10,6 +10,11 @@
  */
 
 #include "MessageHandler.h"
+#include "BlockCapture.h"
+#include "FrameWriter.h"
+#include "BulkGenerator.h"
+#include "FrameCodec.h"
+#include "CaptureIndex.h"
 #include <stdio.h>
 #include <assert.h>
 #include <cJSON.h>
@@ -17,6 +22,10 @@
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
+#include <fcntl.h>      /* open */
+#include <unistd.h>     /* close */
+#include <time.h>       /* clock_gettime */
+#include <thread>
 
 using namespace std;
 
@@ -34,9 +43,229 @@ enum
     argvIndex_payload           = 4,
 };
 
+static uint64_t readNanoseconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * @brief Read a whole file into memory, NUL terminated
+ *
+ * @return file contents to free, NULL if it could not be read
+ */
+static char* readTextFile(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+
+    if( file == NULL )
+        return NULL;
+
+    char*  text = NULL;
+    long   size = (fseek(file, 0, SEEK_END) == 0) ? ftell(file) : -1;
+
+    if( size >= 0 && fseek(file, 0, SEEK_SET) == 0 )
+    {
+        text = (char*)malloc((size_t)size + 1);
+
+        if( text && fread(text, 1, (size_t)size, file) != (size_t)size )
+        {
+            free(text);
+            text = NULL;
+        }
+        else if( text )
+        {
+            text[size] = '\0';
+        }
+    }
+
+    fclose(file);
+
+    return text;
+}
+
+/*
+ * @brief BulkGenerator outputs: a chunk goes to a bare capture in one write,
+ *        or into a block capture a message at a time
+ */
+static bool writeChunk(const uint8_t* frames, size_t size, void* context)
+{
+    FrameWriter* writer = (FrameWriter*)context;
+
+    return writer->addFrame(frames, size) && writer->flush();
+}
+
+static bool writeBlockChunk(const uint8_t* frames, size_t size, void* context)
+{
+    BlockCaptureWriter* writer = (BlockCaptureWriter*)context;
+
+    for(size_t position = 0; position < size; )
+    {
+        uint32_t frameSize = fieldIndex_payload + frameCodec_payloadSize::read(&frames[position]);
+
+        if( !writer->addFrame(&frames[position], frameSize) )
+            return false;
+
+        position += frameSize;
+    }
+
+    return true;
+}
+
+/*
+ * @brief Generate a whole capture from the spec in specPath, then report how fast it went
+ *
+ * @return exit status
+ */
+static int generateBulk(const char* specPath, const char* outPath, bool blockCapture, uint32_t threadCount)
+{
+    BulkGenerator_Spec spec;
+    char*              specText = readTextFile(specPath);
+
+    if( specText == NULL )
+    {
+        fprintf(stderr, "Error - unable to read %s\n", specPath);
+        return 1;
+    }
+
+    bool specValid = BulkGenerator::parseSpec(specText, &spec);
+
+    free(specText);
+
+    if( !specValid )
+        return 1;
+
+    if( spec.groundTruth && blockCapture )
+    {
+        fprintf(stderr, "Error - faults can only be put in a bare capture, not a block capture\n");
+        return 1;
+    }
+
+    BulkGenerator      generator(&spec, threadCount);
+    CaptureIndexWriter truth;
+    char               truthPath[4096];
+    uint64_t           start   = readNanoseconds();
+    bool               written = false;
+
+    // The messages left intact, as messageParser -i would index them
+    if( spec.groundTruth )
+    {
+        snprintf(truthPath, sizeof(truthPath), "%s.truth", outPath);
+
+        if( !truth.open(truthPath) )
+        {
+            fprintf(stderr, "Error - unable to write %s\n", truthPath);
+            return 1;
+        }
+
+        generator.setGroundTruth(&truth);
+    }
+
+    if( blockCapture )
+    {
+        BlockCaptureWriter writer;
+
+        written =    writer.open(outPath)
+                  && generator.generate(writeBlockChunk, &writer);
+        written = writer.close() && written;
+    }
+    else
+    {
+        int fd = open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if( fd >= 0 )
+        {
+            FrameWriter writer(fd);
+
+            written = generator.generate(writeChunk, &writer);
+            written = (close(fd) == 0) && written;
+        }
+    }
+
+    if( !written )
+    {
+        fprintf(stderr, "Error - unable to write %s\n", outPath);
+        return 1;
+    }
+
+    if( spec.groundTruth && !truth.close() )
+    {
+        fprintf(stderr, "Error - unable to write %s\n", truthPath);
+        return 1;
+    }
+
+    double seconds = (double)(readNanoseconds() - start) / 1e9;
+    double bytes   = (double)generator.getBytesGenerated();
+
+    printf("%llu messages, %.0f bytes of messages in %.3f s, %.1f MB/s\r\n",
+           (unsigned long long)spec.messageCount, bytes, seconds, (seconds > 0) ? bytes / seconds / 1e6 : 0.0);
+
+    if( spec.groundTruth )
+        printf("%llu messages left intact, listed in %s\r\n", (unsigned long long)generator.getIntactCount(), truthPath);
+
+    return 0;
+}
+
+/*
+ * usage: messageGenerator.exe [-b] <output file> <message properties> <command code> <payload...>
+ *        messageGenerator.exe [-b] [-j N] -n <spec file> <output file>
+ *   -b - write a block capture holding the messages instead of the bare messages
+ *   -n - generate many random messages as the JSON spec file describes; see
+ *        BulkGenerator::parseSpec for what it holds. A spec with faults also
+ *        writes <output file>.truth, an index of the messages left intact
+ *   -j - generate them on N threads (0 for one per core, the default)
+ */
 int main(int argc, char *argv[])
 {
     MessageHandler message;
+    bool           blockCapture = false;
+    const char*    specPath     = NULL;
+    uint32_t       threadCount  = 0;
+
+    while( argc >= 2 && argv[1][0] == '-' )
+    {
+        if( strcmp(argv[1], "-b") == 0 )
+        {
+            blockCapture = true;
+
+            argc -= 1;
+            argv += 1;
+        }
+        else if( argc >= 3 && strcmp(argv[1], "-j") == 0 )
+        {
+            threadCount = (uint32_t)atoi(argv[2]);
+
+            argc -= 2;
+            argv += 2;
+        }
+        else if( argc >= 3 && strcmp(argv[1], "-n") == 0 )
+        {
+            specPath = argv[2];
+
+            argc -= 2;
+            argv += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if( specPath )
+    {
+        assert( argc >= 2 );
+
+        if( threadCount == 0 )
+            threadCount = thread::hardware_concurrency();
+
+        if( threadCount == 0 )
+            threadCount = 1;
+
+        return generateBulk(specPath, argv[argvIndex_outFile], blockCapture, threadCount);
+    }
 
     MessageHandler_MessageProperties properties;
 
@@ -72,14 +301,40 @@ int main(int argc, char *argv[])
         assert( false );
     }
 
-    uint8_t* serializedBuffer;
-    uint32_t serializedSize = message.getSerialized(&serializedBuffer);
+    if( blockCapture )
+    {
+        BlockCaptureWriter writer;
+        uint8_t*           serializedBuffer;
+        uint32_t           serializedSize = message.getSerialized(&serializedBuffer);
+
+        if(   !writer.open(argv[argvIndex_outFile])
+           || !writer.addFrame(serializedBuffer, serializedSize)
+           || !writer.close()
+          )
+        {
+            fprintf(stderr, "Error - unable to write %s\n", argv[argvIndex_outFile]);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    int  fd      = open(argv[argvIndex_outFile], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool written = false;
 
-    ofstream dataFile;
-    dataFile.open(argv[argvIndex_outFile], ios::out | ios::binary);
-    dataFile.write((const char*)serializedBuffer, serializedSize);
-    dataFile.flush();
-    dataFile.close();
+    if( fd >= 0 )
+    {
+        FrameWriter writer(fd);
+
+        written = writer.addMessage(&message) && writer.flush();
+        written = (close(fd) == 0) && written;
+    }
+
+    if( !written )
+    {
+        fprintf(stderr, "Error - unable to write %s\n", argv[argvIndex_outFile]);
+        return 1;
+    }
 
     return 0;
 }
@@ -10,40 +10,766 @@
  */
 
 #include "MessageHandler.h"
+#include "MessageSink.h"
+#include "MessageView.h"
+#include "CaptureFile.h"
+#include "ParallelParser.h"
+#include "MessagePipeline.h"
+#include "CaptureIndex.h"
+#include "BlockCapture.h"
+#include "CaptureCodec.h"
+#include "DeviceTable.h"
+#include "FrameCodec.h"
 #include <stdio.h>
 #include <assert.h>
 #include <stdint.h>
-
-#include <iostream>
-#include <fstream>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
 
 using namespace std;
 
+enum
+{
+    argvIndex_inFile   = 1,
+    argvIndex_sink     = 2,
+    argvIndex_sinkFile = 3,
+};
+
+enum
+{
+    outputBufferSize = 1024 * 1024,
+    maxFrameSize     = fieldIndex_payload + UINT16_MAX,
+};
+
+
+
+/*
+ * @brief Text output marks the end of every message it prints
+ */
+class ParsedTextSink : public MessageTextSink
+{
+    public:
+
+        ParsedTextSink(FILE* stream) : MessageTextSink(stream)
+        {
+            this->stream = stream;
+        }
+
+        void frameComplete(MessageHandler* message, MessageView* view)
+        {
+            MessageTextSink::frameComplete(message, view);
+
+            fputs("Full Message Parsed\n\n", this->stream);
+        }
+
+    private:
+        FILE* stream;
+};
+
+static MessageSink* createTextSink(FILE* stream, void* context)
+{
+    return new ParsedTextSink(stream);
+}
+
+static MessageSink* createBinarySink(FILE* stream, void* context)
+{
+    return new MessageBinarySink(stream);
+}
+
+/*
+ * @brief Check whether a verified message is a heartbeat a query selects
+ *
+ * @param frame - the whole message
+ * @param query - heartbeats to select
+ * @return      message selected
+ */
+static bool isFrameSelected(const uint8_t* frame, CaptureIndex_Query* query)
+{
+    MessageHandler_HeartbeatPayload heartbeat;
+
+    if( frameCodec_commandCode::read(frame) != MESSAGE_HANDLER_COMMAND_HEARTBEAT )
+        return false;
+
+    frameCodec_heartbeat::decode(&frame[fieldIndex_payload], &heartbeat);
+
+    return    heartbeat.epochTime_seconds >= query->fromEpoch_seconds
+           && heartbeat.epochTime_seconds <= query->toEpoch_seconds
+           && (!query->matchSerial || heartbeat.serialNumber == query->serialNumber);
+}
+
+/*
+ * @brief Check whether a file is a compressed capture from its header alone
+ *
+ * @param path - capture to check
+ * @return     file starts with a compressed capture header
+ */
+static bool isCompressedFile(const char* path)
+{
+    CaptureFile dataFile;
+    uint8_t     header[captureCodec_headerSize];
+
+    return    dataFile.open(path)
+           && dataFile.readAt(0, header, sizeof(header))
+           && isCompressedCapture(header, sizeof(header));
+}
+
+/*
+ * @brief Parse a block capture held in memory, block by block
+ *        Blocks that fail verification are reported and skipped. With a query,
+ *        blocks that cannot hold a selected heartbeat are not read at all.
+ *
+ * @param[in]  capture        - the whole capture
+ * @param[in]  captureSize    - number of bytes in capture
+ * @param[in]  query          - heartbeats to select, or NULL for every message
+ * @param[in]  threadCount    - threads to parse on when there is no query
+ * @param[in]  sinkFactory    - sink factory for parsing on several threads
+ * @param[in]  sinkFile       - where those sinks write
+ * @param[in]  jsonValidation - how those threads check Set Sar Mode payloads
+ * @param[in]  messageHandler - handler that reports each message on one thread
+ * @param[out] messageCount   - number of messages parsed
+ * @return     capture has a valid block capture layout; nothing is parsed otherwise
+ */
+static bool parseBlockCapture(const uint8_t* capture, uint64_t captureSize, CaptureIndex_Query* query, uint32_t threadCount,
+                              MessageSink_Factory sinkFactory, FILE* sinkFile, MessageHandler_JsonValidation jsonValidation,
+                              MessageHandler* messageHandler, uint64_t* messageCount)
+{
+    BlockCapture blockCapture;
+
+    if( !blockCapture.open(capture, captureSize) )
+        return false;
+
+    vector<ParallelParser_Piece> pieces;
+    BlockCapture_Block           block;
+
+    *messageCount = 0;
+
+    for(uint32_t i = 0; i < blockCapture.getBlockCount(); i++)
+    {
+        blockCapture.getBlock(i, &block);
+
+        if(   query
+           && (   !isCommandInBlock(&block, MESSAGE_HANDLER_COMMAND_HEARTBEAT)
+               || !isEpochInBlock(&block, query->fromEpoch_seconds, query->toEpoch_seconds)
+              )
+          )
+        {
+            continue;
+        }
+
+        if( !blockCapture.verifyBlock(i) )
+        {
+            fprintf(stderr, "Block %u failed verification, skipped\n", i);
+            continue;
+        }
+
+        ParallelParser_Piece piece;
+
+        piece.begin = (uint64_t)(block.frames - capture);
+        piece.end   = piece.begin + block.frameBytes;
+
+        pieces.push_back(piece);
+    }
+
+    if( query == NULL && threadCount > 1 )
+    {
+        // Every block holds whole messages, so blocks are parsed on their own
+        ParallelParser parallelParser(threadCount);
+
+        parallelParser.setSinkFactory(sinkFactory, NULL);
+        parallelParser.setJsonValidation(jsonValidation);
+
+        *messageCount = parallelParser.parsePieces(capture, pieces.data(), pieces.size(), sinkFile);
+        return true;
+    }
+
+    for(size_t i = 0; i < pieces.size(); i++)
+    {
+        uint64_t position = pieces[i].begin;
+
+        while( position < pieces[i].end )
+        {
+            const uint8_t* frame     = &capture[position];
+            size_t         frameSize = (size_t)(pieces[i].end - position);
+            size_t         consumed;
+
+            if( query )
+            {
+                // Verified blocks hold verified messages, so each one's length can be trusted
+                frameSize = fieldIndex_payload + frameCodec_payloadSize::read(frame);
+                position += frameSize;
+
+                if( isFrameSelected(frame, query) && messageHandler->parseBlock(frame, frameSize, &consumed) )
+                    (*messageCount)++;
+            }
+            else
+            {
+                if( messageHandler->parseBlock(frame, frameSize, &consumed) )
+                    (*messageCount)++;
+
+                position += consumed;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * @brief Parse a compressed capture held in memory, decoding it a buffer at a time
+ *
+ * @param[in]  capture        - the whole capture
+ * @param[in]  captureSize    - number of bytes in capture
+ * @param[in]  query          - heartbeats to select, or NULL for every message
+ * @param[in]  messageHandler - handler that reports each message
+ * @param[out] messageCount   - number of messages parsed
+ * @return     capture has a compressed capture header; nothing is parsed otherwise
+ */
+static bool parseCompressedCapture(const uint8_t* capture, uint64_t captureSize, CaptureIndex_Query* query,
+                                   MessageHandler* messageHandler, uint64_t* messageCount)
+{
+    CaptureDecoder decoder;
+
+    if( !decoder.begin(capture, captureSize) )
+        return false;
+
+    vector<uint8_t> frames(outputBufferSize);
+    uint64_t        position = captureCodec_headerSize;
+
+    *messageCount = 0;
+
+    while( position < captureSize )
+    {
+        size_t consumed;
+        size_t produced;
+        bool   valid = decoder.decode(&capture[position], (size_t)(captureSize - position), &consumed, frames.data(), frames.size(), &produced);
+
+        // Decoded messages are whole and back to back
+        for(size_t offset = 0; offset < produced; )
+        {
+            const uint8_t* frame = &frames[offset];
+            size_t         parsed;
+
+            if( query )
+            {
+                // Only verified messages were compressed, so each one's length can be trusted
+                size_t frameSize = fieldIndex_payload + frameCodec_payloadSize::read(frame);
+
+                if( isFrameSelected(frame, query) && messageHandler->parseBlock(frame, frameSize, &parsed) )
+                    (*messageCount)++;
+
+                offset += frameSize;
+                continue;
+            }
+
+            if( messageHandler->parseBlock(frame, produced - offset, &parsed) )
+                (*messageCount)++;
+
+            offset += parsed;
+        }
+
+        position += consumed;
+
+        if( !valid )
+        {
+            fprintf(stderr, "Compressed capture damaged at offset %llu, the rest is skipped\n", (unsigned long long)position);
+            break;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * @brief Compress the verified messages of a capture
+ *
+ * @param capturePath - capture to read
+ * @param outputPath  - compressed capture to write
+ * @return            compressed capture written
+ */
+static bool compressCapture(const char* capturePath, const char* outputPath)
+{
+    CaptureFile    dataFile;
+    CaptureEncoder encoder;
+    MessageHandler handler;
+    FILE*          output = fopen(outputPath, "wb");
+
+    if( output == NULL || !dataFile.open(capturePath) )
+    {
+        if( output )
+            fclose(output);
+
+        return false;
+    }
+
+    vector<uint8_t> record(captureCodec_maxFrameSize + captureCodec_recordOverhead);
+    uint64_t        messageCount   = 0;
+    uint64_t        messageBytes   = 0;
+    uint64_t        compressedSize = encoder.begin(record.data());
+    bool            written        = fwrite(record.data(), 1, (size_t)compressedSize, output) == compressedSize;
+    const uint8_t*  span;
+    size_t          spanSize;
+
+    handler.setSink(NULL);
+
+    while( written && dataFile.nextSpan(&span, &spanSize) )
+    {
+        for(size_t position = 0; written && position < spanSize; )
+        {
+            MessageView view;
+            size_t      consumed;
+            bool        found = handler.parseView(&span[position], spanSize - position, &consumed, &view);
+
+            position += consumed;
+
+            if( !found )
+                continue;
+
+            size_t size = encoder.encodeFrame(view.getFrame(), view.getFrameSize(), record.data());
+
+            written = fwrite(record.data(), 1, size, output) == size;
+
+            messageCount++;
+            messageBytes   += view.getFrameSize();
+            compressedSize += size;
+        }
+    }
+
+    written = (fclose(output) == 0) && written;
+
+    printf("Messages compressed: %llu, %llu bytes to %llu bytes, ratio %.2f\n",
+           (unsigned long long)messageCount, (unsigned long long)messageBytes, (unsigned long long)compressedSize,
+           compressedSize ? (double)messageBytes / compressedSize : 0.0);
+
+    return written;
+}
+
+/*
+ * @brief Parse the heartbeats an index query selects, reading only their frames
+ *        A block capture is searched through its block headers instead of an index,
+ *        and a compressed capture is decoded whole, since its messages have no offsets
+ *        in the file to index.
+ *
+ * @param capturePath    - capture to read
+ * @param query          - heartbeats to select
+ * @param sink           - where each message is reported, NULL to discard them
+ * @param jsonValidation - how Set Sar Mode payloads are checked
+ * @param deviceTable    - table the heartbeats are recorded in, or NULL
+ * @return               number of messages parsed, or -1 if the index could not be built
+ */
+static int64_t parseSelected(const char* capturePath, CaptureIndex_Query* query, MessageSink* sink,
+                             MessageHandler_JsonValidation jsonValidation, DeviceTable* deviceTable)
+{
+    char           indexPath[4096];
+    CaptureIndex   index;
+    CaptureFile    dataFile;
+    MessageHandler messageHandler;
+
+    messageHandler.setSink(sink);
+    messageHandler.setJsonValidation(jsonValidation);
+    messageHandler.setDeviceTable(deviceTable);
+
+    const uint8_t* span;
+    size_t         spanSize;
+    uint64_t       blockMessageCount;
+    uint8_t        header[blockCapture_fileHeaderSize];
+    uint8_t        trailer[blockCapture_trailerSize];
+
+    // Only the ends are read to tell what the capture is; an indexed capture is never mapped whole
+    bool blockCapture =    dataFile.open(capturePath)
+                        && dataFile.getSize() >= sizeof(header) + sizeof(trailer)
+                        && dataFile.readAt(0, header, sizeof(header))
+                        && dataFile.readAt(dataFile.getSize() - sizeof(trailer), trailer, sizeof(trailer))
+                        && BlockCapture::isBlockCaptureEnds(header, trailer);
+
+    if(   (blockCapture || isCompressedFile(capturePath))
+       && dataFile.nextSpan(&span, &spanSize)
+       && spanSize == dataFile.getSize()
+       && (   parseBlockCapture(span, spanSize, query, 1, NULL, NULL, jsonValidation, &messageHandler, &blockMessageCount)
+           || parseCompressedCapture(span, spanSize, query, &messageHandler, &blockMessageCount)
+          )
+      )
+    {
+        return (int64_t)blockMessageCount;
+    }
+
+    snprintf(indexPath, sizeof(indexPath), "%s.idx", capturePath);
+
+    if( !index.build(capturePath, indexPath) || !index.load(indexPath) || !dataFile.open(capturePath) )
+        return -1;
+
+    uint64_t* matches;
+    uint64_t  matchCount = index.select(query, &matches);
+    int64_t   messageCount = 0;
+    uint8_t   frame[maxFrameSize];
+
+    for(uint64_t i = 0; i < matchCount; i++)
+    {
+        CaptureIndex_Entry* entry     = index.getEntry(matches[i]);
+        size_t              frameSize = fieldIndex_payload + entry->payloadLength;
+        size_t              consumed;
+
+        // The frames are not contiguous, so nothing one leaves in a handler may carry into the next
+        MessageHandler frameHandler;
+
+        frameHandler.setSink(sink);
+        frameHandler.setJsonValidation(jsonValidation);
+        frameHandler.setDeviceTable(deviceTable);
+
+        if(   dataFile.readAt(entry->frameOffset, frame, frameSize)
+           && frameHandler.parseBlock(frame, frameSize, &consumed)
+          )
+        {
+            messageCount++;
+        }
+    }
+
+    dataFile.close();
+
+    return messageCount;
+}
+
+/*
+ * @brief Print what a device table recorded, one line per device in serial number order
+ *
+ * @param deviceTable - table to print
+ * @param stream      - where the lines go
+ */
+static void printDevices(DeviceTable* deviceTable, FILE* stream)
+{
+    vector<DeviceTable_Device> devices(deviceTable->getCount());
+
+    devices.resize(deviceTable->snapshot(devices.data(), (uint32_t)devices.size()));
+
+    sort(devices.begin(), devices.end(), [](const DeviceTable_Device& a, const DeviceTable_Device& b)
+    {
+        return a.serialNumber < b.serialNumber;
+    });
+
+    for(size_t i = 0; i < devices.size(); i++)
+    {
+        DeviceTable_Device* device = &devices[i];
+
+        fprintf(stream, "Device %u: %llu heartbeats, seen %u to %u, mode %u after %u transitions, %u out of order\n",
+                device->serialNumber, (unsigned long long)device->heartbeatCount,
+                device->firstSeen_seconds, device->lastSeen_seconds,
+                device->heartbeat.mode, device->modeTransitions, device->outOfOrderCount);
+    }
+
+    fprintf(stream, "Devices: %u, heartbeats dropped: %llu\n",
+            (uint32_t)devices.size(), (unsigned long long)deviceTable->getDroppedCount());
+}
+
+/*
+ * usage: messageParser.exe [-j threads | -p] [-i | -c output] [-s serial] [-t from:to] [-v check] [-d] <capture> [text|null|binary] [binary output file]
+ *   -j     - parse on this many threads, 0 for one per core; the output is the same
+ *            as parsing on one thread. Captures that cannot be mapped whole are
+ *            always parsed on one thread.
+ *   -p     - read, parse and write output on separate threads, then report on
+ *            how each stage kept up to stderr
+ *   -i     - build or update the index <capture>.idx, then print the number of
+ *            messages in it
+ *   -c     - write the verified messages of the capture to a compressed capture,
+ *            then print the compression ratio; compressed captures are
+ *            recognized and decoded when they are parsed, and rejected by
+ *            -i, -c and -p
+ *   -s     - parse only the heartbeats from this serial number
+ *   -t     - parse only the heartbeats with an epoch time from..to, inclusive
+ *            -s and -t build or update the index first, then read only the
+ *            frames it selects; a compressed capture is decoded whole instead
+ *   -v     - how Set Sar Mode JSON is checked as it is decoded: structural rejects
+ *            what cJSON would without building a tree (default), parse builds the
+ *            tree for every message, none accepts any text
+ *   -d     - record every heartbeat in a DeviceTable, then print a summary of each
+ *            device after the messages; the capture is parsed on one thread, so
+ *            -j and -p are ignored
+ *   text   - print every message as it is parsed (default)
+ *   null   - parse only, then print the number of messages
+ *   binary - write MessageBinarySink records to the output file, or stdout
+ */
 int main(int argc, char *argv[])
 {
+    uint32_t threadCount = 1;
+    bool     pipelined   = false;
+    bool     indexOnly   = false;
+    bool     selected    = false;
+    bool     summarize   = false;
+
+    MessageHandler_JsonValidation jsonValidation = messageHandler_jsonStructural;
+
+    const char* compressedPath = NULL;
+
+    CaptureIndex_Query query = { false, 0, 0, UINT32_MAX };
+
+    while( argc >= 2 && argv[1][0] == '-' )
+    {
+        if( argc >= 3 && strcmp(argv[1], "-j") == 0 )
+        {
+            threadCount = (uint32_t)atoi(argv[2]);
+
+            if( threadCount == 0 )
+                threadCount = thread::hardware_concurrency();
+
+            if( threadCount == 0 )
+                threadCount = 1;
+
+            argc -= 2;
+            argv += 2;
+        }
+        else if( strcmp(argv[1], "-p") == 0 )
+        {
+            pipelined = true;
+
+            argc -= 1;
+            argv += 1;
+        }
+        else if( strcmp(argv[1], "-i") == 0 )
+        {
+            indexOnly = true;
+
+            argc -= 1;
+            argv += 1;
+        }
+        else if( argc >= 3 && strcmp(argv[1], "-c") == 0 )
+        {
+            compressedPath = argv[2];
+
+            argc -= 2;
+            argv += 2;
+        }
+        else if( argc >= 3 && strcmp(argv[1], "-s") == 0 )
+        {
+            query.matchSerial  = true;
+            query.serialNumber = (uint32_t)strtoul(argv[2], NULL, 0);
+            selected           = true;
+
+            argc -= 2;
+            argv += 2;
+        }
+        else if( argc >= 3 && strcmp(argv[1], "-t") == 0 )
+        {
+            char* to;
+
+            query.fromEpoch_seconds = (uint32_t)strtoul(argv[2], &to, 0);
+            query.toEpoch_seconds   = (*to == ':') ? (uint32_t)strtoul(to + 1, NULL, 0) : UINT32_MAX;
+            selected                = true;
+
+            argc -= 2;
+            argv += 2;
+        }
+        else if( strcmp(argv[1], "-d") == 0 )
+        {
+            summarize = true;
+
+            argc -= 1;
+            argv += 1;
+        }
+        else if( argc >= 3 && strcmp(argv[1], "-v") == 0 )
+        {
+            if( strcmp(argv[2], "parse") == 0 )
+                jsonValidation = messageHandler_jsonParse;
+            else if( strcmp(argv[2], "none") == 0 )
+                jsonValidation = messageHandler_jsonUnchecked;
+            else
+                jsonValidation = messageHandler_jsonStructural;
+
+            argc -= 2;
+            argv += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
     assert( argc >= 2 );
 
+    // The table has one updating thread, the one parsing through messageHandler
+    if( summarize )
+    {
+        threadCount = 1;
+        pipelined   = false;
+    }
+
+    // These read the capture's own bytes, which in a compressed capture are not messages
+    if( (indexOnly || compressedPath || pipelined) && isCompressedFile(argv[argvIndex_inFile]) )
+    {
+        fprintf(stderr, "Error - %s is a compressed capture; %s cannot read it\n", argv[argvIndex_inFile],
+                indexOnly ? "-i" : (compressedPath ? "-c" : "-p"));
+        return 1;
+    }
+
+    if( indexOnly )
+    {
+        char         indexPath[4096];
+        CaptureIndex index;
+
+        snprintf(indexPath, sizeof(indexPath), "%s.idx", argv[argvIndex_inFile]);
+
+        if( !index.build(argv[argvIndex_inFile], indexPath) || !index.load(indexPath) )
+        {
+            fprintf(stderr, "Error - unable to index %s\n", argv[argvIndex_inFile]);
+            return 1;
+        }
+
+        printf("Messages indexed: %llu\n", (unsigned long long)index.getCount());
+
+        return 0;
+    }
+
+    if( compressedPath )
+    {
+        if( !compressCapture(argv[argvIndex_inFile], compressedPath) )
+        {
+            fprintf(stderr, "Error - unable to compress %s to %s\n", argv[argvIndex_inFile], compressedPath);
+            return 1;
+        }
+
+        return 0;
+    }
+
     MessageHandler messageHandler;
+    MessageSink*   sink     = NULL;
+    FILE*          sinkFile = stdout;
+    uint64_t       messageCount = 0;
 
-    ifstream dataFile;
-    dataFile.open (argv[1], ios::binary);
+    MessageSink_Factory sinkFactory = NULL;
 
-    if( dataFile.is_open() )
+    // Nothing below flushes per line, so give stdout a buffer worth filling
+    setvbuf(stdout, NULL, _IOFBF, outputBufferSize);
+
+    const char* sinkName = (argc > argvIndex_sink) ? argv[argvIndex_sink] : "text";
+
+    if( strcmp(sinkName, "binary") == 0 )
     {
-        char byte;
+        if( argc > argvIndex_sinkFile )
+            sinkFile = fopen(argv[argvIndex_sinkFile], "wb");
 
-        while( !dataFile.eof() )
+        if( sinkFile == NULL )
         {
-            dataFile.get(byte);
+            fprintf(stderr, "Error - unable to open %s\n", argv[argvIndex_sinkFile]);
+            return 1;
+        }
 
-            if( messageHandler.parseByte(byte) )
+        sinkFactory = createBinarySink;
+    }
+    else if( strcmp(sinkName, "null") != 0 )
+    {
+        sinkFactory = createTextSink;
+    }
+
+    if( sinkFactory )
+        sink = sinkFactory(sinkFile, NULL);
+
+    DeviceTable* deviceTable = summarize ? new DeviceTable() : NULL;
+
+    messageHandler.setSink(sink);
+    messageHandler.setJsonValidation(jsonValidation);
+    messageHandler.setDeviceTable(deviceTable);
+
+    CaptureFile dataFile;
+
+    if( selected )
+    {
+        int64_t selectedCount = parseSelected(argv[argvIndex_inFile], &query, sink, jsonValidation, deviceTable);
+
+        if( selectedCount < 0 )
+        {
+            fprintf(stderr, "Error - unable to index %s\n", argv[argvIndex_inFile]);
+            return 1;
+        }
+
+        messageCount = (uint64_t)selectedCount;
+    }
+    else if( dataFile.open(argv[argvIndex_inFile]) )
+    {
+        const uint8_t* span;
+        size_t         spanSize;
+        bool           spanRead = false;
+
+        if( pipelined )
+        {
+            MessagePipeline       pipeline;
+            MessagePipeline_Stats stats;
+
+            pipeline.setSinkFactory(sinkFactory, NULL);
+            pipeline.setJsonValidation(jsonValidation);
+
+            messageCount = pipeline.run(&dataFile, sinkFile);
+
+            pipeline.getStats(&stats);
+
+            fprintf(stderr, "Pipeline: %llu bytes read\n", (unsigned long long)stats.bytesRead);
+            fprintf(stderr, "  reader:   %llu stalls waiting for a free buffer\n", (unsigned long long)stats.readerStalls);
+            fprintf(stderr, "  input:    peak depth %u of %u\n", stats.inputPeakDepth, messagePipeline_bufferCount);
+            fprintf(stderr, "  parser:   %llu idles waiting for input, %llu stalls waiting for the consumer\n",
+                    (unsigned long long)stats.parserIdles, (unsigned long long)stats.parserStalls);
+            fprintf(stderr, "  output:   peak depth %u of %u, %llu deferrals while full\n",
+                    stats.outputPeakDepth, messagePipeline_outputRingSize, (unsigned long long)stats.outputDeferrals);
+        }
+        else
+        {
+            spanRead = dataFile.nextSpan(&span, &spanSize);
+        }
+
+        if(   spanRead
+           && spanSize == dataFile.getSize()
+           && (   parseBlockCapture(span, spanSize, NULL, threadCount, sinkFactory, sinkFile, jsonValidation, &messageHandler, &messageCount)
+               || parseCompressedCapture(span, spanSize, NULL, &messageHandler, &messageCount)
+              )
+          )
+        {
+            spanRead = false;
+        }
+
+        if( spanRead && threadCount > 1 && spanSize == dataFile.getSize() )
+        {
+            // The whole capture is mapped at once, so it can be split between threads
+            ParallelParser parallelParser(threadCount);
+
+            parallelParser.setSinkFactory(sinkFactory, NULL);
+            parallelParser.setJsonValidation(jsonValidation);
+
+            messageCount = parallelParser.parse(span, spanSize, sinkFile);
+            spanRead     = false;
+        }
+
+        for( ; spanRead; spanRead = dataFile.nextSpan(&span, &spanSize) )
+        {
+            const uint8_t* block     = span;
+            size_t         remaining = spanSize;
+
+            while( remaining > 0 )
             {
-                cout << "Full Message Parsed"  << endl << endl;
+                size_t consumed;
+
+                if( messageHandler.parseBlock(block, remaining, &consumed) )
+                    messageCount++;
+
+                block     += consumed;
+                remaining -= consumed;
             }
         }
         dataFile.close();
     }
 
+    // Text already marks every message, and binary records on stdout must not be mixed with text
+    if( sinkFactory == NULL || sinkFile != stdout )
+        printf("Messages parsed: %llu\n", (unsigned long long)messageCount);
+
+    // After the messages, and off stdout when binary records are going there
+    if( deviceTable )
+        printDevices(deviceTable, (sinkFactory == createBinarySink && sinkFile == stdout) ? stderr : stdout);
+
+    if( sinkFile != stdout )
+        fclose(sinkFile);
+
+    fflush(stdout);
+
+    delete sink;
+    delete deviceTable;
+
     return 0;
 }
 